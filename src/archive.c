@@ -0,0 +1,791 @@
+// Copyright (c) Christopher D. Dickson <cdd@matoya.group>
+//
+// This Source Code Form is subject to the terms of the MIT License.
+// If a copy of the MIT License was not distributed with this file,
+// You can obtain one at https://spdx.org/licenses/MIT.html.
+
+#include "archive.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "matoya.h"
+#include "fmap.h"
+
+#define ARCHIVE_CACHE_MAX   16
+#define ARCHIVE_CACHE_BYTES (256 * 1024 * 1024)
+
+#define INFLATE_FAST_BITS 10
+#define INFLATE_FAST_MASK ((1 << INFLATE_FAST_BITS) - 1)
+
+#define ZIP_SIG_LOCAL   0x04034b50
+#define ZIP_SIG_CENTRAL 0x02014b50
+#define ZIP_SIG_END     0x06054b50
+
+enum archive_method {
+	ARCHIVE_METHOD_STORE   = 0,
+	ARCHIVE_METHOD_DEFLATE = 8,
+};
+
+struct archive_member {
+	const uint8_t *data;
+	size_t csize;
+	size_t size;
+	uint32_t crc;
+	uint16_t method;
+};
+
+typedef bool (*ARCHIVE_ENTRY_FUNC)(const char *name, const struct archive_member *m, void *opaque);
+
+struct archive_entry {
+	void *data;
+	size_t size;
+	uint32_t crc;
+	uint64_t stamp;
+};
+
+static MTY_Atomic32 ARCHIVE_LOCK;
+static struct archive_entry ARCHIVE_CACHE[ARCHIVE_CACHE_MAX];
+static uint64_t ARCHIVE_STAMP;
+
+
+// Inflate (RFC 1951), decodes straight into the destination buffer
+
+struct inflate_huff {
+	uint16_t fast[1 << INFLATE_FAST_BITS];
+	uint16_t count[16];
+	uint16_t symbol[288];
+};
+
+struct inflate {
+	const uint8_t *in;
+	size_t in_size;
+	size_t in_pos;
+	uint64_t bits;
+	uint32_t nbits;
+	bool error;
+
+	uint8_t *out;
+	size_t out_size;
+	size_t out_pos;
+
+	struct inflate_huff lit;
+	struct inflate_huff dist;
+};
+
+static const uint16_t INFLATE_LEN_BASE[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+};
+
+static const uint8_t INFLATE_LEN_EXTRA[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+};
+
+static const uint16_t INFLATE_DIST_BASE[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577,
+};
+
+static const uint8_t INFLATE_DIST_EXTRA[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+};
+
+static const uint8_t INFLATE_ORDER[19] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15,
+};
+
+static void inflate_refill(struct inflate *s)
+{
+	while (s->nbits <= 56 && s->in_pos < s->in_size) {
+		s->bits |= (uint64_t) s->in[s->in_pos++] << s->nbits;
+		s->nbits += 8;
+	}
+}
+
+static uint32_t inflate_bits(struct inflate *s, uint32_t n)
+{
+	if (s->nbits < n) {
+		inflate_refill(s);
+
+		if (s->nbits < n) {
+			s->error = true;
+			return 0;
+		}
+	}
+
+	uint32_t v = (uint32_t) (s->bits & ((1ull << n) - 1));
+	s->bits >>= n;
+	s->nbits -= n;
+
+	return v;
+}
+
+static bool inflate_build(struct inflate_huff *h, const uint8_t *lens, uint32_t n)
+{
+	memset(h->count, 0, sizeof(h->count));
+	memset(h->fast, 0, sizeof(h->fast));
+
+	for (uint32_t x = 0; x < n; x++)
+		h->count[lens[x]]++;
+
+	h->count[0] = 0;
+
+	// Over-subscribed codes are invalid, incomplete codes are allowed
+	int32_t left = 1;
+	for (uint32_t len = 1; len < 16; len++) {
+		left = (left << 1) - h->count[len];
+		if (left < 0)
+			return false;
+	}
+
+	uint16_t offs[16] = {0};
+	uint16_t next[16] = {0};
+
+	for (uint32_t len = 1; len < 15; len++) {
+		offs[len + 1] = offs[len] + h->count[len];
+		next[len + 1] = (uint16_t) ((next[len] + h->count[len]) << 1);
+	}
+
+	for (uint32_t x = 0; x < n; x++) {
+		uint32_t len = lens[x];
+		if (len == 0)
+			continue;
+
+		h->symbol[offs[len]++] = (uint16_t) x;
+
+		uint32_t code = next[len]++;
+		if (len > INFLATE_FAST_BITS)
+			continue;
+
+		uint32_t rev = 0;
+		for (uint32_t y = 0; y < len; y++)
+			rev |= ((code >> y) & 1) << (len - 1 - y);
+
+		for (uint32_t y = rev; y < (1 << INFLATE_FAST_BITS); y += 1 << len)
+			h->fast[y] = (uint16_t) (len << 9 | x);
+	}
+
+	return true;
+}
+
+static int32_t inflate_decode(struct inflate *s, const struct inflate_huff *h)
+{
+	if (s->nbits < 16)
+		inflate_refill(s);
+
+	uint16_t e = h->fast[s->bits & INFLATE_FAST_MASK];
+	uint32_t len = e >> 9;
+
+	if (e && len <= s->nbits) {
+		s->bits >>= len;
+		s->nbits -= len;
+		return e & 0x1FF;
+	}
+
+	// Long codes, canonical walk one bit at a time
+	int32_t code = 0;
+	int32_t first = 0;
+	int32_t index = 0;
+
+	for (len = 1; len < 16 && s->nbits > 0; len++) {
+		code |= (int32_t) (s->bits & 1);
+		s->bits >>= 1;
+		s->nbits--;
+
+		int32_t count = h->count[len];
+		if (code - count < first)
+			return h->symbol[index + (code - first)];
+
+		index += count;
+		first = (first + count) << 1;
+		code <<= 1;
+	}
+
+	return -1;
+}
+
+static bool inflate_stored(struct inflate *s)
+{
+	inflate_bits(s, s->nbits & 7);
+
+	uint32_t len = inflate_bits(s, 16);
+	uint32_t nlen = inflate_bits(s, 16);
+
+	if (s->error || len != (~nlen & 0xFFFF) || len > s->out_size - s->out_pos)
+		return false;
+
+	// Drain whatever is left in the bit buffer before copying directly
+	for (; len > 0 && s->nbits >= 8; len--)
+		s->out[s->out_pos++] = (uint8_t) inflate_bits(s, 8);
+
+	if (len > s->in_size - s->in_pos)
+		return false;
+
+	memcpy(s->out + s->out_pos, s->in + s->in_pos, len);
+	s->out_pos += len;
+	s->in_pos += len;
+
+	return true;
+}
+
+static bool inflate_codes(struct inflate *s)
+{
+	while (true) {
+		int32_t sym = inflate_decode(s, &s->lit);
+
+		if (sym < 0)
+			return false;
+
+		if (sym < 256) {
+			if (s->out_pos >= s->out_size)
+				return false;
+
+			s->out[s->out_pos++] = (uint8_t) sym;
+
+		} else if (sym == 256) {
+			return !s->error;
+
+		} else {
+			sym -= 257;
+			if (sym >= 29)
+				return false;
+
+			size_t len = INFLATE_LEN_BASE[sym] + inflate_bits(s, INFLATE_LEN_EXTRA[sym]);
+
+			int32_t dsym = inflate_decode(s, &s->dist);
+			if (dsym < 0 || dsym >= 30)
+				return false;
+
+			size_t dist = INFLATE_DIST_BASE[dsym] + inflate_bits(s, INFLATE_DIST_EXTRA[dsym]);
+
+			if (s->error || dist > s->out_pos || len > s->out_size - s->out_pos)
+				return false;
+
+			uint8_t *dst = s->out + s->out_pos;
+			const uint8_t *src = dst - dist;
+
+			if (dist >= len) {
+				memcpy(dst, src, len);
+
+			} else {
+				for (size_t x = 0; x < len; x++)
+					dst[x] = src[x];
+			}
+
+			s->out_pos += len;
+		}
+	}
+}
+
+static bool inflate_fixed(struct inflate *s)
+{
+	uint8_t lens[288];
+
+	memset(lens, 8, 144);
+	memset(lens + 144, 9, 112);
+	memset(lens + 256, 7, 24);
+	memset(lens + 280, 8, 8);
+
+	if (!inflate_build(&s->lit, lens, 288))
+		return false;
+
+	memset(lens, 5, 30);
+
+	if (!inflate_build(&s->dist, lens, 30))
+		return false;
+
+	return inflate_codes(s);
+}
+
+static bool inflate_dynamic(struct inflate *s)
+{
+	uint32_t nlen = inflate_bits(s, 5) + 257;
+	uint32_t ndist = inflate_bits(s, 5) + 1;
+	uint32_t ncode = inflate_bits(s, 4) + 4;
+
+	if (s->error || nlen > 286 || ndist > 30)
+		return false;
+
+	uint8_t lens[320] = {0};
+
+	for (uint32_t x = 0; x < ncode; x++)
+		lens[INFLATE_ORDER[x]] = (uint8_t) inflate_bits(s, 3);
+
+	// The code length code is decoded with the literal table as scratch
+	if (!inflate_build(&s->lit, lens, 19))
+		return false;
+
+	uint32_t index = 0;
+
+	while (index < nlen + ndist) {
+		int32_t sym = inflate_decode(s, &s->lit);
+		if (sym < 0)
+			return false;
+
+		if (sym < 16) {
+			lens[index++] = (uint8_t) sym;
+			continue;
+		}
+
+		uint8_t len = 0;
+		uint32_t rep = 0;
+
+		if (sym == 16) {
+			if (index == 0)
+				return false;
+
+			len = lens[index - 1];
+			rep = 3 + inflate_bits(s, 2);
+
+		} else if (sym == 17) {
+			rep = 3 + inflate_bits(s, 3);
+
+		} else {
+			rep = 11 + inflate_bits(s, 7);
+		}
+
+		if (s->error || index + rep > nlen + ndist)
+			return false;
+
+		memset(lens + index, len, rep);
+		index += rep;
+	}
+
+	if (lens[256] == 0)
+		return false;
+
+	if (!inflate_build(&s->lit, lens, nlen))
+		return false;
+
+	if (!inflate_build(&s->dist, lens + nlen, ndist))
+		return false;
+
+	return inflate_codes(s);
+}
+
+static bool archive_inflate(const void *in, size_t in_size, void *out, size_t out_size)
+{
+	struct inflate *s = MTY_Alloc(1, sizeof(struct inflate));
+	s->in = in;
+	s->in_size = in_size;
+	s->out = out;
+	s->out_size = out_size;
+
+	bool r = false;
+	bool last = false;
+
+	while (!last) {
+		last = inflate_bits(s, 1);
+		uint32_t type = inflate_bits(s, 2);
+
+		if (s->error)
+			goto except;
+
+		bool ok = type == 0 ? inflate_stored(s) : type == 1 ? inflate_fixed(s) :
+			type == 2 ? inflate_dynamic(s) : false;
+
+		if (!ok)
+			goto except;
+	}
+
+	r = s->out_pos == s->out_size;
+
+	except:
+
+	MTY_Free(s);
+
+	return r;
+}
+
+
+// Containers
+
+static uint16_t archive_le16(const uint8_t *p)
+{
+	return (uint16_t) (p[0] | p[1] << 8);
+}
+
+static uint32_t archive_le32(const uint8_t *p)
+{
+	return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static bool archive_is_gz(const char *path)
+{
+	const char *ext = MTY_GetFileExtension(path);
+
+	return ext && MTY_Strcasecmp(ext, "gz") == 0;
+}
+
+static bool archive_zip_entries(const uint8_t *buf, size_t size, ARCHIVE_ENTRY_FUNC func, void *opaque)
+{
+	if (size < 22)
+		return false;
+
+	// End of central directory, possibly followed by a comment
+	size_t end = size - 22;
+	size_t min = end > 0xFFFF ? end - 0xFFFF : 0;
+
+	while (archive_le32(buf + end) != ZIP_SIG_END) {
+		if (end == min)
+			return false;
+
+		end--;
+	}
+
+	uint32_t n = archive_le16(buf + end + 10);
+	size_t pos = archive_le32(buf + end + 16);
+
+	for (uint32_t x = 0; x < n; x++) {
+		if (pos + 46 > size || archive_le32(buf + pos) != ZIP_SIG_CENTRAL)
+			return false;
+
+		uint16_t name_len = archive_le16(buf + pos + 28);
+		size_t next = pos + 46 + name_len + archive_le16(buf + pos + 30) + archive_le16(buf + pos + 32);
+
+		if (next > size)
+			return false;
+
+		struct archive_member m = {0};
+		m.method = archive_le16(buf + pos + 10);
+		m.crc = archive_le32(buf + pos + 16);
+		m.csize = archive_le32(buf + pos + 20);
+		m.size = archive_le32(buf + pos + 24);
+
+		size_t local = archive_le32(buf + pos + 42);
+
+		char name[MTY_PATH_MAX];
+		bool valid = name_len > 0 && name_len < MTY_PATH_MAX && buf[pos + 46 + name_len - 1] != '/' &&
+			(m.method == ARCHIVE_METHOD_STORE || m.method == ARCHIVE_METHOD_DEFLATE) &&
+			m.size > 0 && m.csize != UINT32_MAX && m.size != UINT32_MAX && local + 30 <= size &&
+			archive_le32(buf + local) == ZIP_SIG_LOCAL;
+
+		if (valid) {
+			memcpy(name, buf + pos + 46, name_len);
+			name[name_len] = '\0';
+
+			size_t data = local + 30 + archive_le16(buf + local + 26) + archive_le16(buf + local + 28);
+
+			if (data <= size && m.csize <= size - data) {
+				m.data = buf + data;
+
+				if (func(name, &m, opaque))
+					return true;
+			}
+		}
+
+		pos = next;
+	}
+
+	return false;
+}
+
+static bool archive_gz_entries(const char *path, const uint8_t *buf, size_t size,
+	ARCHIVE_ENTRY_FUNC func, void *opaque)
+{
+	if (size < 18 || buf[0] != 0x1F || buf[1] != 0x8B || buf[2] != ARCHIVE_METHOD_DEFLATE)
+		return false;
+
+	uint8_t flags = buf[3];
+	size_t pos = 10;
+
+	char name[MTY_PATH_MAX];
+	snprintf(name, MTY_PATH_MAX, "%s", MTY_GetFileName(path, false));
+
+	// FEXTRA
+	if (flags & 0x04) {
+		if (pos + 2 > size)
+			return false;
+
+		pos += 2 + archive_le16(buf + pos);
+	}
+
+	// FNAME
+	if (flags & 0x08) {
+		size_t start = pos;
+
+		while (pos < size && buf[pos] != 0)
+			pos++;
+
+		if (pos - start > 0 && pos - start < MTY_PATH_MAX) {
+			memcpy(name, buf + start, pos - start);
+			name[pos - start] = '\0';
+		}
+
+		pos++;
+	}
+
+	// FCOMMENT
+	if (flags & 0x10) {
+		while (pos < size && buf[pos] != 0)
+			pos++;
+
+		pos++;
+	}
+
+	// FHCRC
+	if (flags & 0x02)
+		pos += 2;
+
+	if (pos + 8 > size)
+		return false;
+
+	struct archive_member m = {0};
+	m.method = ARCHIVE_METHOD_DEFLATE;
+	m.data = buf + pos;
+	m.csize = size - 8 - pos;
+	m.crc = archive_le32(buf + size - 8);
+	m.size = archive_le32(buf + size - 4);
+
+	return m.size > 0 && func(name, &m, opaque);
+}
+
+static bool archive_entries(const char *path, struct fmap *fm, ARCHIVE_ENTRY_FUNC func, void *opaque)
+{
+	const uint8_t *buf = fmap_get_data(fm);
+	size_t size = fmap_get_size(fm);
+
+	return archive_is_gz(path) ? archive_gz_entries(path, buf, size, func, opaque) :
+		archive_zip_entries(buf, size, func, opaque);
+}
+
+static bool archive_extract(const struct archive_member *m, void *data)
+{
+	if (m->method == ARCHIVE_METHOD_STORE) {
+		if (m->csize != m->size)
+			return false;
+
+		memcpy(data, m->data, m->size);
+
+	} else if (!archive_inflate(m->data, m->csize, data, m->size)) {
+		return false;
+	}
+
+	return MTY_CRC32(0, data, m->size) == m->crc;
+}
+
+
+// Cache, keyed by the member CRC and size stored in the archive so hits never
+// touch the compressed data. Entries are never handed out, every reader gets
+// its own copy
+
+static void archive_lock(void)
+{
+	while (!MTY_Atomic32CAS(&ARCHIVE_LOCK, 0, 1))
+		MTY_Sleep(0);
+}
+
+static void archive_unlock(void)
+{
+	MTY_Atomic32Set(&ARCHIVE_LOCK, 0);
+}
+
+static struct archive_entry *archive_cache_find(uint32_t crc, size_t size)
+{
+	for (uint32_t x = 0; x < ARCHIVE_CACHE_MAX; x++) {
+		struct archive_entry *e = &ARCHIVE_CACHE[x];
+
+		if (e->data && e->crc == crc && e->size == size)
+			return e;
+	}
+
+	return NULL;
+}
+
+static void archive_cache_evict(size_t incoming)
+{
+	while (true) {
+		size_t total = incoming;
+		struct archive_entry *lru = NULL;
+		bool full = true;
+
+		for (uint32_t x = 0; x < ARCHIVE_CACHE_MAX; x++) {
+			struct archive_entry *e = &ARCHIVE_CACHE[x];
+
+			if (!e->data) {
+				full = false;
+				continue;
+			}
+
+			total += e->size;
+
+			if (!lru || e->stamp < lru->stamp)
+				lru = e;
+		}
+
+		if ((!full && total <= ARCHIVE_CACHE_BYTES) || !lru)
+			break;
+
+		MTY_Free(lru->data);
+		memset(lru, 0, sizeof(struct archive_entry));
+	}
+}
+
+static bool archive_cache_insert(void *data, size_t size, uint32_t crc)
+{
+	archive_cache_evict(size);
+
+	for (uint32_t x = 0; x < ARCHIVE_CACHE_MAX; x++) {
+		struct archive_entry *e = &ARCHIVE_CACHE[x];
+
+		if (!e->data) {
+			e->data = data;
+			e->size = size;
+			e->crc = crc;
+			e->stamp = ++ARCHIVE_STAMP;
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+// Public
+
+struct archive_find {
+	const char *target;
+	ARCHIVE_FILTER filter;
+	void *opaque;
+	char *member;
+	size_t size;
+	struct archive_member m;
+};
+
+static bool archive_find_func(const char *name, const struct archive_member *m, void *opaque)
+{
+	struct archive_find *find = opaque;
+
+	bool match = find->target ? strcmp(name, find->target) == 0 :
+		find->filter(name, find->opaque);
+
+	if (match) {
+		if (find->member)
+			snprintf(find->member, find->size, "%s", name);
+
+		find->m = *m;
+	}
+
+	return match;
+}
+
+bool archive_is_supported(const char *path)
+{
+	const char *ext = MTY_GetFileExtension(path);
+
+	return ext && (MTY_Strcasecmp(ext, "zip") == 0 || MTY_Strcasecmp(ext, "gz") == 0);
+}
+
+const char *archive_get_member(const char *path)
+{
+	const char *sep = strrchr(path, ARCHIVE_SEPARATOR);
+	if (!sep)
+		return NULL;
+
+	char archive[MTY_PATH_MAX];
+	snprintf(archive, MTY_PATH_MAX, "%.*s", (int) (sep - path), path);
+
+	return archive_is_supported(archive) ? sep + 1 : NULL;
+}
+
+bool archive_find_member(const char *path, ARCHIVE_FILTER filter, void *opaque,
+	char *member, size_t size)
+{
+	struct archive_find find = {0};
+	find.filter = filter;
+	find.opaque = opaque;
+	find.member = member;
+	find.size = size;
+
+	struct fmap *fm = fmap_open(path, false);
+	if (!fm)
+		return false;
+
+	bool r = archive_entries(path, fm, archive_find_func, &find);
+
+	fmap_close(&fm);
+
+	return r;
+}
+
+void *archive_read(const char *path, size_t *size)
+{
+	const char *member = archive_get_member(path);
+	if (!member)
+		return NULL;
+
+	char archive[MTY_PATH_MAX];
+	snprintf(archive, MTY_PATH_MAX, "%.*s", (int) (member - path - 1), path);
+
+	struct archive_find find = {0};
+	find.target = member;
+
+	// Only the directory is touched here, compressed data is paged in on a miss
+	struct fmap *fm = fmap_open(archive, false);
+	if (!fm)
+		return NULL;
+
+	void *data = NULL;
+
+	if (!archive_entries(archive, fm, archive_find_func, &find))
+		goto except;
+
+	archive_lock();
+
+	struct archive_entry *e = archive_cache_find(find.m.crc, find.m.size);
+	if (e) {
+		e->stamp = ++ARCHIVE_STAMP;
+		data = MTY_Dup(e->data, e->size);
+	}
+
+	archive_unlock();
+
+	if (data)
+		goto except;
+
+	data = MTY_Alloc(find.m.size, 1);
+
+	if (!archive_extract(&find.m, data)) {
+		MTY_Free(data);
+		data = NULL;
+		goto except;
+	}
+
+	void *cached = MTY_Dup(data, find.m.size);
+
+	archive_lock();
+
+	if (!archive_cache_insert(cached, find.m.size, find.m.crc))
+		MTY_Free(cached);
+
+	archive_unlock();
+
+	except:
+
+	fmap_close(&fm);
+
+	if (data)
+		*size = find.m.size;
+
+	return data;
+}
+
+void archive_clear_cache(void)
+{
+	archive_lock();
+
+	for (uint32_t x = 0; x < ARCHIVE_CACHE_MAX; x++) {
+		struct archive_entry *e = &ARCHIVE_CACHE[x];
+
+		if (e->data) {
+			MTY_Free(e->data);
+			memset(e, 0, sizeof(struct archive_entry));
+		}
+	}
+
+	archive_unlock();
+}
@@ -0,0 +1,23 @@
+// Copyright (c) Christopher D. Dickson <cdd@matoya.group>
+//
+// This Source Code Form is subject to the terms of the MIT License.
+// If a copy of the MIT License was not distributed with this file,
+// You can obtain one at https://spdx.org/licenses/MIT.html.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Archive members are addressed as "path/to/archive.zip#member.ext"
+#define ARCHIVE_SEPARATOR '#'
+
+typedef bool (*ARCHIVE_FILTER)(const char *name, void *opaque);
+
+bool archive_is_supported(const char *path);
+const char *archive_get_member(const char *path);
+bool archive_find_member(const char *path, ARCHIVE_FILTER filter, void *opaque,
+	char *member, size_t size);
+void *archive_read(const char *path, size_t *size);
+void archive_clear_cache(void);
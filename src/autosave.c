@@ -0,0 +1,182 @@
+// Copyright (c) Christopher D. Dickson <cdd@matoya.group>
+//
+// This Source Code Form is subject to the terms of the MIT License.
+// If a copy of the MIT License was not distributed with this file,
+// You can obtain one at https://spdx.org/licenses/MIT.html.
+
+#include "autosave.h"
+
+#include <string.h>
+
+#include "matoya.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+	#define AUTOSAVE_SSE2
+	#include <emmintrin.h>
+
+#elif defined(__aarch64__) || defined(_M_ARM64)
+	#define AUTOSAVE_NEON
+	#include <arm_neon.h>
+#endif
+
+#define AUTOSAVE_LANES 4
+#define AUTOSAVE_ALIGN 64
+
+// SRAM is hashed a slice per frame so a full pass is spread over roughly a
+// second, the hash is a pair of Fletcher style running sums per 32-bit lane
+struct autosave {
+	const void *sram;
+	size_t size;
+	size_t pos;
+
+	uint32_t sum1[AUTOSAVE_LANES];
+	uint32_t sum2[AUTOSAVE_LANES];
+
+	uint64_t hash;
+	bool baseline;
+};
+
+
+// Kernels, n is a multiple of 16
+
+#if defined(AUTOSAVE_SSE2)
+
+static void autosave_sum(const uint8_t *p, size_t n, uint32_t *sum1, uint32_t *sum2)
+{
+	__m128i a = _mm_loadu_si128((const __m128i *) sum1);
+	__m128i b = _mm_loadu_si128((const __m128i *) sum2);
+
+	for (size_t x = 0; x < n; x += 16) {
+		a = _mm_add_epi32(a, _mm_loadu_si128((const __m128i *) (p + x)));
+		b = _mm_add_epi32(b, a);
+	}
+
+	_mm_storeu_si128((__m128i *) sum1, a);
+	_mm_storeu_si128((__m128i *) sum2, b);
+}
+
+#elif defined(AUTOSAVE_NEON)
+
+static void autosave_sum(const uint8_t *p, size_t n, uint32_t *sum1, uint32_t *sum2)
+{
+	uint32x4_t a = vld1q_u32(sum1);
+	uint32x4_t b = vld1q_u32(sum2);
+
+	for (size_t x = 0; x < n; x += 16) {
+		a = vaddq_u32(a, vreinterpretq_u32_u8(vld1q_u8(p + x)));
+		b = vaddq_u32(b, a);
+	}
+
+	vst1q_u32(sum1, a);
+	vst1q_u32(sum2, b);
+}
+
+#else
+
+static void autosave_sum(const uint8_t *p, size_t n, uint32_t *sum1, uint32_t *sum2)
+{
+	for (size_t x = 0; x < n; x += 16) {
+		for (uint32_t y = 0; y < AUTOSAVE_LANES; y++) {
+			uint32_t v = 0;
+			memcpy(&v, p + x + y * 4, 4);
+
+			sum1[y] += v;
+			sum2[y] += sum1[y];
+		}
+	}
+}
+
+#endif
+
+static void autosave_hash(struct autosave *ctx, const uint8_t *p, size_t n)
+{
+	size_t body = n & ~(size_t) 15;
+
+	autosave_sum(p, body, ctx->sum1, ctx->sum2);
+
+	// Zero padded tail
+	if (body < n) {
+		uint8_t tail[16] = {0};
+		memcpy(tail, p + body, n - body);
+
+		autosave_sum(tail, 16, ctx->sum1, ctx->sum2);
+	}
+}
+
+static uint64_t autosave_finish(struct autosave *ctx)
+{
+	uint64_t h = 0xCBF29CE484222325ull ^ ctx->size;
+
+	for (uint32_t x = 0; x < AUTOSAVE_LANES; x++) {
+		h = (h ^ ctx->sum1[x]) * 0x100000001B3ull;
+		h = (h ^ ctx->sum2[x]) * 0x100000001B3ull;
+	}
+
+	memset(ctx->sum1, 0, sizeof(ctx->sum1));
+	memset(ctx->sum2, 0, sizeof(ctx->sum2));
+
+	return h;
+}
+
+
+// Public
+
+struct autosave *autosave_create(void)
+{
+	return MTY_Alloc(1, sizeof(struct autosave));
+}
+
+void autosave_destroy(struct autosave **autosave)
+{
+	if (!autosave || !*autosave)
+		return;
+
+	struct autosave *ctx = *autosave;
+
+	MTY_Free(ctx);
+	*autosave = NULL;
+}
+
+void autosave_reset(struct autosave *ctx)
+{
+	if (!ctx)
+		return;
+
+	memset(ctx, 0, sizeof(struct autosave));
+}
+
+bool autosave_step(struct autosave *ctx, const void *sram, size_t size, uint32_t frames)
+{
+	if (!ctx || !sram || size == 0)
+		return false;
+
+	// Cores are free to move SRAM around between loads
+	if (sram != ctx->sram || size != ctx->size) {
+		autosave_reset(ctx);
+		ctx->sram = sram;
+		ctx->size = size;
+	}
+
+	size_t slice = size / (frames > 0 ? frames : 1);
+	slice = (slice + AUTOSAVE_ALIGN - 1) & ~(size_t) (AUTOSAVE_ALIGN - 1);
+
+	if (slice == 0 || slice > size - ctx->pos)
+		slice = size - ctx->pos;
+
+	autosave_hash(ctx, (const uint8_t *) sram + ctx->pos, slice);
+	ctx->pos += slice;
+
+	if (ctx->pos < size)
+		return false;
+
+	ctx->pos = 0;
+
+	uint64_t hash = autosave_finish(ctx);
+	bool changed = ctx->baseline && hash != ctx->hash;
+
+	// The first pass after a load describes what is already on disk
+	ctx->hash = hash;
+	ctx->baseline = true;
+
+	return changed;
+}
@@ -0,0 +1,18 @@
+// Copyright (c) Christopher D. Dickson <cdd@matoya.group>
+//
+// This Source Code Form is subject to the terms of the MIT License.
+// If a copy of the MIT License was not distributed with this file,
+// You can obtain one at https://spdx.org/licenses/MIT.html.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+struct autosave;
+
+struct autosave *autosave_create(void);
+void autosave_destroy(struct autosave **autosave);
+void autosave_reset(struct autosave *ctx);
+bool autosave_step(struct autosave *ctx, const void *sram, size_t size, uint32_t frames);
@@ -0,0 +1,373 @@
+// Copyright (c) Christopher D. Dickson <cdd@matoya.group>
+//
+// This Source Code Form is subject to the terms of the MIT License.
+// If a copy of the MIT License was not distributed with this file,
+// You can obtain one at https://spdx.org/licenses/MIT.html.
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "matoya.h"
+
+#include "core.h"
+#include "host.h"
+#include "latency.h"
+#include "movie.h"
+#include "netplay.h"
+#include "vfs.h"
+
+#define BENCH_FRAMES 3600
+#define BENCH_ALIGN  64
+#define BENCH_TRIES  5000
+
+#define BENCH_HOST_TARGET_US 50.0f
+
+struct bench {
+	struct core *core;
+	struct latency *latency;
+	void *fb;
+	size_t fb_size;
+	uint64_t audio_frames;
+	uint64_t video_frames;
+	uint64_t dupe_frames;
+};
+
+
+// Core callbacks
+
+static void bench_video(const void *buf, uint32_t width, uint32_t height, size_t pitch, void *opaque)
+{
+	struct bench *ctx = opaque;
+
+	if (ctx->latency) {
+		MTY_Time input = 0;
+		MTY_Time latch = 0;
+		core_get_input_stamps(ctx->core, &input, &latch);
+
+		latency_video(ctx->latency, input, latch, buf, width, height, pitch, core_get_color_format(ctx->core));
+	}
+
+	if (buf) {
+		ctx->video_frames++;
+
+	} else {
+		ctx->dupe_frames++;
+	}
+}
+
+static void *bench_framebuffer(uint32_t width, uint32_t height, enum core_color_format format,
+	size_t *pitch, void *opaque)
+{
+	struct bench *ctx = opaque;
+
+	// Mirrors the frontend's pool so cores take the same zero-copy path
+	size_t bpp = format == CORE_COLOR_FORMAT_BGRA ? 4 : 2;
+	*pitch = ((size_t) width * bpp + BENCH_ALIGN - 1) & ~((size_t) BENCH_ALIGN - 1);
+
+	size_t size = *pitch * height;
+
+	if (ctx->fb_size < size) {
+		MTY_FreeAligned(ctx->fb);
+		ctx->fb = MTY_AllocAligned(size, BENCH_ALIGN);
+		ctx->fb_size = size;
+	}
+
+	return ctx->fb;
+}
+
+static void bench_audio(const int16_t *buf, size_t frames, void *opaque)
+{
+	struct bench *ctx = opaque;
+
+	ctx->audio_frames += frames;
+}
+
+static void bench_log(const char *msg, void *opaque)
+{
+}
+
+
+// Stats
+
+static int bench_compare(const void *a, const void *b)
+{
+	float fa = *(const float *) a;
+	float fb = *(const float *) b;
+
+	return fa < fb ? -1 : fa > fb ? 1 : 0;
+}
+
+static float bench_percentile(const float *sorted, uint32_t n, float p)
+{
+	uint32_t i = (uint32_t) ((float) (n - 1) * p + 0.5f);
+
+	return sorted[i];
+}
+
+
+// Input lag
+
+static const enum core_button BENCH_LAG_BUTTONS[] = {
+	CORE_BUTTON_START,
+	CORE_BUTTON_A,
+	CORE_BUTTON_DPAD_D,
+	CORE_BUTTON_DPAD_U,
+	CORE_BUTTON_B,
+};
+
+#define BENCH_LAG_BUTTONS_N (sizeof(BENCH_LAG_BUTTONS) / sizeof(enum core_button))
+
+static void bench_lag_input(struct bench *ctx, uint32_t *press)
+{
+	// Presses go in once the screen holds still and are let go once the trace
+	// resolves, the release is traced the same way
+	if (latency_is_pending(ctx->latency) || !latency_is_static(ctx->latency))
+		return;
+
+	enum core_button button = BENCH_LAG_BUTTONS[(*press / 2) % BENCH_LAG_BUTTONS_N];
+	core_set_button(ctx->core, 0, button, *press % 2 == 0);
+
+	(*press)++;
+}
+
+
+// Netplay loopback
+
+static void bench_random_input(struct core *core, uint32_t *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+
+	// Held buttons change every few frames so prediction is right most of the time
+	if ((*seed >> 16) % 8 == 0) {
+		enum core_button button = (enum core_button) ((*seed >> 20) % (CORE_BUTTON_MAX - 1) + 1);
+		core_set_button(core, 0, button, (*seed >> 28) & 1);
+	}
+}
+
+static bool bench_netplay_connect(struct netplay *np[2])
+{
+	for (uint32_t x = 0; x < BENCH_TRIES; x++) {
+		struct netplay_stats stats[2];
+
+		netplay_run_frame(np[0]);
+		netplay_run_frame(np[1]);
+
+		netplay_get_stats(np[0], &stats[0]);
+		netplay_get_stats(np[1], &stats[1]);
+
+		if (stats[0].connected && stats[1].connected)
+			return true;
+
+		MTY_Sleep(1);
+	}
+
+	return false;
+}
+
+static void bench_netplay_print(const char *name, struct netplay *np)
+{
+	struct netplay_stats stats = {0};
+	netplay_get_stats(np, &stats);
+
+	printf("%s %llu frames, %llu rollbacks, %llu replayed, %llu stalls, delay %u, %s\n", name,
+		(unsigned long long) stats.frame, (unsigned long long) stats.rollbacks,
+		(unsigned long long) stats.replayed, (unsigned long long) stats.stalls, stats.delay,
+		stats.desync ? "DESYNC" : "in sync");
+}
+
+
+// Main
+
+int32_t main(int32_t argc, char **argv)
+{
+	// --host runs the core through a copy of this executable
+	if (argc >= 3 && !strcmp(argv[1], HOST_ARG))
+		return host_main(argv[2]);
+
+	if (argc < 3) {
+		printf("Usage: %s <core> <rom> [frames] [movie | --netplay | --host | --lag]\n", argv[0]);
+		return 1;
+	}
+
+	uint32_t n = argc >= 4 ? (uint32_t) strtoul(argv[3], NULL, 10) : 0;
+	bool hosted = argc >= 5 && !strcmp(argv[4], "--host");
+	bool lag = argc >= 5 && !strcmp(argv[4], "--lag");
+
+	int32_t r = 0;
+	struct bench ctx = {0};
+	struct movie *movie = NULL;
+	struct core *peer = NULL;
+	struct netplay *np[2] = {0};
+	uint32_t seed[2] = {1, 2};
+	uint32_t press = 0;
+	float *times = NULL;
+
+	core_set_log_func(bench_log, &ctx);
+
+	MTY_Time stamp = MTY_GetTime();
+
+	struct core *core = hosted ? core_load_hosted(argv[1], argv[0]) : core_load(argv[1]);
+	if (!core) {
+		printf("Failed to load core '%s'\n", argv[1]);
+		r = 1;
+		goto except;
+	}
+
+	ctx.core = core;
+
+	core_set_audio_func(core, bench_audio, &ctx);
+	core_set_video_func(core, bench_video, &ctx);
+	core_set_framebuffer_func(core, bench_framebuffer, &ctx);
+
+	if (!core_load_game(core, argv[2])) {
+		printf("Failed to load game '%s'\n", argv[2]);
+		r = 1;
+		goto except;
+	}
+
+	// Two sessions in one process over loopback, the peer's frames are not timed
+	if (argc >= 5 && !strcmp(argv[4], "--netplay")) {
+		peer = core_load(argv[1]);
+
+		if (!peer || !core_load_game(peer, argv[2])) {
+			printf("Failed to load the netplay peer\n");
+			r = 1;
+			goto except;
+		}
+
+		core_set_framebuffer_func(peer, bench_framebuffer, &ctx);
+
+		np[0] = netplay_create(core, NETPLAY_PORT, "127.0.0.1", NETPLAY_PORT + 1, 0, 0);
+		np[1] = netplay_create(peer, NETPLAY_PORT + 1, "127.0.0.1", NETPLAY_PORT, 1, 0);
+
+		if (!np[0] || !np[1] || !bench_netplay_connect(np)) {
+			printf("Failed to connect netplay over loopback\n");
+			r = 1;
+			goto except;
+		}
+
+	// Button presses are injected and the frames until the screen responds counted
+	} else if (lag) {
+		ctx.latency = latency_create();
+
+	// Replaying a movie drives the core with recorded input, headless and uncapped
+	} else if (argc >= 5 && !hosted) {
+		movie = movie_play(core, argv[4]);
+		if (!movie) {
+			printf("Failed to load movie '%s'\n", argv[4]);
+			r = 1;
+			goto except;
+		}
+
+		if (n == 0)
+			n = (uint32_t) movie_get_length(movie);
+	}
+
+	if (n == 0)
+		n = BENCH_FRAMES;
+
+	times = MTY_Alloc(n, sizeof(float));
+
+	float load_time = MTY_TimeDiff(stamp, MTY_GetTime());
+
+	// Tight loop, no pacing of any kind
+	MTY_Time start = MTY_GetTime();
+
+	for (uint32_t x = 0; x < n; x++) {
+		if (np[0]) {
+			bench_random_input(core, &seed[0]);
+			bench_random_input(peer, &seed[1]);
+		}
+
+		if (ctx.latency)
+			bench_lag_input(&ctx, &press);
+
+		MTY_Time fstamp = MTY_GetTime();
+
+		if (np[0]) {
+			netplay_run_frame(np[0]);
+
+		} else {
+			core_run_frame(core);
+		}
+
+		times[x] = MTY_TimeDiff(fstamp, MTY_GetTime());
+
+		netplay_run_frame(np[1]);
+	}
+
+	float total = MTY_TimeDiff(start, MTY_GetTime());
+
+	qsort(times, n, sizeof(float), bench_compare);
+
+	double fps = (double) n / ((double) total / 1000.0);
+	double core_fps = core_get_frame_rate(core);
+
+	printf("core:         %s\n", argv[1]);
+	printf("game:         %s\n", argv[2]);
+
+	if (movie)
+		printf("movie:        %s (%llu frames)\n", argv[4], (unsigned long long) movie_get_length(movie));
+
+	printf("load:         %.2f ms\n", load_time);
+	printf("frames:       %u (%llu video, %llu dupe)\n", n,
+		(unsigned long long) ctx.video_frames, (unsigned long long) ctx.dupe_frames);
+	printf("total:        %.2f ms\n", total);
+	printf("fps:          %.2f (%.2fx of %.2f)\n", fps, core_fps > 0 ? fps / core_fps : 0, core_fps);
+	printf("frame p50:    %.3f ms\n", bench_percentile(times, n, 0.50f));
+	printf("frame p90:    %.3f ms\n", bench_percentile(times, n, 0.90f));
+	printf("frame p99:    %.3f ms\n", bench_percentile(times, n, 0.99f));
+	printf("frame max:    %.3f ms\n", times[n - 1]);
+	printf("audio frames: %llu (%u Hz, %.1f per frame)\n", (unsigned long long) ctx.audio_frames,
+		core_get_sample_rate(core), (double) ctx.audio_frames / (double) n);
+
+	if (np[0]) {
+		bench_netplay_print("netplay p1:  ", np[0]);
+		bench_netplay_print("netplay p2:  ", np[1]);
+	}
+
+	if (ctx.latency) {
+		struct latency_stats lag_stats = {0};
+		latency_get_stats(ctx.latency, &lag_stats);
+
+		printf("lag:          %.2f frames (%u-%u), %.1f ms at %.2f fps, %u samples, %u ignored, %u no response\n",
+			lag_stats.frames, lag_stats.frames_min, lag_stats.frames_max,
+			core_fps > 0 ? lag_stats.frames * 1000.0 / core_fps : 0, core_fps,
+			lag_stats.responses, lag_stats.ignored, lag_stats.timeouts);
+	}
+
+	if (hosted)
+		printf("host:         %.1f us/frame overhead (target %.0f us)\n", core_get_host_overhead(core),
+			BENCH_HOST_TARGET_US);
+
+	struct vfs_stats vfs = {0};
+	vfs_get_stats(&vfs);
+
+	printf("vfs:          %llu calls, %llu syscalls, %llu mapped reads, %.1f MB read, %llu dir reads\n",
+		(unsigned long long) vfs.calls, (unsigned long long) vfs.syscalls,
+		(unsigned long long) vfs.mapped_reads, (double) vfs.bytes_read / (1024.0 * 1024.0),
+		(unsigned long long) vfs.dir_reads);
+
+	uint32_t num_perf = 0;
+	const struct core_perf_counter *perf = core_get_perf_counters(core, &num_perf);
+
+	for (uint32_t x = 0; x < num_perf; x++)
+		printf("perf %-24s %llu calls, %.1f ticks/frame\n", perf[x].name,
+			(unsigned long long) perf[x].calls, (double) perf[x].ticks / (double) n);
+
+	except:
+
+	netplay_destroy(&np[0]);
+	netplay_destroy(&np[1]);
+	core_unload(&peer);
+	movie_destroy(&movie);
+	latency_destroy(&ctx.latency);
+	core_unload(&core);
+	MTY_FreeAligned(ctx.fb);
+	MTY_Free(times);
+
+	return r;
+}
@@ -33,9 +33,20 @@ struct config {
 	bool bg_pause;
 	bool console;
 	bool fullscreen;
+	bool isolate_core;
+	bool vrr;
+	bool auto_delay;
+	bool latch_on_read;
+	bool lag_trace;
 	bool mute;
+	bool run_ahead_instance;
+	uint32_t fast_forward;
 	uint32_t reduce_latency;
+	uint32_t run_ahead;
+	uint32_t rewind_budget;
+	uint32_t rewind_interval;
 	uint32_t frame_size;
+	char last_system[SYSTEM_NAME_MAX];
 
 	MTY_GFX gfx;
 	MTY_Filter filter;
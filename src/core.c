@@ -12,15 +12,51 @@
 
 #include "matoya.h"
 #include "deps/libretro.h"
-
-#define CORE_VARIABLES_MAX 128
+#include "archive.h"
+#include "fmap.h"
+#include "host.h"
+#include "perf.h"
+#include "vfs.h"
+
+#define CORE_VARIABLES_MAX     128
+#define CORE_PERF_COUNTERS_MAX 64
+#define CORE_CACHE_LINE        64
+
+#define CORE_HOST_TIMEOUT_RUN  5000
+#define CORE_HOST_TIMEOUT_LOAD 60000
+
+// Only quirks the serialization paths below act on are acknowledged
+#define CORE_QUIRKS_SUPPORTED ( \
+	RETRO_SERIALIZATION_QUIRK_INCOMPLETE | \
+	RETRO_SERIALIZATION_QUIRK_MUST_INITIALIZE | \
+	RETRO_SERIALIZATION_QUIRK_CORE_VARIABLE_SIZE \
+)
+
+// Written by the input thread and read by the thread running the core, each
+// player gets its own cache line guarded by a sequence counter. The stamp is
+// when the slot last changed
+
+struct core_input_slot {
+	MTY_Time stamp;
+	MTY_Atomic32 seq;
+	struct core_input input;
+	uint8_t pad[CORE_CACHE_LINE - sizeof(MTY_Time) - sizeof(MTY_Atomic32) - sizeof(struct core_input)];
+};
 
 struct core {
+	// Must stay first so every slot is cache line aligned
+	struct core_input_slot input[CORE_PLAYERS_MAX];
+
 	MTY_SO *so;
+	char *so_path;
+	char *so_copy;
+	uint32_t slot;
+	struct host *host;
+	float host_overhead;
 	bool game_loaded;
 	char *game_path;
-	char *game_data;
-	size_t game_data_size;
+	struct fmap *game_map;
+	void *game_data;
 
 	struct retro_system_info system_info;
 
@@ -50,57 +86,115 @@ struct core {
 	unsigned (RETRO_CALLCONV *retro_get_region)(void);
 	void *(RETRO_CALLCONV *retro_get_memory_data)(unsigned id);
 	size_t (RETRO_CALLCONV *retro_get_memory_size)(unsigned id);
-};
 
+	// State from the environment callback
+	enum retro_pixel_format pixel_format;
+	struct retro_game_geometry game_geometry;
+	struct retro_system_timing system_timing;
+	unsigned region;
+	uint64_t quirks;
+	struct core_memory_region regions[CORE_REGIONS_MAX];
+	uint32_t num_regions;
+	struct core_memory_region system_ram;
+
+	uint32_t num_variables;
+	uint32_t variables_version;
+	struct core_variable variables[CORE_VARIABLES_MAX];
+	MTY_Hash *opts;
+	bool opt_set;
+
+	CORE_AUDIO_FUNC audio;
+	CORE_VIDEO_FUNC video;
+	CORE_FRAMEBUFFER_FUNC framebuffer;
+	CORE_INPUT_FUNC input_func;
+	void *audio_opaque;
+	void *video_opaque;
+	void *framebuffer_opaque;
+	void *input_opaque;
+
+	char save_dir[MTY_PATH_MAX];
+	char system_dir[MTY_PATH_MAX];
+
+	// Input is latched once per frame when the core polls for it, or on its
+	// first read with CORE_LATCH_STATE. With an input hook installed it is
+	// latched at the frame boundary instead
+	struct core_input latched[CORE_PLAYERS_MAX];
+	enum core_latch latch;
+	bool latch_pending;
+	MTY_Time latch_stamp;
+	MTY_Time latch_time;
+
+	// Counters live in the core's memory and stay valid until it is unloaded
+	struct retro_perf_callback perf_cb;
+	struct retro_perf_counter *perf[CORE_PERF_COUNTERS_MAX];
+	struct core_perf_counter perf_stats[CORE_PERF_COUNTERS_MAX];
+	uint32_t num_perf;
+
+	size_t num_frames;
+	int16_t frames[CORE_SAMPLES_MAX];
+
+	// Audio buffer status reported to the core before each frame
+	retro_audio_buffer_status_callback_t audio_status;
+	bool audio_active;
+	uint32_t audio_occupancy;
+	bool audio_underrun;
+	uint32_t audio_latency;
+
+	// Run-ahead
+	uint32_t run_ahead;
+	bool run_ahead_instance;
+	bool run_ahead_synced;
+	bool run_ahead_error;
+	bool hide_video;
+	bool mute_audio;
+	bool fast_state;
+	uint64_t frame_count;
+	void *state;
+	size_t state_size;
+	size_t state_cap;
+	size_t save_size;
+	struct core *secondary;
+	struct core_input prev[CORE_PLAYERS_MAX];
+
+	// Fast-forward, a rate of 0 means uncapped
+	bool fast_forward;
+	float fast_forward_rate;
+};
 
-// Globals from the environment callback
-
-static enum retro_pixel_format RETRO_PIXEL_FORMAT = RETRO_PIXEL_FORMAT_0RGB1555;
-static struct retro_game_geometry RETRO_GAME_GEOMETRY;
-static struct retro_system_timing RETRO_SYSTEM_TIMING;
-static unsigned RETRO_REGION;
 
-static uint32_t CORE_NUM_VARIABLES;
-static struct core_variable CORE_VARIABLES[CORE_VARIABLES_MAX];
-static MTY_Hash *CORE_OPTS;
-static bool CORE_OPT_SET;
+// Globals
 
 static CORE_LOG_FUNC CORE_LOG;
-static CORE_AUDIO_FUNC CORE_AUDIO;
-static CORE_VIDEO_FUNC CORE_VIDEO;
 static void *CORE_LOG_OPAQUE;
-static void *CORE_AUDIO_OPAQUE;
-static void *CORE_VIDEO_OPAQUE;
 
-static char CORE_SAVE_DIR[MTY_PATH_MAX];
-static char CORE_SYSTEM_DIR[MTY_PATH_MAX];
+// Each loaded instance owns a slot, and each slot has its own set of libretro
+// callbacks so calls from the core can be routed back to the owning instance
 
-static bool CORE_BUTTONS[CORE_PLAYERS_MAX][CORE_BUTTON_MAX];
-static int16_t CORE_AXES[CORE_PLAYERS_MAX][CORE_AXIS_MAX];
+static MTY_Atomic32 CORE_SLOT_USED[CORE_INSTANCES_MAX];
+static struct core *CORE_SLOTS[CORE_INSTANCES_MAX];
 
-static size_t CORE_NUM_FRAMES;
-static int16_t CORE_FRAMES[CORE_SAMPLES_MAX];
+// Unique across instances so a copy of one core's variables is never mistaken
+// for another's
+static MTY_Atomic32 CORE_VARIABLES_VERSION;
 
 
 // Maps
 
-static const enum core_button CORE_BUTTON_MAP[16] = {
-	[RETRO_DEVICE_ID_JOYPAD_B]      = CORE_BUTTON_B,
-	[RETRO_DEVICE_ID_JOYPAD_Y]      = CORE_BUTTON_Y,
-	[RETRO_DEVICE_ID_JOYPAD_SELECT] = CORE_BUTTON_SELECT,
-	[RETRO_DEVICE_ID_JOYPAD_START]  = CORE_BUTTON_START,
-	[RETRO_DEVICE_ID_JOYPAD_UP]     = CORE_BUTTON_DPAD_U,
-	[RETRO_DEVICE_ID_JOYPAD_DOWN]   = CORE_BUTTON_DPAD_D,
-	[RETRO_DEVICE_ID_JOYPAD_LEFT]   = CORE_BUTTON_DPAD_L,
-	[RETRO_DEVICE_ID_JOYPAD_RIGHT]  = CORE_BUTTON_DPAD_R,
-	[RETRO_DEVICE_ID_JOYPAD_A]      = CORE_BUTTON_A,
-	[RETRO_DEVICE_ID_JOYPAD_X]      = CORE_BUTTON_X,
-	[RETRO_DEVICE_ID_JOYPAD_L]      = CORE_BUTTON_L,
-	[RETRO_DEVICE_ID_JOYPAD_R]      = CORE_BUTTON_R,
-	[RETRO_DEVICE_ID_JOYPAD_L2]     = CORE_BUTTON_L2,
-	[RETRO_DEVICE_ID_JOYPAD_R2]     = CORE_BUTTON_R2,
-	[RETRO_DEVICE_ID_JOYPAD_L3]     = 0,
-	[RETRO_DEVICE_ID_JOYPAD_R3]     = 0,
+static const unsigned CORE_BUTTON_MAP[CORE_BUTTON_MAX] = {
+	[CORE_BUTTON_B]      = RETRO_DEVICE_ID_JOYPAD_B,
+	[CORE_BUTTON_Y]      = RETRO_DEVICE_ID_JOYPAD_Y,
+	[CORE_BUTTON_SELECT] = RETRO_DEVICE_ID_JOYPAD_SELECT,
+	[CORE_BUTTON_START]  = RETRO_DEVICE_ID_JOYPAD_START,
+	[CORE_BUTTON_DPAD_U] = RETRO_DEVICE_ID_JOYPAD_UP,
+	[CORE_BUTTON_DPAD_D] = RETRO_DEVICE_ID_JOYPAD_DOWN,
+	[CORE_BUTTON_DPAD_L] = RETRO_DEVICE_ID_JOYPAD_LEFT,
+	[CORE_BUTTON_DPAD_R] = RETRO_DEVICE_ID_JOYPAD_RIGHT,
+	[CORE_BUTTON_A]      = RETRO_DEVICE_ID_JOYPAD_A,
+	[CORE_BUTTON_X]      = RETRO_DEVICE_ID_JOYPAD_X,
+	[CORE_BUTTON_L]      = RETRO_DEVICE_ID_JOYPAD_L,
+	[CORE_BUTTON_R]      = RETRO_DEVICE_ID_JOYPAD_R,
+	[CORE_BUTTON_L2]     = RETRO_DEVICE_ID_JOYPAD_L2,
+	[CORE_BUTTON_R2]     = RETRO_DEVICE_ID_JOYPAD_R2,
 };
 
 static const enum core_axis CORE_AXIS_MAP[3][2] = {
@@ -136,6 +230,54 @@ static void core_retro_log_printf(enum retro_log_level level, const char *fmt, .
 	MTY_Free(msg);
 }
 
+static retro_time_t core_retro_perf_get_time_usec(void)
+{
+	return perf_get_usec();
+}
+
+static retro_perf_tick_t core_retro_perf_get_counter(void)
+{
+	return perf_get_ticks();
+}
+
+static uint64_t core_retro_get_cpu_features(void)
+{
+	return perf_get_cpu_features();
+}
+
+static void core_retro_perf_start(struct retro_perf_counter *counter)
+{
+	counter->call_cnt++;
+	counter->start = perf_get_ticks();
+}
+
+static void core_retro_perf_stop(struct retro_perf_counter *counter)
+{
+	counter->total += perf_get_ticks() - counter->start;
+}
+
+static void core_retro_perf_register(struct core *ctx, struct retro_perf_counter *counter)
+{
+	if (counter->registered)
+		return;
+
+	counter->registered = true;
+
+	if (ctx->num_perf == CORE_PERF_COUNTERS_MAX)
+		return;
+
+	struct core_perf_counter *stats = &ctx->perf_stats[ctx->num_perf];
+	memset(stats, 0, sizeof(struct core_perf_counter));
+	snprintf(stats->name, CORE_PERF_NAME_MAX, "%s", counter->ident ? counter->ident : "");
+
+	ctx->perf[ctx->num_perf++] = counter;
+}
+
+static void core_retro_perf_log(struct core *ctx)
+{
+	core_log_perf_counters(ctx);
+}
+
 static void core_parse_variable(struct core_variable *var, const char *key, const char *val)
 {
 	snprintf(var->key, CORE_KEY_NAME_MAX, "%s", key);
@@ -177,7 +319,7 @@ static const char *core_variable_default(const char *key)
 	return NULL;
 }
 
-static bool core_retro_environment(unsigned cmd, void *data)
+static bool core_retro_environment(struct core *ctx, unsigned cmd, void *data)
 {
 	switch (cmd) {
 		case RETRO_ENVIRONMENT_GET_MESSAGE_INTERFACE_VERSION:
@@ -212,7 +354,7 @@ static bool core_retro_environment(unsigned cmd, void *data)
 		case RETRO_ENVIRONMENT_GET_SYSTEM_DIRECTORY: {
 			const char **arg = data;
 
-			*arg = CORE_SYSTEM_DIR;
+			*arg = ctx->system_dir;
 			MTY_Mkdir(*arg);
 
 			return true;
@@ -220,20 +362,21 @@ static bool core_retro_environment(unsigned cmd, void *data)
 		case RETRO_ENVIRONMENT_GET_SAVE_DIRECTORY: {
 			const char **arg = data;
 
-			*arg = CORE_SAVE_DIR;
+			*arg = ctx->save_dir;
 			MTY_Mkdir(*arg);
 
 			return true;
 		}
 		case RETRO_ENVIRONMENT_GET_VARIABLE: {
 			struct retro_variable *arg = data;
-			arg->value = MTY_HashGet(CORE_OPTS, arg->key);
+			arg->value = MTY_HashGet(ctx->opts, arg->key);
 
 			return arg->value ? true : false;
 		}
 		case RETRO_ENVIRONMENT_GET_AUDIO_VIDEO_ENABLE: {
 			int *arg = data;
-			*arg = 0x3;
+			*arg = (ctx->hide_video ? 0 : 0x1) | (ctx->mute_audio ? 0 : 0x2) |
+				(ctx->fast_state ? 0x4 : 0);
 
 			return true;
 		}
@@ -246,25 +389,31 @@ static bool core_retro_environment(unsigned cmd, void *data)
 		case RETRO_ENVIRONMENT_SET_VARIABLES: {
 			const struct retro_variable *arg = data;
 
-			for (uint32_t x = 0; x < UINT32_MAX; x++) {
+			// Each call replaces the whole set, a core that reloads or changes
+			// its options resends all of them
+			ctx->num_variables = 0;
+			ctx->variables_version = MTY_Atomic32Add(&CORE_VARIABLES_VERSION, 1);
+			memset(ctx->variables, 0, sizeof(ctx->variables));
+
+			for (uint32_t x = 0; arg && x < UINT32_MAX; x++) {
 				const struct retro_variable *v = &arg[x];
 				if (!v->key || !v->value)
 					break;
 
-				if (CORE_NUM_VARIABLES < CORE_VARIABLES_MAX) {
-					core_parse_variable(&CORE_VARIABLES[CORE_NUM_VARIABLES], v->key, v->value);
+				if (ctx->num_variables < CORE_VARIABLES_MAX) {
+					core_parse_variable(&ctx->variables[ctx->num_variables], v->key, v->value);
 
-					if (!MTY_HashGet(CORE_OPTS, v->key)) {
+					if (!MTY_HashGet(ctx->opts, v->key)) {
 						const char *default_val = core_variable_default(v->key);
 
 						if (!default_val)
-							default_val = CORE_VARIABLES[CORE_NUM_VARIABLES].opts[0];
+							default_val = ctx->variables[ctx->num_variables].opts[0];
 
 						if (default_val[0])
-							MTY_HashSet(CORE_OPTS, v->key, MTY_Strdup(default_val));
+							MTY_HashSet(ctx->opts, v->key, MTY_Strdup(default_val));
 					}
 
-					CORE_NUM_VARIABLES++;
+					ctx->num_variables++;
 				}
 			}
 
@@ -272,28 +421,142 @@ static bool core_retro_environment(unsigned cmd, void *data)
 		}
 		case RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE: {
 			bool *arg = data;
-			*arg = CORE_OPT_SET;
-			CORE_OPT_SET = false;
+			*arg = ctx->opt_set;
+			ctx->opt_set = false;
 
 			return true;
 		}
 		case RETRO_ENVIRONMENT_SET_PIXEL_FORMAT: {
 			const enum retro_pixel_format *arg = data;
 
-			RETRO_PIXEL_FORMAT = *arg;
+			ctx->pixel_format = *arg;
 
 			return true;
 		}
 		case RETRO_ENVIRONMENT_SET_GEOMETRY: {
 			const struct retro_game_geometry *arg = data;
-			RETRO_GAME_GEOMETRY = *arg;
+			ctx->game_geometry = *arg;
 
 			return true;
 		}
 		case RETRO_ENVIRONMENT_SET_SYSTEM_AV_INFO: {
 			const struct retro_system_av_info *arg = data;
-			RETRO_GAME_GEOMETRY = arg->geometry;
-			RETRO_SYSTEM_TIMING = arg->timing;
+			ctx->game_geometry = arg->geometry;
+			ctx->system_timing = arg->timing;
+
+			return true;
+		}
+		case RETRO_ENVIRONMENT_GET_CURRENT_SOFTWARE_FRAMEBUFFER: {
+			struct retro_framebuffer *arg = data;
+
+			// Hidden frames are thrown away, let the core use its own buffer
+			if (!ctx->framebuffer || ctx->hide_video)
+				return false;
+
+			size_t pitch = 0;
+			void *buf = ctx->framebuffer(arg->width, arg->height, core_get_color_format(ctx),
+				&pitch, ctx->framebuffer_opaque);
+
+			if (!buf)
+				return false;
+
+			arg->data = buf;
+			arg->pitch = pitch;
+			arg->format = ctx->pixel_format;
+			arg->memory_flags = RETRO_MEMORY_TYPE_CACHED;
+
+			return true;
+		}
+		case RETRO_ENVIRONMENT_SET_AUDIO_BUFFER_STATUS_CALLBACK: {
+			const struct retro_audio_buffer_status_callback *arg = data;
+
+			ctx->audio_status = arg ? arg->callback : NULL;
+
+			return true;
+		}
+		case RETRO_ENVIRONMENT_SET_MINIMUM_AUDIO_LATENCY: {
+			const unsigned *arg = data;
+
+			ctx->audio_latency = *arg;
+
+			return true;
+		}
+		case RETRO_ENVIRONMENT_GET_FASTFORWARDING: {
+			bool *arg = data;
+
+			if (arg)
+				*arg = ctx->fast_forward;
+
+			return true;
+		}
+		case RETRO_ENVIRONMENT_GET_THROTTLE_STATE: {
+			struct retro_throttle_state *arg = data;
+
+			arg->mode = ctx->fast_forward ? RETRO_THROTTLE_FAST_FORWARD : RETRO_THROTTLE_NONE;
+			arg->rate = ctx->fast_forward ? ctx->fast_forward_rate : (float) ctx->system_timing.fps;
+
+			return true;
+		}
+		case RETRO_ENVIRONMENT_SET_MEMORY_MAPS: {
+			const struct retro_memory_map *arg = data;
+
+			ctx->num_regions = 0;
+
+			for (unsigned x = 0; x < arg->num_descriptors && ctx->num_regions < CORE_REGIONS_MAX; x++) {
+				const struct retro_memory_descriptor *desc = &arg->descriptors[x];
+
+				// ROM and unbacked ranges are of no use for searching or writing
+				if (!desc->ptr || desc->len == 0 || (desc->flags & RETRO_MEMDESC_CONST))
+					continue;
+
+				void *ptr = (uint8_t *) desc->ptr + desc->offset;
+
+				// Mirrors point at the same memory
+				bool mirror = false;
+				for (uint32_t y = 0; y < ctx->num_regions && !mirror; y++)
+					mirror = ctx->regions[y].ptr == ptr;
+
+				if (mirror)
+					continue;
+
+				struct core_memory_region *region = &ctx->regions[ctx->num_regions++];
+				region->ptr = ptr;
+				region->size = desc->len;
+				region->start = desc->start;
+			}
+
+			return true;
+		}
+		case RETRO_ENVIRONMENT_GET_VFS_INTERFACE: {
+			struct retro_vfs_interface_info *arg = data;
+
+			if (arg->required_interface_version > VFS_VERSION)
+				return false;
+
+			arg->required_interface_version = VFS_VERSION;
+			arg->iface = vfs_get_interface();
+
+			return true;
+		}
+		case RETRO_ENVIRONMENT_GET_PERF_INTERFACE: {
+			struct retro_perf_callback *arg = data;
+
+			*arg = ctx->perf_cb;
+
+			return true;
+		}
+		case RETRO_ENVIRONMENT_GET_INPUT_BITMASKS: {
+			bool *arg = data;
+
+			if (arg)
+				*arg = true;
+
+			return true;
+		}
+		case RETRO_ENVIRONMENT_SET_SERIALIZATION_QUIRKS: {
+			uint64_t *arg = data;
+			*arg &= CORE_QUIRKS_SUPPORTED;
+			ctx->quirks = *arg;
 
 			return true;
 		}
@@ -314,39 +577,20 @@ static bool core_retro_environment(unsigned cmd, void *data)
 		case RETRO_ENVIRONMENT_SET_INPUT_DESCRIPTORS:
 			printf("RETRO_ENVIRONMENT_SET_INPUT_DESCRIPTORS\n");
 			break;
-		case RETRO_ENVIRONMENT_GET_VFS_INTERFACE:
-			printf("RETRO_ENVIRONMENT_GET_VFS_INTERFACE\n");
-			break;
-		case RETRO_ENVIRONMENT_SET_SERIALIZATION_QUIRKS:
-			printf("RETRO_ENVIRONMENT_SET_SERIALIZATION_QUIRKS\n");
-			break;
 		case RETRO_ENVIRONMENT_SET_DISK_CONTROL_INTERFACE:
 			printf("RETRO_ENVIRONMENT_SET_DISK_CONTROL_INTERFACE\n");
 			break;
-		case RETRO_ENVIRONMENT_GET_PERF_INTERFACE:
-			printf("RETRO_ENVIRONMENT_GET_PERF_INTERFACE\n");
-			break;
 		case RETRO_ENVIRONMENT_SET_HW_RENDER:
 			printf("RETRO_ENVIRONMENT_SET_HW_RENDER\n");
 			break;
 
 		// Unimplemented
-		case RETRO_ENVIRONMENT_SET_MEMORY_MAPS:
-			// NES / SNES memory maps for cheats and other advanced emulator features
-		case RETRO_ENVIRONMENT_GET_CURRENT_SOFTWARE_FRAMEBUFFER:
-			// Preallocated memory for drawing, overhead is minimal on current systems
 		case RETRO_ENVIRONMENT_SET_CORE_OPTIONS_DISPLAY:
 			// Optionally hide certain settings
 		case RETRO_ENVIRONMENT_SET_PERFORMANCE_LEVEL:
 			// Perfomance demands hint
 		case RETRO_ENVIRONMENT_SET_SUPPORT_ACHIEVEMENTS:
 			// Achievement system?
-		case RETRO_ENVIRONMENT_SET_AUDIO_BUFFER_STATUS_CALLBACK:
-		case RETRO_ENVIRONMENT_SET_MINIMUM_AUDIO_LATENCY:
-			// Merton handles this with resampling and libmatoya's min/max buffers
-		case RETRO_ENVIRONMENT_GET_INPUT_BITMASKS:
-			// This is an optional efficiency for polling controllers
-		case RETRO_ENVIRONMENT_GET_FASTFORWARDING:
 			return false;
 
 		// Unknown
@@ -358,61 +602,188 @@ static bool core_retro_environment(unsigned cmd, void *data)
 	return false;
 }
 
-static void core_retro_video_refresh(const void *data, unsigned width,
+static void core_retro_video_refresh(struct core *ctx, const void *data, unsigned width,
 	unsigned height, size_t pitch)
 {
-	if (CORE_VIDEO)
-		CORE_VIDEO(data, width, height, pitch, CORE_VIDEO_OPAQUE);
+	if (ctx->video && !ctx->hide_video)
+		ctx->video(data, width, height, pitch, ctx->video_opaque);
 }
 
-static void core_retro_audio_sample(int16_t left, int16_t right)
+static void core_retro_audio_sample(struct core *ctx, int16_t left, int16_t right)
 {
-	if (CORE_NUM_FRAMES + 1 <= CORE_FRAMES_MAX) {
-		CORE_FRAMES[CORE_NUM_FRAMES * 2] = left;
-		CORE_FRAMES[CORE_NUM_FRAMES * 2 + 1] = right;
-		CORE_NUM_FRAMES++;
+	if (!ctx->mute_audio && ctx->num_frames + 1 <= CORE_FRAMES_MAX) {
+		ctx->frames[ctx->num_frames * 2] = left;
+		ctx->frames[ctx->num_frames * 2 + 1] = right;
+		ctx->num_frames++;
 	}
 }
 
-static size_t core_retro_audio_sample_batch(const int16_t *data, size_t frames)
+static size_t core_retro_audio_sample_batch(struct core *ctx, const int16_t *data, size_t frames)
 {
-	if (CORE_NUM_FRAMES + frames <= CORE_FRAMES_MAX) {
-		memcpy(CORE_FRAMES + CORE_NUM_FRAMES * 2, data, frames * 4);
-		CORE_NUM_FRAMES += frames;
+	if (!ctx->mute_audio && ctx->num_frames + frames <= CORE_FRAMES_MAX) {
+		memcpy(ctx->frames + ctx->num_frames * 2, data, frames * 4);
+		ctx->num_frames += frames;
 	}
 
 	return frames;
 }
 
-static void core_retro_input_poll(void)
+static void core_latch_input(struct core *ctx)
+{
+	MTY_Time stamp = 0;
+
+	// Seqlock reader, retries if the input thread was mid write
+	for (uint8_t x = 0; x < CORE_PLAYERS_MAX; x++) {
+		struct core_input_slot *slot = &ctx->input[x];
+
+		while (true) {
+			int32_t seq = MTY_Atomic32Get(&slot->seq);
+			if (seq & 1)
+				continue;
+
+			ctx->latched[x] = slot->input;
+			MTY_Time changed = slot->stamp;
+
+			if (MTY_Atomic32Get(&slot->seq) == seq) {
+				stamp = changed > stamp ? changed : stamp;
+				break;
+			}
+		}
+	}
+
+	ctx->latch_pending = false;
+	ctx->latch_stamp = stamp;
+	ctx->latch_time = MTY_GetTime();
+
+	// Movies record or replace the snapshot before the core sees it
+	if (ctx->input_func)
+		ctx->input_func(ctx->latched, CORE_PLAYERS_MAX, ctx->input_opaque);
+}
+
+static void core_begin_latch(struct core *ctx)
+{
+	// Hooks record or replace the snapshot and may serialize the core, so they
+	// run before retro_run and the core gets exactly what they saw
+	if (ctx->input_func) {
+		core_latch_input(ctx);
+		return;
+	}
+
+	ctx->latch_pending = true;
+}
+
+static void core_end_latch(struct core *ctx)
+{
+	// A core that never asked still leaves a snapshot for run-ahead and the
+	// latency stamps
+	if (ctx->latch_pending)
+		core_latch_input(ctx);
+}
+
+static void core_retro_input_poll(struct core *ctx)
 {
+	// The freshest input is taken when the core asks for it rather than at the
+	// start of the frame, later polls in the same frame keep the snapshot
+	if (ctx->latch_pending && ctx->latch == CORE_LATCH_POLL)
+		core_latch_input(ctx);
 }
 
-static int16_t core_retro_input_state(unsigned port, unsigned device,
+static int16_t core_retro_input_state(struct core *ctx, unsigned port, unsigned device,
 	unsigned index, unsigned id)
 {
 	if (port >= CORE_PLAYERS_MAX)
 		return 0;
 
+	if (ctx->latch_pending)
+		core_latch_input(ctx);
+
+	const struct core_input *input = &ctx->latched[port];
+
 	// Buttons
 	if (device == RETRO_DEVICE_JOYPAD) {
+		if (id == RETRO_DEVICE_ID_JOYPAD_MASK)
+			return (int16_t) input->buttons;
+
 		if (id >= 16)
 			return 0;
 
-		return CORE_BUTTONS[port][CORE_BUTTON_MAP[id]];
+		return (input->buttons >> id) & 1;
 
 	// Axes
 	} else if (device == RETRO_DEVICE_ANALOG) {
 		if (index >= 3 || id >= 2)
 			return 0;
 
-		return CORE_AXES[port][CORE_AXIS_MAP[index][id]];
+		return input->axes[CORE_AXIS_MAP[index][id]];
 	}
 
 	return 0;
 }
 
 
+// Per slot trampolines
+
+struct core_callbacks {
+	retro_environment_t environment;
+	retro_video_refresh_t video_refresh;
+	retro_audio_sample_t audio_sample;
+	retro_audio_sample_batch_t audio_sample_batch;
+	retro_input_poll_t input_poll;
+	retro_input_state_t input_state;
+	retro_perf_register_t perf_register;
+	retro_perf_log_t perf_log;
+};
+
+#define CORE_SLOT_FUNCS(n) \
+	static bool core_retro_environment_##n(unsigned cmd, void *data) \
+		{return core_retro_environment(CORE_SLOTS[n], cmd, data);} \
+	static void core_retro_video_refresh_##n(const void *data, unsigned width, unsigned height, size_t pitch) \
+		{core_retro_video_refresh(CORE_SLOTS[n], data, width, height, pitch);} \
+	static void core_retro_audio_sample_##n(int16_t left, int16_t right) \
+		{core_retro_audio_sample(CORE_SLOTS[n], left, right);} \
+	static size_t core_retro_audio_sample_batch_##n(const int16_t *data, size_t frames) \
+		{return core_retro_audio_sample_batch(CORE_SLOTS[n], data, frames);} \
+	static void core_retro_input_poll_##n(void) \
+		{core_retro_input_poll(CORE_SLOTS[n]);} \
+	static int16_t core_retro_input_state_##n(unsigned port, unsigned device, unsigned index, unsigned id) \
+		{return core_retro_input_state(CORE_SLOTS[n], port, device, index, id);} \
+	static void core_retro_perf_register_##n(struct retro_perf_counter *counter) \
+		{core_retro_perf_register(CORE_SLOTS[n], counter);} \
+	static void core_retro_perf_log_##n(void) \
+		{core_retro_perf_log(CORE_SLOTS[n]);}
+
+#define CORE_SLOT_CALLBACKS(n) { \
+	core_retro_environment_##n, \
+	core_retro_video_refresh_##n, \
+	core_retro_audio_sample_##n, \
+	core_retro_audio_sample_batch_##n, \
+	core_retro_input_poll_##n, \
+	core_retro_input_state_##n, \
+	core_retro_perf_register_##n, \
+	core_retro_perf_log_##n, \
+}
+
+CORE_SLOT_FUNCS(0)
+CORE_SLOT_FUNCS(1)
+CORE_SLOT_FUNCS(2)
+CORE_SLOT_FUNCS(3)
+CORE_SLOT_FUNCS(4)
+CORE_SLOT_FUNCS(5)
+CORE_SLOT_FUNCS(6)
+CORE_SLOT_FUNCS(7)
+
+static const struct core_callbacks CORE_CALLBACKS[CORE_INSTANCES_MAX] = {
+	CORE_SLOT_CALLBACKS(0),
+	CORE_SLOT_CALLBACKS(1),
+	CORE_SLOT_CALLBACKS(2),
+	CORE_SLOT_CALLBACKS(3),
+	CORE_SLOT_CALLBACKS(4),
+	CORE_SLOT_CALLBACKS(5),
+	CORE_SLOT_CALLBACKS(6),
+	CORE_SLOT_CALLBACKS(7),
+};
+
+
 // Core API
 
 static bool core_load_symbols(struct core *ctx)
@@ -447,18 +818,218 @@ static bool core_load_symbols(struct core *ctx)
 	return true;
 }
 
-struct core *core_load(const char *name)
+static bool core_acquire_slot(struct core *ctx)
+{
+	for (uint32_t x = 0; x < CORE_INSTANCES_MAX; x++) {
+		if (MTY_Atomic32CAS(&CORE_SLOT_USED[x], 0, 1)) {
+			CORE_SLOTS[x] = ctx;
+			ctx->slot = x;
+
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void core_release_slot(struct core *ctx)
+{
+	if (ctx->slot >= CORE_INSTANCES_MAX)
+		return;
+
+	CORE_SLOTS[ctx->slot] = NULL;
+	MTY_Atomic32Set(&CORE_SLOT_USED[ctx->slot], 0);
+
+	ctx->slot = CORE_INSTANCES_MAX;
+}
+
+static bool core_so_in_use(struct core *ctx)
+{
+	for (uint32_t x = 0; x < CORE_INSTANCES_MAX; x++) {
+		struct core *other = CORE_SLOTS[x];
+
+		if (other && other != ctx && other->so && !strcmp(other->so_path, ctx->so_path))
+			return true;
+	}
+
+	return false;
+}
+
+static bool core_read_game_data(struct core *ctx, const char *path, struct retro_game_info *game)
+{
+	// Archive members are decompressed once into the archive cache, each core
+	// gets its own copy since cores may write through game->data
+	if (archive_get_member(path)) {
+		size_t size = 0;
+		ctx->game_data = archive_read(path, &size);
+		if (!ctx->game_data)
+			return false;
+
+		game->data = ctx->game_data;
+		game->size = size;
+
+		return true;
+	}
+
+	// Private writable mapping: pages come straight from the page cache and
+	// are only copied if the core writes through the const pointer it was given
+	ctx->game_map = fmap_open(path, true);
+
+	if (ctx->game_map) {
+		game->data = fmap_get_data(ctx->game_map);
+		game->size = fmap_get_size(ctx->game_map);
+		return true;
+	}
+
+	// Empty files, pipes, and filesystems that refuse to map
+	size_t size = 0;
+	ctx->game_data = MTY_ReadFile(path, &size);
+	if (!ctx->game_data)
+		return false;
+
+	game->data = ctx->game_data;
+	game->size = size;
+
+	return true;
+}
+
+static void core_free_game_data(struct core *ctx)
+{
+	fmap_close(&ctx->game_map);
+
+	MTY_Free(ctx->game_data);
+	ctx->game_data = NULL;
+}
+
+static struct core *core_alloc(const char *name)
+{
+	struct core *ctx = MTY_AllocAligned(sizeof(struct core), CORE_CACHE_LINE);
+	memset(ctx, 0, sizeof(struct core));
+
+	ctx->slot = CORE_INSTANCES_MAX;
+	ctx->so_path = MTY_Strdup(name);
+	ctx->pixel_format = RETRO_PIXEL_FORMAT_0RGB1555;
+
+	snprintf(ctx->save_dir, MTY_PATH_MAX, "%s", MTY_JoinPath(MTY_GetProcessDir(), "save"));
+	snprintf(ctx->system_dir, MTY_PATH_MAX, "%s", MTY_JoinPath(MTY_GetProcessDir(), "system"));
+
+	ctx->opts = MTY_HashCreate(0);
+
+	return ctx;
+}
+
+
+// Out-of-process, the core runs in a child and every call is a round trip
+// through the shared mapping
+
+static bool core_host_call(struct core *ctx, enum host_cmd cmd, uint32_t timeout)
+{
+	if (host_call(ctx->host, cmd, timeout))
+		return host_get_shm(ctx->host)->result != 0;
+
+	// The child crashed or hung and was killed, the frontend carries on without it
+	if (ctx->game_loaded && CORE_LOG)
+		CORE_LOG("Core process exited unexpectedly\n", CORE_LOG_OPAQUE);
+
+	ctx->game_loaded = false;
+
+	return false;
+}
+
+static void core_host_mirror(struct core *ctx)
+{
+	const struct host_shm *shm = host_get_shm(ctx->host);
+
+	ctx->system_timing.fps = shm->fps;
+	ctx->system_timing.sample_rate = shm->sample_rate;
+	ctx->game_geometry.aspect_ratio = shm->aspect_ratio;
+	ctx->audio_latency = shm->audio_latency;
+
+	switch (shm->color_format) {
+		case CORE_COLOR_FORMAT_BGRA:   ctx->pixel_format = RETRO_PIXEL_FORMAT_XRGB8888; break;
+		case CORE_COLOR_FORMAT_B5G6R5: ctx->pixel_format = RETRO_PIXEL_FORMAT_RGB565;   break;
+		default:                       ctx->pixel_format = RETRO_PIXEL_FORMAT_0RGB1555; break;
+	}
+}
+
+static void core_host_mirror_variables(struct core *ctx)
+{
+	const struct host_shm *shm = host_get_shm(ctx->host);
+
+	ctx->num_variables = shm->num_variables < CORE_VARIABLES_MAX ? shm->num_variables : CORE_VARIABLES_MAX;
+	ctx->variables_version = MTY_Atomic32Add(&CORE_VARIABLES_VERSION, 1);
+	memcpy(ctx->variables, HOST_VARS(shm), ctx->num_variables * sizeof(struct core_variable));
+}
+
+static bool core_host_load_game(struct core *ctx, const char *path)
+{
+	struct host_shm *shm = host_get_shm(ctx->host);
+	snprintf(shm->path, MTY_PATH_MAX, "%s", path);
+
+	ctx->game_loaded = core_host_call(ctx, HOST_CMD_LOAD_GAME, CORE_HOST_TIMEOUT_LOAD);
+
+	if (ctx->game_loaded) {
+		core_host_mirror(ctx);
+		core_host_mirror_variables(ctx);
+	}
+
+	return ctx->game_loaded;
+}
+
+struct core *core_load_hosted(const char *name, const char *exe)
 {
-	struct core *ctx = MTY_Alloc(1, sizeof(struct core));
+	struct core *ctx = core_alloc(name);
 
 	bool r = true;
 
-	snprintf(CORE_SAVE_DIR, MTY_PATH_MAX, "%s", MTY_JoinPath(MTY_GetProcessDir(), "save"));
-	snprintf(CORE_SYSTEM_DIR, MTY_PATH_MAX, "%s", MTY_JoinPath(MTY_GetProcessDir(), "system"));
+	ctx->host = host_create(exe);
+	if (!ctx->host) {
+		r = false;
+		goto except;
+	}
+
+	snprintf(host_get_shm(ctx->host)->path, MTY_PATH_MAX, "%s", name);
+
+	r = core_host_call(ctx, HOST_CMD_LOAD_CORE, CORE_HOST_TIMEOUT_LOAD);
+	if (!r)
+		goto except;
+
+	core_host_mirror_variables(ctx);
+
+	except:
+
+	if (!r)
+		core_unload(&ctx);
+
+	return ctx;
+}
+
+
+// Loading
+
+struct core *core_load(const char *name)
+{
+	struct core *ctx = core_alloc(name);
+
+	bool r = core_acquire_slot(ctx);
+	if (!r)
+		goto except;
+
+	// Shared objects are reference counted by the OS, so a second instance of the
+	// same core needs a private copy or it would share all of the core's globals
+	const char *path = name;
+
+	if (core_so_in_use(ctx)) {
+		ctx->so_copy = MTY_SprintfD("%s.%u", name, ctx->slot);
 
-	CORE_OPTS = MTY_HashCreate(0);
+		r = MTY_CopyFile(name, ctx->so_copy);
+		if (!r)
+			goto except;
+
+		path = ctx->so_copy;
+	}
 
-	ctx->so = MTY_SOLoad(name);
+	ctx->so = MTY_SOLoad(path);
 	if (!ctx->so) {
 		r = false;
 		goto except;
@@ -472,14 +1043,24 @@ struct core *core_load(const char *name)
 	if (!r)
 		goto except;
 
-	ctx->retro_set_environment(core_retro_environment);
+	const struct core_callbacks *cb = &CORE_CALLBACKS[ctx->slot];
+
+	ctx->perf_cb.get_time_usec = core_retro_perf_get_time_usec;
+	ctx->perf_cb.get_cpu_features = core_retro_get_cpu_features;
+	ctx->perf_cb.get_perf_counter = core_retro_perf_get_counter;
+	ctx->perf_cb.perf_register = cb->perf_register;
+	ctx->perf_cb.perf_start = core_retro_perf_start;
+	ctx->perf_cb.perf_stop = core_retro_perf_stop;
+	ctx->perf_cb.perf_log = cb->perf_log;
+
+	ctx->retro_set_environment(cb->environment);
 	ctx->retro_init();
 
-	ctx->retro_set_video_refresh(core_retro_video_refresh);
-	ctx->retro_set_audio_sample(core_retro_audio_sample);
-	ctx->retro_set_audio_sample_batch(core_retro_audio_sample_batch);
-	ctx->retro_set_input_poll(core_retro_input_poll);
-	ctx->retro_set_input_state(core_retro_input_state);
+	ctx->retro_set_video_refresh(cb->video_refresh);
+	ctx->retro_set_audio_sample(cb->audio_sample);
+	ctx->retro_set_audio_sample_batch(cb->audio_sample_batch);
+	ctx->retro_set_input_poll(cb->input_poll);
+	ctx->retro_set_input_state(cb->input_state);
 
 	ctx->retro_get_system_info(&ctx->system_info);
 
@@ -499,38 +1080,27 @@ void core_unload(struct core **core)
 	struct core *ctx = *core;
 
 	core_unload_game(ctx);
+	host_destroy(&ctx->host);
 
 	if (ctx->retro_deinit)
 		ctx->retro_deinit();
 
 	MTY_SOUnload(&ctx->so);
-	MTY_Free(ctx->game_path);
-	MTY_Free(ctx->game_data);
 
-	// Globals
-	RETRO_PIXEL_FORMAT = RETRO_PIXEL_FORMAT_0RGB1555;
-	memset(&RETRO_GAME_GEOMETRY, 0, sizeof(struct retro_game_geometry));
-	memset(&RETRO_SYSTEM_TIMING, 0, sizeof(struct retro_system_timing));
-	RETRO_REGION = 0;
-
-	CORE_NUM_VARIABLES = 0;
-	memset(CORE_VARIABLES, 0, sizeof(struct core_variable) * CORE_VARIABLES_MAX);
-
-	MTY_HashDestroy(&CORE_OPTS, MTY_Free);
-	CORE_OPT_SET = false;
+	if (ctx->so_copy) {
+		MTY_DeleteFile(ctx->so_copy);
+		MTY_Free(ctx->so_copy);
+	}
 
-	CORE_LOG = NULL;
-	CORE_AUDIO = NULL;
-	CORE_VIDEO = NULL;
-	CORE_LOG_OPAQUE = NULL;
-	CORE_AUDIO_OPAQUE = NULL;
-	CORE_VIDEO_OPAQUE = NULL;
-	CORE_NUM_FRAMES = 0;
+	core_release_slot(ctx);
 
-	memset(CORE_BUTTONS, 0, sizeof(bool) * CORE_PLAYERS_MAX * CORE_BUTTON_MAX);
-	memset(CORE_AXES, 0, sizeof(int16_t) * CORE_PLAYERS_MAX * CORE_AXIS_MAX);
+	MTY_HashDestroy(&ctx->opts, MTY_Free);
+	MTY_Free(ctx->state);
+	MTY_Free(ctx->so_path);
+	MTY_Free(ctx->game_path);
+	core_free_game_data(ctx);
 
-	MTY_Free(ctx);
+	MTY_FreeAligned(ctx);
 	*core = NULL;
 }
 
@@ -544,35 +1114,39 @@ bool core_load_game(struct core *ctx, const char *path)
 	MTY_Free(ctx->game_path);
 	ctx->game_path = MTY_Strdup(path);
 
-	MTY_Free(ctx->game_data);
-	ctx->game_data = NULL;
-	ctx->game_data_size = 0;
+	core_free_game_data(ctx);
+
+	ctx->frame_count = 0;
+	ctx->state_size = 0;
+	ctx->save_size = 0;
+	ctx->run_ahead_synced = false;
+	ctx->run_ahead_error = false;
+
+	if (ctx->host)
+		return core_host_load_game(ctx, path);
 
 	struct retro_game_info game = {0};
 	game.path = ctx->game_path;
 	game.meta = "merton";
 
-	if (!ctx->system_info.need_fullpath) {
-		ctx->game_data = MTY_ReadFile(path, &ctx->game_data_size);
-		if (!ctx->game_data)
-			return false;
-
-		game.data = ctx->game_data;
-		game.size = ctx->game_data_size;
-	}
+	if (!ctx->system_info.need_fullpath && !core_read_game_data(ctx, path, &game))
+		return false;
 
 	ctx->game_loaded = ctx->retro_load_game(&game);
 
+	if (!ctx->game_loaded)
+		core_free_game_data(ctx);
+
 	if (ctx->game_loaded) {
 		ctx->retro_set_controller_port_device(0, RETRO_DEVICE_JOYPAD);
 		ctx->retro_set_controller_port_device(1, RETRO_DEVICE_JOYPAD);
 
 		struct retro_system_av_info av_info = {0};
 		ctx->retro_get_system_av_info(&av_info);
-		RETRO_SYSTEM_TIMING = av_info.timing;
-		RETRO_GAME_GEOMETRY = av_info.geometry;
+		ctx->system_timing = av_info.timing;
+		ctx->game_geometry = av_info.geometry;
 
-		RETRO_REGION = ctx->retro_get_region();
+		ctx->region = ctx->retro_get_region();
 	}
 
 	return ctx->game_loaded;
@@ -583,8 +1157,22 @@ void core_unload_game(struct core *ctx)
 	if (!ctx || !ctx->game_loaded)
 		return;
 
+	if (ctx->host) {
+		core_host_call(ctx, HOST_CMD_UNLOAD_GAME, CORE_HOST_TIMEOUT_LOAD);
+		ctx->game_loaded = false;
+		ctx->audio_latency = 0;
+		return;
+	}
+
+	core_unload(&ctx->secondary);
+
 	ctx->retro_unload_game();
 	ctx->game_loaded = false;
+
+	// Cores may hold on to game.data until retro_unload_game
+	core_free_game_data(ctx);
+	ctx->audio_latency = 0;
+	ctx->num_regions = 0;
 }
 
 void core_reset_game(struct core *ctx)
@@ -592,20 +1180,393 @@ void core_reset_game(struct core *ctx)
 	if (!ctx || !ctx->game_loaded)
 		return;
 
-	ctx->retro_reset();
+	if (ctx->host) {
+		core_host_call(ctx, HOST_CMD_RESET, CORE_HOST_TIMEOUT_RUN);
+		return;
+	}
+
+	ctx->retro_reset();
+	ctx->run_ahead_synced = false;
 }
 
-void core_run_frame(struct core *ctx)
+
+// Run-ahead
+
+static bool core_serialize(struct core *ctx)
+{
+	if (ctx->state_size == 0 || (ctx->quirks & RETRO_SERIALIZATION_QUIRK_CORE_VARIABLE_SIZE)) {
+		ctx->state_size = ctx->retro_serialize_size();
+
+		if (ctx->state_size > ctx->state_cap) {
+			ctx->state = MTY_Realloc(ctx->state, ctx->state_size, 1);
+			ctx->state_cap = ctx->state_size;
+		}
+	}
+
+	return ctx->state_size > 0 && ctx->retro_serialize(ctx->state, ctx->state_size);
+}
+
+static void core_report_audio_status(struct core *ctx)
+{
+	if (ctx->audio_status)
+		ctx->audio_status(ctx->audio_active, ctx->audio_occupancy, ctx->audio_underrun);
+}
+
+static void core_run_hidden(struct core *ctx, uint32_t frames)
+{
+	// Only the video from the final frame is shown, audio is never kept
+	ctx->mute_audio = true;
+
+	for (uint32_t x = 0; x < frames; x++) {
+		ctx->hide_video = x + 1 < frames;
+		ctx->retro_run();
+	}
+
+	ctx->hide_video = false;
+	ctx->mute_audio = false;
+}
+
+static bool core_input_changed(struct core *ctx)
+{
+	bool changed = memcmp(ctx->latched, ctx->prev, sizeof(ctx->latched)) != 0;
+
+	memcpy(ctx->prev, ctx->latched, sizeof(ctx->latched));
+
+	return changed;
+}
+
+static bool core_create_secondary(struct core *ctx)
+{
+	struct core *secondary = core_load(ctx->so_path);
+	if (!secondary)
+		return false;
+
+	for (uint32_t x = 0; x < ctx->num_variables; x++) {
+		const char *val = MTY_HashGet(ctx->opts, ctx->variables[x].key);
+
+		if (val)
+			core_set_variable(secondary, ctx->variables[x].key, val);
+	}
+
+	if (!core_load_game(secondary, ctx->game_path)) {
+		core_unload(&secondary);
+		return false;
+	}
+
+	ctx->secondary = secondary;
+	ctx->run_ahead_synced = false;
+
+	return true;
+}
+
+static bool core_run_ahead_same(struct core *ctx)
+{
+	// The real frame keeps its audio, then K frames are run from a saved state
+	// and only the last one is shown before rolling back
+	ctx->hide_video = true;
+	ctx->retro_run();
+	ctx->hide_video = false;
+
+	core_end_latch(ctx);
+
+	ctx->fast_state = true;
+	bool ok = core_serialize(ctx);
+	ctx->fast_state = false;
+
+	if (!ok)
+		return false;
+
+	core_run_hidden(ctx, ctx->run_ahead);
+
+	ctx->fast_state = true;
+	ok = ctx->retro_unserialize(ctx->state, ctx->state_size);
+	ctx->fast_state = false;
+
+	return ok;
+}
+
+static bool core_run_ahead_secondary(struct core *ctx)
+{
+	struct core *secondary = ctx->secondary;
+	secondary->video = ctx->video;
+	secondary->video_opaque = ctx->video_opaque;
+	secondary->framebuffer = ctx->framebuffer;
+	secondary->framebuffer_opaque = ctx->framebuffer_opaque;
+
+	secondary->fast_forward = ctx->fast_forward;
+	secondary->fast_forward_rate = ctx->fast_forward_rate;
+
+	secondary->audio_active = ctx->audio_active;
+	secondary->audio_occupancy = ctx->audio_occupancy;
+	secondary->audio_underrun = ctx->audio_underrun;
+	core_report_audio_status(secondary);
+
+	ctx->hide_video = true;
+	ctx->retro_run();
+	ctx->hide_video = false;
+
+	// The real frame settles the snapshot the prediction is run with
+	core_end_latch(ctx);
+	memcpy(secondary->latched, ctx->latched, sizeof(ctx->latched));
+
+	// The secondary instance stays K frames ahead of the primary and only needs
+	// to be resynchronized when the input deviates from the prediction. The
+	// previous input is tracked on every frame so it never goes stale
+	bool changed = core_input_changed(ctx);
+
+	if (!ctx->run_ahead_synced || changed) {
+		ctx->run_ahead_synced = false;
+
+		// The state never leaves this process, so both instances may use their
+		// fast savestate paths for the sync
+		ctx->fast_state = secondary->fast_state = true;
+		bool ok = core_serialize(ctx) && secondary->retro_unserialize(ctx->state, ctx->state_size);
+		ctx->fast_state = secondary->fast_state = false;
+
+		if (!ok)
+			return false;
+
+		core_run_hidden(secondary, ctx->run_ahead);
+		ctx->run_ahead_synced = true;
+
+	} else {
+		core_run_hidden(secondary, 1);
+	}
+
+	return true;
+}
+
+static bool core_can_run_ahead(struct core *ctx)
+{
+	if (ctx->run_ahead == 0 || ctx->run_ahead_error)
+		return false;
+
+	if (ctx->quirks & RETRO_SERIALIZATION_QUIRK_INCOMPLETE)
+		return false;
+
+	if (ctx->frame_count == 0 && (ctx->quirks & RETRO_SERIALIZATION_QUIRK_MUST_INITIALIZE))
+		return false;
+
+	if (ctx->run_ahead_instance && !ctx->secondary && !core_create_secondary(ctx)) {
+		ctx->run_ahead_error = true;
+		return false;
+	}
+
+	return true;
+}
+
+void core_set_run_ahead(struct core *ctx, uint32_t frames, bool second_instance)
+{
+	if (!ctx)
+		return;
+
+	if (frames == ctx->run_ahead && second_instance == ctx->run_ahead_instance)
+		return;
+
+	ctx->run_ahead = frames;
+	ctx->run_ahead_instance = second_instance;
+	ctx->run_ahead_synced = false;
+	ctx->run_ahead_error = false;
+
+	if (frames == 0 || !second_instance)
+		core_unload(&ctx->secondary);
+}
+
+static void core_perf_collect(struct core *ctx)
+{
+	// Per frame deltas include any hidden run-ahead frames, that is the real cost
+	for (uint32_t x = 0; x < ctx->num_perf; x++) {
+		const struct retro_perf_counter *counter = ctx->perf[x];
+		struct core_perf_counter *stats = &ctx->perf_stats[x];
+
+		stats->frame_ticks = counter->total - stats->ticks;
+		stats->frame_calls = counter->call_cnt - stats->calls;
+		stats->ticks = counter->total;
+		stats->calls = counter->call_cnt;
+	}
+}
+
+void core_set_audio_buffer_status(struct core *ctx, bool active, uint32_t occupancy, bool underrun_likely)
+{
+	if (!ctx)
+		return;
+
+	ctx->audio_active = active;
+	ctx->audio_occupancy = occupancy > 100 ? 100 : occupancy;
+	ctx->audio_underrun = underrun_likely;
+}
+
+uint32_t core_get_audio_latency(struct core *ctx)
+{
+	if (!ctx || !ctx->game_loaded)
+		return 0;
+
+	return ctx->audio_latency;
+}
+
+void core_set_input_latch(struct core *ctx, enum core_latch latch)
+{
+	if (!ctx)
+		return;
+
+	ctx->latch = latch;
+}
+
+void core_get_input_stamps(struct core *ctx, MTY_Time *input, MTY_Time *latch)
+{
+	// When the newest event in the current snapshot arrived, and when it was taken
+	*input = ctx ? ctx->latch_stamp : 0;
+	*latch = ctx ? ctx->latch_time : 0;
+}
+
+void core_set_fast_forward(struct core *ctx, bool enabled, uint32_t ratio)
+{
+	if (!ctx)
+		return;
+
+	ctx->fast_forward = enabled;
+	ctx->fast_forward_rate = enabled ? (float) (ctx->system_timing.fps * ratio) : 0.0f;
+}
+
+static void core_end_frame(struct core *ctx)
+{
+	core_perf_collect(ctx);
+
+	ctx->frame_count++;
+
+	if (ctx->audio) {
+		ctx->audio(ctx->frames, ctx->num_frames, ctx->audio_opaque);
+		ctx->num_frames = 0;
+	}
+}
+
+static void core_host_run(struct core *ctx, enum host_run mode)
+{
+	struct host_shm *shm = host_get_shm(ctx->host);
+
+	// Input hooks run on this side so movies and netplay work unchanged
+	core_latch_input(ctx);
+	memcpy(shm->input, ctx->latched, sizeof(ctx->latched));
+
+	shm->size = mode;
+	shm->run_ahead = ctx->run_ahead;
+	shm->run_ahead_instance = ctx->run_ahead_instance;
+	shm->fast_forward = ctx->fast_forward;
+	shm->fast_forward_ratio = ctx->system_timing.fps > 0.0 ?
+		(float) (ctx->fast_forward_rate / ctx->system_timing.fps) : 0.0f;
+	shm->audio_active = ctx->audio_active;
+	shm->audio_occupancy = ctx->audio_occupancy;
+	shm->audio_underrun = ctx->audio_underrun;
+
+	MTY_Time stamp = MTY_GetTime();
+
+	if (!core_host_call(ctx, HOST_CMD_RUN, CORE_HOST_TIMEOUT_RUN))
+		return;
+
+	// Whatever the round trip took beyond the child's own frame
+	float overhead = MTY_TimeDiff(stamp, MTY_GetTime()) * 1000.0f - shm->exec_us;
+	ctx->host_overhead = ctx->frame_count == 0 ? overhead : ctx->host_overhead * 0.95f + overhead * 0.05f;
+
+	core_host_mirror(ctx);
+
+	// Both are handed out as pointers into the shared mapping
+	if (ctx->video && shm->video)
+		ctx->video(shm->dupe ? NULL : HOST_VIDEO(shm, shm->video_slot) + shm->video_offset,
+			shm->width, shm->height, shm->pitch, ctx->video_opaque);
+
+	if (ctx->audio && mode != HOST_RUN_REPLAY)
+		ctx->audio(HOST_AUDIO(shm, shm->audio_slot), shm->audio_frames, ctx->audio_opaque);
+
+	ctx->frame_count++;
+}
+
+void core_skip_frame(struct core *ctx)
 {
 	if (!ctx || !ctx->game_loaded)
 		return;
 
+	if (ctx->host) {
+		core_host_run(ctx, HOST_RUN_SKIP);
+		return;
+	}
+
+	core_begin_latch(ctx);
+	core_report_audio_status(ctx);
+
+	// Nothing is shown so run-ahead is skipped, the prediction is rebuilt on
+	// the next shown frame
+	ctx->hide_video = true;
 	ctx->retro_run();
+	ctx->hide_video = false;
 
-	if (CORE_AUDIO) {
-		CORE_AUDIO(CORE_FRAMES, CORE_NUM_FRAMES, CORE_AUDIO_OPAQUE);
-		CORE_NUM_FRAMES = 0;
+	core_end_latch(ctx);
+
+	ctx->run_ahead_synced = false;
+
+	core_end_frame(ctx);
+}
+
+void core_replay_frame(struct core *ctx)
+{
+	if (!ctx || !ctx->game_loaded)
+		return;
+
+	if (ctx->host) {
+		core_host_run(ctx, HOST_RUN_REPLAY);
+		return;
 	}
+
+	core_begin_latch(ctx);
+
+	// Resimulated frames were already seen and heard, only their effect on
+	// the state matters
+	ctx->hide_video = true;
+	ctx->mute_audio = true;
+	ctx->retro_run();
+	ctx->hide_video = false;
+	ctx->mute_audio = false;
+
+	core_end_latch(ctx);
+
+	ctx->run_ahead_synced = false;
+
+	core_perf_collect(ctx);
+	ctx->frame_count++;
+}
+
+void core_run_frame(struct core *ctx)
+{
+	if (!ctx || !ctx->game_loaded)
+		return;
+
+	if (ctx->host) {
+		core_host_run(ctx, HOST_RUN_FRAME);
+		return;
+	}
+
+	core_begin_latch(ctx);
+	core_report_audio_status(ctx);
+
+	if (!core_can_run_ahead(ctx)) {
+		ctx->retro_run();
+		core_end_latch(ctx);
+
+	} else {
+		bool ok = ctx->run_ahead_instance ? core_run_ahead_secondary(ctx) :
+			core_run_ahead_same(ctx);
+
+		// Serialization failed part way through, show the previous frame and
+		// stop trying for this session
+		if (!ok) {
+			core_end_latch(ctx);
+			ctx->run_ahead_error = true;
+
+			if (ctx->video)
+				ctx->video(NULL, 0, 0, 0, ctx->video_opaque);
+		}
+	}
+
+	core_end_frame(ctx);
 }
 
 enum core_color_format core_get_color_format(struct core *ctx)
@@ -613,7 +1574,7 @@ enum core_color_format core_get_color_format(struct core *ctx)
 	if (!ctx)
 		return CORE_COLOR_FORMAT_UNKNOWN;
 
-	switch (RETRO_PIXEL_FORMAT) {
+	switch (ctx->pixel_format) {
 		case RETRO_PIXEL_FORMAT_XRGB8888: return CORE_COLOR_FORMAT_BGRA;
 		case RETRO_PIXEL_FORMAT_RGB565:   return CORE_COLOR_FORMAT_B5G6R5;
 		case RETRO_PIXEL_FORMAT_0RGB1555: return CORE_COLOR_FORMAT_B5G5R5A1;
@@ -627,7 +1588,7 @@ uint32_t core_get_sample_rate(struct core *ctx)
 	if (!ctx || !ctx->game_loaded)
 		return 0;
 
-	return lrint(RETRO_SYSTEM_TIMING.sample_rate);
+	return lrint(ctx->system_timing.sample_rate);
 }
 
 double core_get_frame_rate(struct core *ctx)
@@ -635,7 +1596,7 @@ double core_get_frame_rate(struct core *ctx)
 	if (!ctx || !ctx->game_loaded)
 		return 0;
 
-	return RETRO_SYSTEM_TIMING.fps;
+	return ctx->system_timing.fps;
 }
 
 float core_get_aspect_ratio(struct core *ctx)
@@ -643,28 +1604,50 @@ float core_get_aspect_ratio(struct core *ctx)
 	if (!ctx || !ctx->game_loaded)
 		return 0.0f;
 
-	float ar = RETRO_GAME_GEOMETRY.aspect_ratio;
+	float ar = ctx->game_geometry.aspect_ratio;
 
 	if (ar <= 0.0f)
-		ar = (float) RETRO_GAME_GEOMETRY.base_width / (float) RETRO_GAME_GEOMETRY.base_height;
+		ar = (float) ctx->game_geometry.base_width / (float) ctx->game_geometry.base_height;
 
 	return ar;
 }
 
 void core_set_button(struct core *ctx, uint8_t player, enum core_button button, bool pressed)
 {
-	if (!ctx)
+	if (!ctx || player >= CORE_PLAYERS_MAX || button <= 0 || button >= CORE_BUTTON_MAX)
 		return;
 
-	CORE_BUTTONS[player][button] = pressed;
+	struct core_input_slot *slot = &ctx->input[player];
+	uint32_t bit = 1u << CORE_BUTTON_MAP[button];
+
+	// Single writer, an odd sequence marks the slot as being written
+	MTY_Atomic32Add(&slot->seq, 1);
+
+	uint32_t buttons = pressed ? slot->input.buttons | bit : slot->input.buttons & ~bit;
+
+	if (buttons != slot->input.buttons) {
+		slot->input.buttons = buttons;
+		slot->stamp = MTY_GetTime();
+	}
+
+	MTY_Atomic32Add(&slot->seq, 1);
 }
 
 void core_set_axis(struct core *ctx, uint8_t player, enum core_axis axis, int16_t value)
 {
-	if (!ctx)
+	if (!ctx || player >= CORE_PLAYERS_MAX || axis <= 0 || axis >= CORE_AXIS_MAX)
 		return;
 
-	CORE_AXES[player][axis] = value;
+	struct core_input_slot *slot = &ctx->input[player];
+
+	MTY_Atomic32Add(&slot->seq, 1);
+
+	if (value != slot->input.axes[axis]) {
+		slot->input.axes[axis] = value;
+		slot->stamp = MTY_GetTime();
+	}
+
+	MTY_Atomic32Add(&slot->seq, 1);
 }
 
 void *core_get_state(struct core *ctx, size_t *size)
@@ -672,6 +1655,12 @@ void *core_get_state(struct core *ctx, size_t *size)
 	if (!ctx || !ctx->game_loaded)
 		return NULL;
 
+	if (ctx->host) {
+		const void *state = core_get_state_buffer(ctx, size);
+
+		return state ? MTY_Dup(state, *size) : NULL;
+	}
+
 	*size = ctx->retro_serialize_size();
 	if (*size == 0)
 		return NULL;
@@ -685,19 +1674,129 @@ void *core_get_state(struct core *ctx, size_t *size)
 	return state;
 }
 
+size_t core_get_state_size(struct core *ctx)
+{
+	if (!ctx || !ctx->game_loaded)
+		return 0;
+
+	if (ctx->host) {
+		if (ctx->save_size == 0 && core_host_call(ctx, HOST_CMD_STATE_SIZE, CORE_HOST_TIMEOUT_RUN))
+			ctx->save_size = host_get_shm(ctx->host)->size;
+
+		return ctx->save_size;
+	}
+
+	// Only cores that flag variable sized states pay for the query every time
+	if (ctx->save_size == 0 || (ctx->quirks & RETRO_SERIALIZATION_QUIRK_CORE_VARIABLE_SIZE))
+		ctx->save_size = ctx->retro_serialize_size();
+
+	return ctx->save_size;
+}
+
+bool core_copy_state(struct core *ctx, void *buf, size_t size)
+{
+	if (!ctx || !ctx->game_loaded || !buf || size == 0)
+		return false;
+
+	if (ctx->host) {
+		size_t state_size = 0;
+		const void *state = core_get_state_buffer(ctx, &state_size);
+
+		if (!state || state_size > size)
+			return false;
+
+		memcpy(buf, state, state_size);
+
+		return true;
+	}
+
+	return ctx->retro_serialize(buf, size);
+}
+
+const void *core_get_state_buffer(struct core *ctx, size_t *size)
+{
+	if (!ctx || !ctx->game_loaded)
+		return NULL;
+
+	if (ctx->host) {
+		if (!core_host_call(ctx, HOST_CMD_SAVE_STATE, CORE_HOST_TIMEOUT_RUN))
+			return NULL;
+
+		*size = host_get_shm(ctx->host)->size;
+
+		return HOST_STATE(host_get_shm(ctx->host));
+	}
+
+	if (ctx->frame_count == 0 && (ctx->quirks & RETRO_SERIALIZATION_QUIRK_MUST_INITIALIZE))
+		return NULL;
+
+	if (!core_serialize(ctx))
+		return NULL;
+
+	*size = ctx->state_size;
+
+	return ctx->state;
+}
+
 bool core_set_state(struct core *ctx, const void *state, size_t size)
 {
 	if (!ctx || !ctx->game_loaded)
 		return false;
 
+	ctx->run_ahead_synced = false;
+
+	if (ctx->host) {
+		struct host_shm *shm = host_get_shm(ctx->host);
+
+		if (size > HOST_STATE_MAX)
+			return false;
+
+		memcpy(HOST_STATE(shm), state, size);
+		shm->size = size;
+
+		return core_host_call(ctx, HOST_CMD_LOAD_STATE, CORE_HOST_TIMEOUT_RUN);
+	}
+
 	return ctx->retro_unserialize(state, size);
 }
 
+const struct core_memory_region *core_get_memory_regions(struct core *ctx, uint32_t *len)
+{
+	*len = 0;
+
+	// Memory of a core in another process can not be searched or frozen
+	if (!ctx || !ctx->game_loaded || ctx->host)
+		return NULL;
+
+	if (ctx->num_regions > 0) {
+		*len = ctx->num_regions;
+		return ctx->regions;
+	}
+
+	// Cores without memory maps still expose their main RAM
+	ctx->system_ram.ptr = ctx->retro_get_memory_data(RETRO_MEMORY_SYSTEM_RAM);
+	ctx->system_ram.size = ctx->retro_get_memory_size(RETRO_MEMORY_SYSTEM_RAM);
+	ctx->system_ram.start = 0;
+
+	if (!ctx->system_ram.ptr || ctx->system_ram.size == 0)
+		return NULL;
+
+	*len = 1;
+
+	return &ctx->system_ram;
+}
+
 void *core_get_sram(struct core *ctx, size_t *size)
 {
 	if (!ctx || !ctx->game_loaded)
 		return NULL;
 
+	if (ctx->host) {
+		const void *sram = core_get_sram_buffer(ctx, size);
+
+		return sram ? MTY_Dup(sram, *size) : NULL;
+	}
+
 	*size = ctx->retro_get_memory_size(RETRO_MEMORY_SAVE_RAM);
 	if (*size == 0)
 		return NULL;
@@ -712,11 +1811,47 @@ void *core_get_sram(struct core *ctx, size_t *size)
 	return dup;
 }
 
+const void *core_get_sram_buffer(struct core *ctx, size_t *size)
+{
+	*size = 0;
+
+	if (!ctx || !ctx->game_loaded)
+		return NULL;
+
+	// The child mirrors SRAM after every frame
+	if (ctx->host) {
+		const struct host_shm *shm = host_get_shm(ctx->host);
+		*size = (size_t) shm->sram_size;
+
+		return *size > 0 ? HOST_SRAM(shm) : NULL;
+	}
+
+	const void *sram = ctx->retro_get_memory_data(RETRO_MEMORY_SAVE_RAM);
+	if (!sram)
+		return NULL;
+
+	*size = ctx->retro_get_memory_size(RETRO_MEMORY_SAVE_RAM);
+
+	return sram;
+}
+
 bool core_set_sram(struct core *ctx, const void *sram, size_t size)
 {
 	if (!ctx || !ctx->game_loaded)
 		return false;
 
+	if (ctx->host) {
+		struct host_shm *shm = host_get_shm(ctx->host);
+
+		if (size > HOST_SRAM_MAX)
+			return false;
+
+		memcpy(HOST_SRAM(shm), sram, size);
+		shm->size = size;
+
+		return core_host_call(ctx, HOST_CMD_SET_SRAM, CORE_HOST_TIMEOUT_RUN);
+	}
+
 	if (ctx->retro_get_memory_size(RETRO_MEMORY_SAVE_RAM) != size)
 		return false;
 
@@ -734,7 +1869,37 @@ const char *core_get_save_dir(struct core *ctx)
 	if (!ctx)
 		return NULL;
 
-	return CORE_SAVE_DIR;
+	return ctx->save_dir;
+}
+
+const char *core_get_path(struct core *ctx)
+{
+	if (!ctx)
+		return NULL;
+
+	return ctx->so_path;
+}
+
+const char *core_get_library_name(struct core *ctx)
+{
+	if (!ctx)
+		return "";
+
+	if (ctx->host)
+		return host_get_shm(ctx->host)->library_name;
+
+	return ctx->system_info.library_name ? ctx->system_info.library_name : "";
+}
+
+const char *core_get_library_version(struct core *ctx)
+{
+	if (!ctx)
+		return "";
+
+	if (ctx->host)
+		return host_get_shm(ctx->host)->library_version;
+
+	return ctx->system_info.library_version ? ctx->system_info.library_version : "";
 }
 
 const char *core_get_game_path(struct core *ctx)
@@ -750,6 +1915,16 @@ bool core_game_is_loaded(struct core *ctx)
 	return ctx ? ctx->game_loaded : false;
 }
 
+bool core_is_hosted(struct core *ctx)
+{
+	return ctx ? ctx->host != NULL : false;
+}
+
+float core_get_host_overhead(struct core *ctx)
+{
+	return ctx ? ctx->host_overhead : 0.0f;
+}
+
 void core_set_log_func(CORE_LOG_FUNC func, void *opaque)
 {
 	CORE_LOG = func;
@@ -761,8 +1936,8 @@ void core_set_audio_func(struct core *ctx, CORE_AUDIO_FUNC func, void *opaque)
 	if (!ctx)
 		return;
 
-	CORE_AUDIO = func;
-	CORE_AUDIO_OPAQUE = opaque;
+	ctx->audio = func;
+	ctx->audio_opaque = opaque;
 }
 
 void core_set_video_func(struct core *ctx, CORE_VIDEO_FUNC func, void *opaque)
@@ -770,15 +1945,43 @@ void core_set_video_func(struct core *ctx, CORE_VIDEO_FUNC func, void *opaque)
 	if (!ctx)
 		return;
 
-	CORE_VIDEO = func;
-	CORE_VIDEO_OPAQUE = opaque;
+	ctx->video = func;
+	ctx->video_opaque = opaque;
+}
+
+void core_set_framebuffer_func(struct core *ctx, CORE_FRAMEBUFFER_FUNC func, void *opaque)
+{
+	if (!ctx)
+		return;
+
+	ctx->framebuffer = func;
+	ctx->framebuffer_opaque = opaque;
+}
+
+void core_set_input_func(struct core *ctx, CORE_INPUT_FUNC func, void *opaque)
+{
+	if (!ctx)
+		return;
+
+	ctx->input_func = func;
+	ctx->input_opaque = opaque;
 }
 
 const struct core_variable *core_get_variables(struct core *ctx, uint32_t *len)
 {
-	*len = CORE_NUM_VARIABLES;
+	if (!ctx) {
+		*len = 0;
+		return NULL;
+	}
+
+	*len = ctx->num_variables;
 
-	return CORE_VARIABLES;
+	return ctx->variables;
+}
+
+uint32_t core_get_variables_version(struct core *ctx)
+{
+	return ctx ? ctx->variables_version : 0;
 }
 
 void core_set_variable(struct core *ctx, const char *key, const char *val)
@@ -786,9 +1989,19 @@ void core_set_variable(struct core *ctx, const char *key, const char *val)
 	if (!ctx)
 		return;
 
-	MTY_Free(MTY_HashSet(CORE_OPTS, key, MTY_Strdup(val)));
+	MTY_Free(MTY_HashSet(ctx->opts, key, MTY_Strdup(val)));
+
+	ctx->opt_set = true;
+
+	if (ctx->host) {
+		struct host_shm *shm = host_get_shm(ctx->host);
+		snprintf(shm->path, MTY_PATH_MAX, "%s", key);
+		snprintf(shm->val, HOST_VAL_MAX, "%s", val);
+
+		core_host_call(ctx, HOST_CMD_SET_VAR, CORE_HOST_TIMEOUT_RUN);
+	}
 
-	CORE_OPT_SET = true;
+	core_set_variable(ctx->secondary, key, val);
 }
 
 const char *core_get_variable(struct core *ctx, const char *key)
@@ -796,16 +2009,60 @@ const char *core_get_variable(struct core *ctx, const char *key)
 	if (!ctx)
 		return NULL;
 
-	return MTY_HashGet(CORE_OPTS, key);
+	return MTY_HashGet(ctx->opts, key);
 }
 
 void core_clear_variables(struct core *ctx)
 {
-	MTY_HashDestroy(&CORE_OPTS, MTY_Free);
-	CORE_OPTS = MTY_HashCreate(0);
+	if (!ctx)
+		return;
+
+	MTY_HashDestroy(&ctx->opts, MTY_Free);
+	ctx->opts = MTY_HashCreate(0);
+
+	if (ctx->host)
+		core_host_call(ctx, HOST_CMD_CLEAR_VARS, CORE_HOST_TIMEOUT_RUN);
+
+	for (uint32_t x = 0; x < ctx->num_variables; x++)
+		MTY_HashSet(ctx->opts, ctx->variables[x].key, MTY_Strdup(ctx->variables[x].opts[0]));
+
+	ctx->opt_set = true;
+
+	core_clear_variables(ctx->secondary);
+}
+
+const struct core_perf_counter *core_get_perf_counters(struct core *ctx, uint32_t *len)
+{
+	*len = 0;
 
-	for (uint32_t x = 0; x < CORE_NUM_VARIABLES; x++)
-		MTY_HashSet(CORE_OPTS, CORE_VARIABLES[x].key, MTY_Strdup(CORE_VARIABLES[x].opts[0]));
+	if (!ctx)
+		return NULL;
+
+	*len = ctx->num_perf;
 
-	CORE_OPT_SET = true;
+	return ctx->perf_stats;
+}
+
+void core_log_perf_counters(struct core *ctx)
+{
+	if (!ctx || !CORE_LOG)
+		return;
+
+	if (ctx->host) {
+		char *msg = MTY_SprintfD("[PERF] out-of-process: %.1f us/frame\n", ctx->host_overhead);
+
+		CORE_LOG(msg, CORE_LOG_OPAQUE);
+		MTY_Free(msg);
+	}
+
+	for (uint32_t x = 0; x < ctx->num_perf; x++) {
+		const struct core_perf_counter *stats = &ctx->perf_stats[x];
+
+		char *msg = MTY_SprintfD("[PERF] %s: %llu ticks, %llu calls, %llu ticks/call\n",
+			stats->name, (unsigned long long) stats->ticks, (unsigned long long) stats->calls,
+			(unsigned long long) (stats->calls > 0 ? stats->ticks / stats->calls : 0));
+
+		CORE_LOG(msg, CORE_LOG_OPAQUE);
+		MTY_Free(msg);
+	}
 }
@@ -9,11 +9,16 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "matoya.h"
+
+#define CORE_INSTANCES_MAX 8
 #define CORE_PLAYERS_MAX   8
 #define CORE_DESC_MAX      128
 #define CORE_OPTS_MAX      128
 #define CORE_KEY_NAME_MAX  64
 #define CORE_OPT_NAME_MAX  64
+#define CORE_PERF_NAME_MAX 64
+#define CORE_REGIONS_MAX   32
 
 #define CORE_FRAMES_MAX    0x4000
 #define CORE_SAMPLES_MAX   (CORE_FRAMES_MAX * 2)
@@ -53,6 +58,22 @@ enum core_color_format {
 	CORE_COLOR_FORMAT_B5G5R5A1 = 3,
 };
 
+enum core_latch {
+	CORE_LATCH_POLL  = 0,
+	CORE_LATCH_STATE = 1,
+};
+
+struct core_input {
+	uint32_t buttons;
+	int16_t axes[CORE_AXIS_MAX];
+};
+
+struct core_memory_region {
+	void *ptr;
+	size_t size;
+	uint64_t start;
+};
+
 struct core_variable {
 	uint32_t nopts;
 	char key[CORE_KEY_NAME_MAX];
@@ -60,26 +81,56 @@ struct core_variable {
 	char opts[CORE_OPTS_MAX][CORE_OPT_NAME_MAX];
 };
 
+struct core_perf_counter {
+	char name[CORE_PERF_NAME_MAX];
+	uint64_t ticks;
+	uint64_t calls;
+	uint64_t frame_ticks;
+	uint64_t frame_calls;
+};
+
 typedef void (*CORE_LOG_FUNC)(const char *msg, void *opaque);
 typedef void (*CORE_AUDIO_FUNC)(const int16_t *buf, size_t frames, void *opaque);
 typedef void (*CORE_VIDEO_FUNC)(const void *buf, uint32_t width, uint32_t height,
 	size_t pitch, void *opaque);
+typedef void *(*CORE_FRAMEBUFFER_FUNC)(uint32_t width, uint32_t height,
+	enum core_color_format format, size_t *pitch, void *opaque);
+typedef void (*CORE_INPUT_FUNC)(struct core_input *input, uint8_t players, void *opaque);
 
 struct core *core_load(const char *name);
+struct core *core_load_hosted(const char *name, const char *exe);
 void core_unload(struct core **core);
 bool core_load_game(struct core *ctx, const char *path);
 void core_unload_game(struct core *ctx);
 void core_reset_game(struct core *ctx);
 void core_run_frame(struct core *ctx);
+void core_skip_frame(struct core *ctx);
+void core_replay_frame(struct core *ctx);
+void core_set_run_ahead(struct core *ctx, uint32_t frames, bool second_instance);
+void core_set_fast_forward(struct core *ctx, bool enabled, uint32_t ratio);
+void core_set_input_latch(struct core *ctx, enum core_latch latch);
+void core_get_input_stamps(struct core *ctx, MTY_Time *input, MTY_Time *latch);
+void core_set_audio_buffer_status(struct core *ctx, bool active, uint32_t occupancy, bool underrun_likely);
+uint32_t core_get_audio_latency(struct core *ctx);
 void core_set_button(struct core *ctx, uint8_t player, enum core_button button, bool pressed);
 void core_set_axis(struct core *ctx, uint8_t player, enum core_axis axis, int16_t value);
 void *core_get_state(struct core *ctx, size_t *size);
+size_t core_get_state_size(struct core *ctx);
+bool core_copy_state(struct core *ctx, void *buf, size_t size);
 bool core_set_state(struct core *ctx, const void *state, size_t size);
+const void *core_get_state_buffer(struct core *ctx, size_t *size);
 void *core_get_sram(struct core *ctx, size_t *size);
+const void *core_get_sram_buffer(struct core *ctx, size_t *size);
+const struct core_memory_region *core_get_memory_regions(struct core *ctx, uint32_t *len);
 bool core_set_sram(struct core *ctx, const void *sram, size_t size);
 const char *core_get_save_dir(struct core *ctx);
+const char *core_get_path(struct core *ctx);
+const char *core_get_library_name(struct core *ctx);
+const char *core_get_library_version(struct core *ctx);
 const char *core_get_game_path(struct core *ctx);
 bool core_game_is_loaded(struct core *ctx);
+bool core_is_hosted(struct core *ctx);
+float core_get_host_overhead(struct core *ctx);
 uint32_t core_get_sample_rate(struct core *ctx);
 double core_get_frame_rate(struct core *ctx);
 float core_get_aspect_ratio(struct core *ctx);
@@ -87,7 +138,12 @@ enum core_color_format core_get_color_format(struct core *ctx);
 void core_set_log_func(CORE_LOG_FUNC func, void *opaque);
 void core_set_audio_func(struct core *ctx, CORE_AUDIO_FUNC func, void *opaque);
 void core_set_video_func(struct core *ctx, CORE_VIDEO_FUNC func, void *opaque);
+void core_set_framebuffer_func(struct core *ctx, CORE_FRAMEBUFFER_FUNC func, void *opaque);
+void core_set_input_func(struct core *ctx, CORE_INPUT_FUNC func, void *opaque);
 const struct core_variable *core_get_variables(struct core *ctx, uint32_t *len);
+uint32_t core_get_variables_version(struct core *ctx);
 void core_set_variable(struct core *ctx, const char *key, const char *val);
 const char *core_get_variable(struct core *ctx, const char *key);
 void core_clear_variables(struct core *ctx);
+const struct core_perf_counter *core_get_perf_counters(struct core *ctx, uint32_t *len);
+void core_log_perf_counters(struct core *ctx);
@@ -0,0 +1,203 @@
+// Copyright (c) Christopher D. Dickson <cdd@matoya.group>
+//
+// This Source Code Form is subject to the terms of the MIT License.
+// If a copy of the MIT License was not distributed with this file,
+// You can obtain one at https://spdx.org/licenses/MIT.html.
+
+#include "fmap.h"
+
+#include "matoya.h"
+
+#if defined(_WIN32)
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+#endif
+
+struct fmap {
+	void *data;
+	size_t size;
+
+	// Optional, every call that reaches the OS is added to it
+	MTY_Atomic64 *syscalls;
+
+	#if defined(_WIN32)
+	HANDLE mapping;
+	#endif
+};
+
+
+static void fmap_count(struct fmap *ctx)
+{
+	if (ctx->syscalls)
+		MTY_Atomic64Add(ctx->syscalls, 1);
+}
+
+
+// Read only mappings share pages with the page cache, copy-on-write mappings
+// may be written to without the changes ever reaching the file
+
+#if defined(_WIN32)
+
+static bool fmap_map(struct fmap *ctx, const char *path, bool cow)
+{
+	WCHAR *wpath = MTY_MultiToWideD(path);
+	HANDLE file = CreateFileW(wpath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL, NULL);
+	MTY_Free(wpath);
+	fmap_count(ctx);
+
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	bool r = false;
+
+	LARGE_INTEGER size = {0};
+	BOOL have_size = GetFileSizeEx(file, &size);
+	fmap_count(ctx);
+
+	if (!have_size || size.QuadPart == 0 || (uint64_t) size.QuadPart > SIZE_MAX)
+		goto except;
+
+	ctx->size = (size_t) size.QuadPart;
+
+	ctx->mapping = CreateFileMappingW(file, NULL, cow ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+	fmap_count(ctx);
+
+	if (!ctx->mapping)
+		goto except;
+
+	ctx->data = MapViewOfFile(ctx->mapping, cow ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+	fmap_count(ctx);
+
+	if (!ctx->data)
+		goto except;
+
+	r = true;
+
+	except:
+
+	CloseHandle(file);
+	fmap_count(ctx);
+
+	return r;
+}
+
+static void fmap_unmap(struct fmap *ctx)
+{
+	if (ctx->data) {
+		UnmapViewOfFile(ctx->data);
+		fmap_count(ctx);
+	}
+
+	if (ctx->mapping) {
+		CloseHandle(ctx->mapping);
+		fmap_count(ctx);
+	}
+}
+
+void fmap_will_need(struct fmap *ctx)
+{
+}
+
+#else
+
+static bool fmap_map(struct fmap *ctx, const char *path, bool cow)
+{
+	int32_t fd = open(path, O_RDONLY);
+	fmap_count(ctx);
+
+	if (fd == -1)
+		return false;
+
+	bool r = false;
+
+	struct stat st;
+	int32_t e = fstat(fd, &st);
+	fmap_count(ctx);
+
+	if (e != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+		goto except;
+
+	ctx->size = (size_t) st.st_size;
+
+	void *data = mmap(NULL, ctx->size, cow ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, fd, 0);
+	fmap_count(ctx);
+
+	if (data == MAP_FAILED)
+		goto except;
+
+	ctx->data = data;
+	r = true;
+
+	except:
+
+	// The mapping holds its own reference to the file
+	close(fd);
+	fmap_count(ctx);
+
+	return r;
+}
+
+static void fmap_unmap(struct fmap *ctx)
+{
+	if (ctx->data) {
+		munmap(ctx->data, ctx->size);
+		fmap_count(ctx);
+	}
+}
+
+void fmap_will_need(struct fmap *ctx)
+{
+	if (ctx) {
+		posix_madvise(ctx->data, ctx->size, POSIX_MADV_WILLNEED);
+		fmap_count(ctx);
+	}
+}
+
+#endif
+
+
+// Public
+
+struct fmap *fmap_open_counted(const char *path, bool cow, MTY_Atomic64 *syscalls)
+{
+	struct fmap *ctx = MTY_Alloc(1, sizeof(struct fmap));
+	ctx->syscalls = syscalls;
+
+	if (!fmap_map(ctx, path, cow))
+		fmap_close(&ctx);
+
+	return ctx;
+}
+
+struct fmap *fmap_open(const char *path, bool cow)
+{
+	return fmap_open_counted(path, cow, NULL);
+}
+
+void fmap_close(struct fmap **fmap)
+{
+	if (!fmap || !*fmap)
+		return;
+
+	struct fmap *ctx = *fmap;
+
+	fmap_unmap(ctx);
+
+	MTY_Free(ctx);
+	*fmap = NULL;
+}
+
+void *fmap_get_data(struct fmap *ctx)
+{
+	return ctx ? ctx->data : NULL;
+}
+
+size_t fmap_get_size(struct fmap *ctx)
+{
+	return ctx ? ctx->size : 0;
+}
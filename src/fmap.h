@@ -0,0 +1,22 @@
+// Copyright (c) Christopher D. Dickson <cdd@matoya.group>
+//
+// This Source Code Form is subject to the terms of the MIT License.
+// If a copy of the MIT License was not distributed with this file,
+// You can obtain one at https://spdx.org/licenses/MIT.html.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "matoya.h"
+
+struct fmap;
+
+struct fmap *fmap_open(const char *path, bool cow);
+struct fmap *fmap_open_counted(const char *path, bool cow, MTY_Atomic64 *syscalls);
+void fmap_close(struct fmap **fmap);
+void *fmap_get_data(struct fmap *ctx);
+size_t fmap_get_size(struct fmap *ctx);
+void fmap_will_need(struct fmap *ctx);
@@ -0,0 +1,534 @@
+// Copyright (c) Christopher D. Dickson <cdd@matoya.group>
+//
+// This Source Code Form is subject to the terms of the MIT License.
+// If a copy of the MIT License was not distributed with this file,
+// You can obtain one at https://spdx.org/licenses/MIT.html.
+
+// shm_open and posix_spawn are POSIX.1-2001
+#if !defined(_WIN32)
+	#define _XOPEN_SOURCE 700
+#endif
+
+#include "host.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#if !defined(_WIN32) && !defined(__ANDROID__) && !defined(__EMSCRIPTEN__)
+	#define HOST_SUPPORTED
+
+	#include <errno.h>
+	#include <fcntl.h>
+	#include <sched.h>
+	#include <signal.h>
+	#include <spawn.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/wait.h>
+
+	extern char **environ;
+#endif
+
+#define HOST_MAGIC        0x54534F48 // HOST
+#define HOST_SHM_NAME_MAX 64
+#define HOST_SPIN         2000
+#define HOST_ALIGN        64
+
+#define HOST_TIMEOUT_ATTACH 5000
+#define HOST_TIMEOUT_QUIT   1000
+
+struct host {
+	struct host_shm *shm;
+	char name[HOST_SHM_NAME_MAX];
+	bool dead;
+
+	#if defined(HOST_SUPPORTED)
+		pid_t pid;
+		int32_t doorbell;
+	#endif
+};
+
+#if defined(HOST_SUPPORTED)
+
+
+// Parent
+
+static MTY_Atomic32 HOST_COUNT;
+
+static bool host_reap(struct host *ctx, bool kill_child)
+{
+	if (ctx->pid <= 0)
+		return true;
+
+	if (kill_child)
+		kill(ctx->pid, SIGKILL);
+
+	int32_t status = 0;
+	pid_t r = waitpid(ctx->pid, &status, kill_child ? 0 : WNOHANG);
+
+	if (r == ctx->pid) {
+		ctx->pid = 0;
+		ctx->dead = true;
+		return true;
+	}
+
+	return false;
+}
+
+static bool host_wait(struct host *ctx, uint32_t seq, uint32_t timeout)
+{
+	MTY_Time stamp = MTY_GetTime();
+
+	// The parent has nothing else to do until the frame is back, so it spins for
+	// the first few microseconds and yields after that rather than sleeping
+	for (uint32_t x = 0; ; x++) {
+		if ((uint32_t) MTY_Atomic32Get(&ctx->shm->done_seq) == seq)
+			return true;
+
+		if (x < HOST_SPIN)
+			continue;
+
+		sched_yield();
+
+		if (x % 256 == 0) {
+			if (host_reap(ctx, false))
+				return false;
+
+			if (timeout > 0 && MTY_TimeDiff(stamp, MTY_GetTime()) > (float) timeout) {
+				host_reap(ctx, true);
+				return false;
+			}
+		}
+	}
+}
+
+struct host *host_create(const char *exe)
+{
+	struct host *ctx = MTY_Alloc(1, sizeof(struct host));
+	ctx->doorbell = -1;
+
+	int32_t fds[2] = {-1, -1};
+	posix_spawn_file_actions_t actions;
+	bool actions_init = false;
+
+	// A child that dies closes its end of the doorbell, the next write has to
+	// fail with EPIPE rather than kill the whole process
+	signal(SIGPIPE, SIG_IGN);
+
+	snprintf(ctx->name, HOST_SHM_NAME_MAX, "/merton-%d-%d", (int32_t) getpid(), MTY_Atomic32Add(&HOST_COUNT, 1));
+
+	bool r = true;
+
+	int32_t fd = shm_open(ctx->name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd == -1) {
+		r = false;
+		goto except;
+	}
+
+	// Pages are only backed once touched, the state region costs nothing until
+	// a core serializes into it
+	if (ftruncate(fd, HOST_SHM_SIZE) == 0) {
+		void *shm = mmap(NULL, HOST_SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		ctx->shm = shm != MAP_FAILED ? shm : NULL;
+	}
+
+	close(fd);
+
+	if (!ctx->shm) {
+		r = false;
+		goto except;
+	}
+
+	ctx->shm->magic = HOST_MAGIC;
+
+	// Commands are rung on a pipe that becomes the child's stdin, the child sees
+	// end of file and exits if the parent goes away
+	r = pipe(fds) == 0 && fcntl(fds[1], F_SETFD, FD_CLOEXEC) == 0;
+	if (!r)
+		goto except;
+
+	r = posix_spawn_file_actions_init(&actions) == 0;
+	if (!r)
+		goto except;
+
+	actions_init = true;
+
+	r = posix_spawn_file_actions_adddup2(&actions, fds[0], STDIN_FILENO) == 0 &&
+		posix_spawn_file_actions_addclose(&actions, fds[0]) == 0;
+	if (!r)
+		goto except;
+
+	char *argv[] = {(char *) exe, HOST_ARG, ctx->name, NULL};
+
+	r = posix_spawnp(&ctx->pid, exe, &actions, NULL, argv, environ) == 0;
+	if (!r)
+		goto except;
+
+	ctx->doorbell = fds[1];
+	fds[1] = -1;
+
+	r = host_call(ctx, HOST_CMD_NONE, HOST_TIMEOUT_ATTACH);
+
+	except:
+
+	if (actions_init)
+		posix_spawn_file_actions_destroy(&actions);
+
+	if (fds[0] != -1)
+		close(fds[0]);
+
+	if (fds[1] != -1)
+		close(fds[1]);
+
+	// Both sides have it mapped or it failed, either way the name can go
+	shm_unlink(ctx->name);
+
+	if (!r)
+		host_destroy(&ctx);
+
+	return ctx;
+}
+
+void host_destroy(struct host **host)
+{
+	if (!host || !*host)
+		return;
+
+	struct host *ctx = *host;
+
+	if (ctx->pid > 0 && !host_call(ctx, HOST_CMD_QUIT, HOST_TIMEOUT_QUIT))
+		host_reap(ctx, true);
+
+	if (ctx->doorbell != -1)
+		close(ctx->doorbell);
+
+	// Blocks until the child has exited after a clean quit
+	if (ctx->pid > 0) {
+		int32_t status = 0;
+		waitpid(ctx->pid, &status, 0);
+	}
+
+	if (ctx->shm)
+		munmap(ctx->shm, HOST_SHM_SIZE);
+
+	MTY_Free(ctx);
+	*host = NULL;
+}
+
+bool host_call(struct host *ctx, enum host_cmd cmd, uint32_t timeout)
+{
+	if (!ctx || ctx->dead || ctx->doorbell == -1)
+		return false;
+
+	struct host_shm *shm = ctx->shm;
+	shm->cmd = cmd;
+	shm->seq++;
+
+	uint8_t bell = 0;
+	ssize_t n = 0;
+
+	do {
+		n = write(ctx->doorbell, &bell, 1);
+	} while (n < 0 && errno == EINTR);
+
+	// EPIPE, the child is gone or on its way out
+	if (n != 1) {
+		host_reap(ctx, true);
+		return false;
+	}
+
+	return host_wait(ctx, shm->seq, timeout);
+}
+
+
+// Child
+
+struct host_child {
+	struct host_shm *shm;
+	struct core *core;
+	uint32_t fb_slot;
+	uint32_t audio_slot;
+};
+
+static void host_log(const char *msg, void *opaque)
+{
+	printf("%s", msg);
+}
+
+static void host_video(const void *buf, uint32_t width, uint32_t height, size_t pitch, void *opaque)
+{
+	struct host_child *ctx = opaque;
+	struct host_shm *shm = ctx->shm;
+
+	shm->video = true;
+	shm->dupe = !buf;
+
+	if (!buf)
+		return;
+
+	const uint8_t *slot = HOST_VIDEO(shm, ctx->fb_slot);
+
+	// Cores that rendered into the slot handed out by host_framebuffer need no copy
+	if ((const uint8_t *) buf < slot || (const uint8_t *) buf >= slot + HOST_VIDEO_MAX) {
+		size_t size = pitch * height;
+
+		if (size > HOST_VIDEO_MAX) {
+			shm->dupe = true;
+			return;
+		}
+
+		ctx->fb_slot = (ctx->fb_slot + 1) % HOST_VIDEO_SLOTS;
+		memcpy(HOST_VIDEO(shm, ctx->fb_slot), buf, size);
+		buf = HOST_VIDEO(shm, ctx->fb_slot);
+	}
+
+	shm->video_slot = ctx->fb_slot;
+	shm->video_offset = (const uint8_t *) buf - HOST_VIDEO(shm, ctx->fb_slot);
+	shm->width = width;
+	shm->height = height;
+	shm->pitch = pitch;
+}
+
+static void *host_framebuffer(uint32_t width, uint32_t height, enum core_color_format format,
+	size_t *pitch, void *opaque)
+{
+	struct host_child *ctx = opaque;
+
+	if (format == CORE_COLOR_FORMAT_UNKNOWN)
+		return NULL;
+
+	size_t bpp = format == CORE_COLOR_FORMAT_BGRA ? 4 : 2;
+	*pitch = ((size_t) width * bpp + HOST_ALIGN - 1) & ~((size_t) HOST_ALIGN - 1);
+
+	if (*pitch * height > HOST_VIDEO_MAX)
+		return NULL;
+
+	ctx->fb_slot = (ctx->fb_slot + 1) % HOST_VIDEO_SLOTS;
+
+	return HOST_VIDEO(ctx->shm, ctx->fb_slot);
+}
+
+static void host_audio(const int16_t *buf, size_t frames, void *opaque)
+{
+	struct host_child *ctx = opaque;
+	struct host_shm *shm = ctx->shm;
+
+	ctx->audio_slot = (ctx->audio_slot + 1) % HOST_AUDIO_SLOTS;
+	memcpy(HOST_AUDIO(shm, ctx->audio_slot), buf, frames * 2 * sizeof(int16_t));
+
+	shm->audio_slot = ctx->audio_slot;
+	shm->audio_frames = frames;
+}
+
+static void host_input(struct core_input *input, uint8_t players, void *opaque)
+{
+	struct host_child *ctx = opaque;
+
+	memcpy(input, ctx->shm->input, players * sizeof(struct core_input));
+}
+
+static void host_mirror(struct host_child *ctx, bool sram)
+{
+	struct host_shm *shm = ctx->shm;
+	struct core *core = ctx->core;
+
+	shm->fps = core_get_frame_rate(core);
+	shm->sample_rate = core_get_sample_rate(core);
+	shm->aspect_ratio = core_get_aspect_ratio(core);
+	shm->color_format = core_get_color_format(core);
+	shm->audio_latency = core_get_audio_latency(core);
+
+	// SRAM is small and copying it keeps autosave hashing free of round trips
+	if (sram) {
+		size_t size = 0;
+		const void *buf = core_get_sram_buffer(core, &size);
+
+		shm->sram_size = buf && size <= HOST_SRAM_MAX ? size : 0;
+
+		if (shm->sram_size > 0)
+			memcpy(HOST_SRAM(shm), buf, size);
+	}
+}
+
+static void host_mirror_variables(struct host_child *ctx)
+{
+	uint32_t len = 0;
+	const struct core_variable *vars = core_get_variables(ctx->core, &len);
+
+	if (len > HOST_VARS_MAX)
+		len = HOST_VARS_MAX;
+
+	if (len > 0)
+		memcpy(HOST_VARS(ctx->shm), vars, len * sizeof(struct core_variable));
+
+	ctx->shm->num_variables = len;
+}
+
+static void host_run(struct host_child *ctx)
+{
+	struct host_shm *shm = ctx->shm;
+	struct core *core = ctx->core;
+
+	shm->video = false;
+	shm->audio_frames = 0;
+
+	core_set_run_ahead(core, shm->run_ahead, shm->run_ahead_instance);
+	core_set_fast_forward(core, shm->fast_forward, (uint32_t) lrintf(shm->fast_forward_ratio));
+	core_set_audio_buffer_status(core, shm->audio_active, shm->audio_occupancy, shm->audio_underrun);
+
+	MTY_Time stamp = MTY_GetTime();
+
+	switch (shm->size) {
+		case HOST_RUN_SKIP:   core_skip_frame(core);   break;
+		case HOST_RUN_REPLAY: core_replay_frame(core); break;
+		default:              core_run_frame(core);    break;
+	}
+
+	shm->exec_us = MTY_TimeDiff(stamp, MTY_GetTime()) * 1000.0f;
+
+	host_mirror(ctx, shm->size != HOST_RUN_REPLAY);
+}
+
+static bool host_execute(struct host_child *ctx)
+{
+	struct host_shm *shm = ctx->shm;
+
+	shm->result = 1;
+
+	switch (shm->cmd) {
+		case HOST_CMD_LOAD_CORE:
+			core_unload(&ctx->core);
+			ctx->core = core_load(shm->path);
+
+			if (!ctx->core) {
+				shm->result = 0;
+				break;
+			}
+
+			core_set_video_func(ctx->core, host_video, ctx);
+			core_set_audio_func(ctx->core, host_audio, ctx);
+			core_set_framebuffer_func(ctx->core, host_framebuffer, ctx);
+			core_set_input_func(ctx->core, host_input, ctx);
+			host_mirror_variables(ctx);
+
+			snprintf(shm->library_name, HOST_LIB_NAME_MAX, "%s", core_get_library_name(ctx->core));
+			snprintf(shm->library_version, HOST_LIB_NAME_MAX, "%s", core_get_library_version(ctx->core));
+			break;
+		case HOST_CMD_LOAD_GAME:
+			shm->result = core_load_game(ctx->core, shm->path);
+			host_mirror(ctx, true);
+			host_mirror_variables(ctx);
+			break;
+		case HOST_CMD_UNLOAD_GAME:
+			core_unload_game(ctx->core);
+			break;
+		case HOST_CMD_RESET:
+			core_reset_game(ctx->core);
+			break;
+		case HOST_CMD_RUN:
+			host_run(ctx);
+			break;
+		case HOST_CMD_STATE_SIZE:
+			shm->size = core_get_state_size(ctx->core);
+			break;
+		case HOST_CMD_SAVE_STATE:
+			shm->size = core_get_state_size(ctx->core);
+			shm->result = shm->size <= HOST_STATE_MAX && core_copy_state(ctx->core, HOST_STATE(shm), shm->size);
+			break;
+		case HOST_CMD_LOAD_STATE:
+			shm->result = core_set_state(ctx->core, HOST_STATE(shm), shm->size);
+			break;
+		case HOST_CMD_SET_SRAM:
+			shm->result = core_set_sram(ctx->core, HOST_SRAM(shm), shm->size);
+			host_mirror(ctx, true);
+			break;
+		case HOST_CMD_SET_VAR:
+			core_set_variable(ctx->core, shm->path, shm->val);
+			break;
+		case HOST_CMD_CLEAR_VARS:
+			core_clear_variables(ctx->core);
+			break;
+		case HOST_CMD_QUIT:
+			return true;
+		default:
+			break;
+	}
+
+	return false;
+}
+
+int32_t host_main(const char *name)
+{
+	int32_t fd = shm_open(name, O_RDWR, 0600);
+	if (fd == -1)
+		return 1;
+
+	void *shm = mmap(NULL, HOST_SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (shm == MAP_FAILED)
+		return 1;
+
+	struct host_child ctx = {0};
+	ctx.shm = shm;
+
+	if (ctx.shm->magic != HOST_MAGIC) {
+		munmap(shm, HOST_SHM_SIZE);
+		return 1;
+	}
+
+	core_set_log_func(host_log, NULL);
+
+	while (true) {
+		uint8_t bell = 0;
+		ssize_t n = read(STDIN_FILENO, &bell, 1);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+
+		// The parent is gone
+		if (n <= 0)
+			break;
+
+		bool quit = host_execute(&ctx);
+
+		MTY_Atomic32Set(&ctx.shm->done_seq, (int32_t) ctx.shm->seq);
+
+		if (quit)
+			break;
+	}
+
+	core_unload(&ctx.core);
+	munmap(shm, HOST_SHM_SIZE);
+
+	return 0;
+}
+
+#else
+
+struct host *host_create(const char *exe)
+{
+	return NULL;
+}
+
+void host_destroy(struct host **host)
+{
+}
+
+bool host_call(struct host *ctx, enum host_cmd cmd, uint32_t timeout)
+{
+	return false;
+}
+
+int32_t host_main(const char *name)
+{
+	return 1;
+}
+
+#endif
+
+struct host_shm *host_get_shm(struct host *ctx)
+{
+	return ctx ? ctx->shm : NULL;
+}
@@ -0,0 +1,116 @@
+// Copyright (c) Christopher D. Dickson <cdd@matoya.group>
+//
+// This Source Code Form is subject to the terms of the MIT License.
+// If a copy of the MIT License was not distributed with this file,
+// You can obtain one at https://spdx.org/licenses/MIT.html.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "matoya.h"
+#include "core.h"
+
+#define HOST_ARG "--core-host"
+
+#define HOST_VIDEO_SLOTS  3
+#define HOST_AUDIO_SLOTS  3
+#define HOST_VIDEO_MAX    (8 * 1024 * 1024)
+#define HOST_AUDIO_MAX    (CORE_SAMPLES_MAX * sizeof(int16_t))
+#define HOST_STATE_MAX    (64 * 1024 * 1024)
+#define HOST_SRAM_MAX     (2 * 1024 * 1024)
+#define HOST_VARS_MAX     128
+#define HOST_VAL_MAX      256
+#define HOST_LIB_NAME_MAX 64
+
+enum host_cmd {
+	HOST_CMD_NONE        = 0,
+	HOST_CMD_LOAD_CORE   = 1,
+	HOST_CMD_LOAD_GAME   = 2,
+	HOST_CMD_UNLOAD_GAME = 3,
+	HOST_CMD_RESET       = 4,
+	HOST_CMD_RUN         = 5,
+	HOST_CMD_STATE_SIZE  = 6,
+	HOST_CMD_SAVE_STATE  = 7,
+	HOST_CMD_LOAD_STATE  = 8,
+	HOST_CMD_SET_SRAM    = 9,
+	HOST_CMD_SET_VAR     = 10,
+	HOST_CMD_CLEAR_VARS  = 11,
+	HOST_CMD_QUIT        = 12,
+};
+
+enum host_run {
+	HOST_RUN_FRAME  = 0,
+	HOST_RUN_SKIP   = 1,
+	HOST_RUN_REPLAY = 2,
+};
+
+// Fixed header at the start of the shared mapping, the frame, audio, state,
+// SRAM and variable regions follow at page aligned offsets. The parent writes
+// a command and rings the doorbell, the child publishes done_seq when finished
+struct host_shm {
+	uint32_t magic;
+	MTY_Atomic32 done_seq;
+	uint32_t seq;
+	uint32_t cmd;
+	int32_t result;
+	uint64_t size;
+	char path[MTY_PATH_MAX];
+	char val[HOST_VAL_MAX];
+
+	// Frame parameters
+	struct core_input input[CORE_PLAYERS_MAX];
+	uint32_t run_ahead;
+	bool run_ahead_instance;
+	bool fast_forward;
+	float fast_forward_ratio;
+	bool audio_active;
+	uint32_t audio_occupancy;
+	bool audio_underrun;
+
+	// Frame results, the video and audio rings are indexed by slot
+	float exec_us;
+	bool video;
+	bool dupe;
+	uint32_t video_slot;
+	uint64_t video_offset;
+	uint32_t width;
+	uint32_t height;
+	uint64_t pitch;
+	uint32_t audio_slot;
+	uint64_t audio_frames;
+
+	// Mirrored after loads and frames
+	char library_name[HOST_LIB_NAME_MAX];
+	char library_version[HOST_LIB_NAME_MAX];
+	double fps;
+	double sample_rate;
+	float aspect_ratio;
+	uint32_t color_format;
+	uint32_t audio_latency;
+	uint64_t sram_size;
+	uint32_t num_variables;
+};
+
+#define HOST_VIDEO_OFFSET 0x10000
+#define HOST_AUDIO_OFFSET (HOST_VIDEO_OFFSET + (size_t) HOST_VIDEO_SLOTS * HOST_VIDEO_MAX)
+#define HOST_STATE_OFFSET (HOST_AUDIO_OFFSET + (size_t) HOST_AUDIO_SLOTS * HOST_AUDIO_MAX)
+#define HOST_SRAM_OFFSET  (HOST_STATE_OFFSET + (size_t) HOST_STATE_MAX)
+#define HOST_VARS_OFFSET  (HOST_SRAM_OFFSET + (size_t) HOST_SRAM_MAX)
+#define HOST_SHM_SIZE     (HOST_VARS_OFFSET + (size_t) HOST_VARS_MAX * sizeof(struct core_variable))
+
+#define HOST_VIDEO(shm, slot) ((uint8_t *) (shm) + HOST_VIDEO_OFFSET + (size_t) (slot) * HOST_VIDEO_MAX)
+#define HOST_AUDIO(shm, slot) ((int16_t *) ((uint8_t *) (shm) + HOST_AUDIO_OFFSET + (size_t) (slot) * HOST_AUDIO_MAX))
+#define HOST_STATE(shm)       ((uint8_t *) (shm) + HOST_STATE_OFFSET)
+#define HOST_SRAM(shm)        ((uint8_t *) (shm) + HOST_SRAM_OFFSET)
+#define HOST_VARS(shm)        ((struct core_variable *) ((uint8_t *) (shm) + HOST_VARS_OFFSET))
+
+struct host;
+
+struct host *host_create(const char *exe);
+void host_destroy(struct host **host);
+struct host_shm *host_get_shm(struct host *ctx);
+bool host_call(struct host *ctx, enum host_cmd cmd, uint32_t timeout);
+int32_t host_main(const char *name);
@@ -126,6 +126,9 @@ static void im_poll_input(ImGuiIO &io)
 
 				break;
 			}
+			case MTY_EVENT_TEXT:
+				io.AddInputCharactersUTF8(wmsg->text.text);
+				break;
 			default:
 				break;
 		}
@@ -385,6 +388,14 @@ bool im_selectable(const char *label)
 	return Selectable(label);
 }
 
+bool im_input_u32(const char *label, uint32_t *value)
+{
+	const uint32_t step = 1;
+	const uint32_t step_fast = 16;
+
+	return InputScalar(label, ImGuiDataType_U32, value, &step, &step_fast, "%u");
+}
+
 void im_pop_style(uint32_t n)
 {
 	PopStyleVar(n);
@@ -166,6 +166,7 @@ void im_text(const char *text);
 void im_text_wrapped(const char *text);
 bool im_button(const char *label);
 bool im_selectable(const char *label);
+bool im_input_u32(const char *label, uint32_t *value);
 
 void im_pop_style(uint32_t n);
 void im_pop_color(uint32_t n);
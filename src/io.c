@@ -0,0 +1,867 @@
+// Copyright (c) Christopher D. Dickson <cdd@matoya.group>
+//
+// This Source Code Form is subject to the terms of the MIT License.
+// If a copy of the MIT License was not distributed with this file,
+// You can obtain one at https://spdx.org/licenses/MIT.html.
+
+#include "io.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "matoya.h"
+#include "fmap.h"
+
+#define IO_BUFFERS   4
+#define IO_HASH_BITS 16
+#define IO_MIN_MATCH 4
+#define IO_MAX_DIST  0xFFFF
+
+// "MSTZ", followed by reserved flags and the uncompressed size
+#define IO_MAGIC  0x5A54534D
+#define IO_HEADER 16
+
+// Appended records: tag, flags, id, raw size, stored size
+#define IO_RECORD_HEADER     32
+#define IO_RECORD_COMPRESSED 0x01
+
+// Savestate container "MSSC": header, chunk table, then chunks compressed
+// independently so saving and loading can be split across threads
+#define IO_STATE_MAGIC   0x4353534D
+#define IO_STATE_VERSION 1
+#define IO_STATE_CHUNK   (256 * 1024)
+#define IO_WORKERS       4
+
+struct io_state_header {
+	uint32_t magic;
+	uint32_t version;
+	char core[IO_STATE_NAME_MAX];
+	char core_version[IO_STATE_NAME_MAX];
+	uint64_t size;
+	uint32_t hash;
+	uint32_t chunk_size;
+	uint32_t num_chunks;
+	uint32_t reserved;
+};
+
+struct io_state_chunk {
+	uint64_t offset;
+	uint32_t stored;
+	uint32_t crc;
+};
+
+struct io_chunks {
+	const uint8_t *in;
+	uint8_t *out;
+	size_t size;
+	size_t stride;
+	struct io_state_chunk *table;
+	uint32_t num_chunks;
+	bool compress;
+
+	MTY_Atomic32 next;
+	MTY_Atomic32 failed;
+};
+
+struct io_buffer {
+	void *data;
+	size_t cap;
+	bool busy;
+};
+
+struct io_job {
+	char path[MTY_PATH_MAX];
+	struct io_buffer *buf;
+	size_t size;
+	bool compress;
+
+	bool append;
+	uint32_t tag;
+	uint64_t id;
+
+	bool state;
+	struct io_state_info info;
+};
+
+struct io {
+	MTY_Thread *thread;
+	MTY_Mutex *mutex;
+	MTY_Cond *cond;
+	bool running;
+
+	struct io_buffer buffers[IO_BUFFERS];
+	struct io_job jobs[IO_BUFFERS];
+	uint32_t head;
+	uint32_t tail;
+
+	// Only touched by the writer thread
+	uint8_t *scratch;
+	size_t scratch_cap;
+	uint32_t *table;
+};
+
+
+// LZ, byte oriented with 64 KB window, tuned for savestates which are mostly
+// zero runs and repeated tables
+
+static uint32_t io_hash(uint32_t v)
+{
+	return (v * 2654435761u) >> (32 - IO_HASH_BITS);
+}
+
+static size_t io_put_len(uint8_t *out, size_t len)
+{
+	size_t n = 0;
+
+	for (; len >= 255; len -= 255)
+		out[n++] = 255;
+
+	out[n++] = (uint8_t) len;
+
+	return n;
+}
+
+static size_t io_put_seq(uint8_t *out, const uint8_t *lit, size_t lit_len, size_t dist, size_t match_len)
+{
+	size_t n = 1;
+	size_t mlen = match_len > 0 ? match_len - IO_MIN_MATCH : 0;
+
+	out[0] = (uint8_t) ((lit_len < 15 ? lit_len : 15) << 4 | (mlen < 15 ? mlen : 15));
+
+	if (lit_len >= 15)
+		n += io_put_len(out + n, lit_len - 15);
+
+	memcpy(out + n, lit, lit_len);
+	n += lit_len;
+
+	if (match_len > 0) {
+		out[n++] = (uint8_t) (dist & 0xFF);
+		out[n++] = (uint8_t) (dist >> 8);
+
+		if (mlen >= 15)
+			n += io_put_len(out + n, mlen - 15);
+	}
+
+	return n;
+}
+
+static size_t io_compress_bound(size_t size)
+{
+	return size + size / 255 + 16;
+}
+
+static size_t io_compress(const uint8_t *in, size_t size, uint8_t *out, uint32_t *table)
+{
+	memset(table, 0, sizeof(uint32_t) << IO_HASH_BITS);
+
+	size_t ip = 0;
+	size_t anchor = 0;
+	size_t op = 0;
+
+	while (ip + IO_MIN_MATCH <= size) {
+		uint32_t v = 0;
+		memcpy(&v, in + ip, 4);
+
+		uint32_t h = io_hash(v);
+		size_t ref = table[h];
+		table[h] = (uint32_t) ip;
+
+		if (ref < ip && ip - ref <= IO_MAX_DIST && !memcmp(in + ref, in + ip, IO_MIN_MATCH)) {
+			size_t len = IO_MIN_MATCH;
+			while (ip + len < size && in[ref + len] == in[ip + len])
+				len++;
+
+			op += io_put_seq(out + op, in + anchor, ip - anchor, ip - ref, len);
+			ip += len;
+			anchor = ip;
+
+		} else {
+			// Skip ahead faster through data that is not compressing
+			ip += 1 + ((ip - anchor) >> 6);
+		}
+	}
+
+	op += io_put_seq(out + op, in + anchor, size - anchor, 0, 0);
+
+	return op;
+}
+
+static bool io_get_len(const uint8_t *in, size_t size, size_t *ip, size_t *len)
+{
+	while (true) {
+		if (*ip >= size)
+			return false;
+
+		uint8_t b = in[(*ip)++];
+		*len += b;
+
+		if (b != 255)
+			return true;
+	}
+}
+
+static bool io_decompress(const uint8_t *in, size_t size, uint8_t *out, size_t out_size)
+{
+	size_t ip = 0;
+	size_t op = 0;
+
+	while (ip < size) {
+		uint8_t token = in[ip++];
+
+		size_t lit_len = token >> 4;
+		if (lit_len == 15 && !io_get_len(in, size, &ip, &lit_len))
+			return false;
+
+		if (lit_len > size - ip || lit_len > out_size - op)
+			return false;
+
+		memcpy(out + op, in + ip, lit_len);
+		ip += lit_len;
+		op += lit_len;
+
+		if (ip == size)
+			break;
+
+		if (ip + 2 > size)
+			return false;
+
+		size_t dist = in[ip] | (size_t) in[ip + 1] << 8;
+		ip += 2;
+
+		size_t match_len = token & 0x0F;
+		if (match_len == 15 && !io_get_len(in, size, &ip, &match_len))
+			return false;
+
+		match_len += IO_MIN_MATCH;
+
+		if (dist == 0 || dist > op || match_len > out_size - op)
+			return false;
+
+		const uint8_t *src = out + op - dist;
+
+		if (dist >= match_len) {
+			memcpy(out + op, src, match_len);
+
+		} else {
+			for (size_t x = 0; x < match_len; x++)
+				out[op + x] = src[x];
+		}
+
+		op += match_len;
+	}
+
+	return op == out_size;
+}
+
+
+// Chunk workers, savestates are saved and loaded rarely enough that threads are
+// started per call rather than kept parked
+
+static void io_chunk_run(struct io_chunks *job, uint32_t x, uint32_t *table)
+{
+	size_t offset = (size_t) x * IO_STATE_CHUNK;
+	size_t len = job->size - offset < IO_STATE_CHUNK ? job->size - offset : IO_STATE_CHUNK;
+	struct io_state_chunk *chunk = &job->table[x];
+
+	if (job->compress) {
+		const uint8_t *in = job->in + offset;
+		uint8_t *out = job->out + (size_t) x * job->stride;
+
+		size_t stored = io_compress(in, len, out, table);
+
+		// Chunks that don't compress are stored as is
+		if (stored >= len) {
+			memcpy(out, in, len);
+			stored = len;
+		}
+
+		chunk->stored = (uint32_t) stored;
+		chunk->crc = MTY_CRC32(0, in, len);
+
+	} else {
+		const uint8_t *in = job->in + chunk->offset;
+		uint8_t *out = job->out + offset;
+
+		bool r = true;
+
+		if (chunk->stored == len) {
+			memcpy(out, in, len);
+
+		} else {
+			r = io_decompress(in, chunk->stored, out, len);
+		}
+
+		if (!r || MTY_CRC32(0, out, len) != chunk->crc)
+			MTY_Atomic32Set(&job->failed, 1);
+	}
+}
+
+static void *io_chunk_thread(void *opaque)
+{
+	struct io_chunks *job = opaque;
+
+	uint32_t *table = job->compress ? MTY_Alloc((size_t) 1 << IO_HASH_BITS, sizeof(uint32_t)) : NULL;
+
+	while (true) {
+		int32_t x = MTY_Atomic32Add(&job->next, 1) - 1;
+		if (x >= (int32_t) job->num_chunks || MTY_Atomic32Get(&job->failed))
+			break;
+
+		io_chunk_run(job, (uint32_t) x, table);
+	}
+
+	MTY_Free(table);
+
+	return NULL;
+}
+
+static bool io_chunks_run(struct io_chunks *job)
+{
+	MTY_Thread *threads[IO_WORKERS - 1] = {0};
+	uint32_t n = job->num_chunks < IO_WORKERS ? job->num_chunks : IO_WORKERS;
+
+	// The calling thread takes a share of the chunks
+	for (uint32_t x = 1; x < n; x++)
+		threads[x - 1] = MTY_ThreadCreate(io_chunk_thread, job);
+
+	io_chunk_thread(job);
+
+	for (uint32_t x = 1; x < n; x++)
+		MTY_ThreadDestroy(&threads[x - 1]);
+
+	return MTY_Atomic32Get(&job->failed) == 0;
+}
+
+
+// Writer thread
+
+static size_t io_pack(struct io *ctx, const void *data, size_t size, size_t header)
+{
+	size_t bound = header + io_compress_bound(size);
+
+	if (ctx->scratch_cap < bound) {
+		MTY_Free(ctx->scratch);
+		ctx->scratch = MTY_Alloc(bound, 1);
+		ctx->scratch_cap = bound;
+	}
+
+	return io_compress(data, size, ctx->scratch + header, ctx->table);
+}
+
+static void io_append_job(struct io *ctx, const struct io_job *job)
+{
+	const void *data = job->buf->data;
+	uint32_t flags = 0;
+	uint64_t raw = job->size;
+	uint64_t stored = job->size;
+
+	if (job->compress) {
+		size_t csize = io_pack(ctx, data, job->size, 0);
+
+		if (csize < job->size) {
+			data = ctx->scratch;
+			stored = csize;
+			flags |= IO_RECORD_COMPRESSED;
+		}
+	}
+
+	uint8_t header[IO_RECORD_HEADER];
+	memcpy(header, &job->tag, 4);
+	memcpy(header + 4, &flags, 4);
+	memcpy(header + 8, &job->id, 8);
+	memcpy(header + 16, &raw, 8);
+	memcpy(header + 24, &stored, 8);
+
+	FILE *f = fopen(job->path, "ab");
+
+	if (f) {
+		fwrite(header, 1, IO_RECORD_HEADER, f);
+		fwrite(data, 1, (size_t) stored, f);
+		fclose(f);
+	}
+}
+
+static void io_replace_file(const char *path, const void *data, size_t size)
+{
+	// Write next to the destination then swap it in so a crash mid-write never
+	// leaves a truncated file behind
+	const char *tmp = MTY_SprintfDL("%s.tmp", path);
+
+	if (MTY_WriteFile(tmp, data, size) && !MTY_MoveFile(tmp, path)) {
+		MTY_DeleteFile(path);
+		MTY_MoveFile(tmp, path);
+	}
+}
+
+static void io_state_job(struct io *ctx, const struct io_job *job)
+{
+	uint32_t num_chunks = (uint32_t) ((job->size + IO_STATE_CHUNK - 1) / IO_STATE_CHUNK);
+	size_t stride = io_compress_bound(IO_STATE_CHUNK);
+	size_t table_size = num_chunks * sizeof(struct io_state_chunk);
+	size_t head = sizeof(struct io_state_header) + table_size;
+	size_t cap = head + num_chunks * stride;
+
+	if (ctx->scratch_cap < cap) {
+		MTY_Free(ctx->scratch);
+		ctx->scratch = MTY_Alloc(cap, 1);
+		ctx->scratch_cap = cap;
+	}
+
+	struct io_state_chunk *table = MTY_Alloc(num_chunks, sizeof(struct io_state_chunk));
+
+	// Every chunk gets a worst case slot past the header
+	struct io_chunks chunks = {0};
+	chunks.in = job->buf->data;
+	chunks.out = ctx->scratch + head;
+	chunks.size = job->size;
+	chunks.stride = stride;
+	chunks.table = table;
+	chunks.num_chunks = num_chunks;
+	chunks.compress = true;
+
+	io_chunks_run(&chunks);
+
+	// Then packed down behind it
+	size_t pos = head;
+
+	for (uint32_t x = 0; x < num_chunks; x++) {
+		memmove(ctx->scratch + pos, chunks.out + (size_t) x * stride, table[x].stored);
+		table[x].offset = pos;
+		pos += table[x].stored;
+	}
+
+	struct io_state_header header = {0};
+	header.magic = IO_STATE_MAGIC;
+	header.version = IO_STATE_VERSION;
+	memcpy(header.core, job->info.core, IO_STATE_NAME_MAX);
+	memcpy(header.core_version, job->info.core_version, IO_STATE_NAME_MAX);
+	header.size = job->size;
+	header.hash = MTY_CRC32(0, table, table_size);
+	header.chunk_size = IO_STATE_CHUNK;
+	header.num_chunks = num_chunks;
+
+	memcpy(ctx->scratch, &header, sizeof(struct io_state_header));
+	memcpy(ctx->scratch + sizeof(struct io_state_header), table, table_size);
+
+	io_replace_file(job->path, ctx->scratch, pos);
+
+	MTY_Free(table);
+}
+
+static void io_write_job(struct io *ctx, const struct io_job *job)
+{
+	if (job->append) {
+		io_append_job(ctx, job);
+		return;
+	}
+
+	if (job->state) {
+		io_state_job(ctx, job);
+		return;
+	}
+
+	const void *data = job->buf->data;
+	size_t size = job->size;
+
+	if (job->compress) {
+		size_t csize = io_pack(ctx, data, size, IO_HEADER);
+
+		if (IO_HEADER + csize < size) {
+			uint32_t magic = IO_MAGIC;
+			uint32_t flags = 0;
+			uint64_t raw = size;
+
+			memcpy(ctx->scratch, &magic, 4);
+			memcpy(ctx->scratch + 4, &flags, 4);
+			memcpy(ctx->scratch + 8, &raw, 8);
+
+			data = ctx->scratch;
+			size = IO_HEADER + csize;
+		}
+	}
+
+	io_replace_file(job->path, data, size);
+}
+
+static void *io_thread(void *opaque)
+{
+	struct io *ctx = opaque;
+
+	MTY_MutexLock(ctx->mutex);
+
+	while (true) {
+		while (ctx->running && ctx->head == ctx->tail)
+			MTY_CondWait(ctx->cond, ctx->mutex, -1);
+
+		// Pending writes are always drained before exiting
+		if (ctx->head == ctx->tail)
+			break;
+
+		struct io_job *job = &ctx->jobs[ctx->tail % IO_BUFFERS];
+
+		MTY_MutexUnlock(ctx->mutex);
+		io_write_job(ctx, job);
+		MTY_MutexLock(ctx->mutex);
+
+		job->buf->busy = false;
+		ctx->tail++;
+
+		MTY_CondSignalAll(ctx->cond);
+	}
+
+	MTY_MutexUnlock(ctx->mutex);
+
+	return NULL;
+}
+
+
+// Public
+
+struct io *io_create(void)
+{
+	struct io *ctx = MTY_Alloc(1, sizeof(struct io));
+
+	ctx->mutex = MTY_MutexCreate();
+	ctx->cond = MTY_CondCreate();
+	ctx->table = MTY_Alloc((size_t) 1 << IO_HASH_BITS, sizeof(uint32_t));
+	ctx->running = true;
+
+	ctx->thread = MTY_ThreadCreate(io_thread, ctx);
+
+	return ctx;
+}
+
+void io_destroy(struct io **io)
+{
+	if (!io || !*io)
+		return;
+
+	struct io *ctx = *io;
+
+	MTY_MutexLock(ctx->mutex);
+	ctx->running = false;
+	MTY_CondSignalAll(ctx->cond);
+	MTY_MutexUnlock(ctx->mutex);
+
+	MTY_ThreadDestroy(&ctx->thread);
+
+	for (uint32_t x = 0; x < IO_BUFFERS; x++)
+		MTY_Free(ctx->buffers[x].data);
+
+	MTY_CondDestroy(&ctx->cond);
+	MTY_MutexDestroy(&ctx->mutex);
+
+	MTY_Free(ctx->scratch);
+	MTY_Free(ctx->table);
+
+	MTY_Free(ctx);
+	*io = NULL;
+}
+
+void *io_get_buffer(struct io *ctx, size_t size)
+{
+	if (!ctx || size == 0)
+		return NULL;
+
+	struct io_buffer *buf = NULL;
+
+	MTY_MutexLock(ctx->mutex);
+
+	// Blocks only if every buffer is still queued behind the writer
+	while (true) {
+		for (uint32_t x = 0; x < IO_BUFFERS; x++) {
+			struct io_buffer *b = &ctx->buffers[x];
+
+			if (!b->busy && (!buf || b->cap >= size))
+				buf = b;
+		}
+
+		if (buf)
+			break;
+
+		MTY_CondWait(ctx->cond, ctx->mutex, -1);
+	}
+
+	buf->busy = true;
+
+	MTY_MutexUnlock(ctx->mutex);
+
+	if (buf->cap < size) {
+		MTY_Free(buf->data);
+		buf->data = MTY_Alloc(size, 1);
+		buf->cap = size;
+	}
+
+	return buf->data;
+}
+
+void io_release_buffer(struct io *ctx, void *buf)
+{
+	if (!ctx || !buf)
+		return;
+
+	MTY_MutexLock(ctx->mutex);
+
+	for (uint32_t x = 0; x < IO_BUFFERS; x++)
+		if (ctx->buffers[x].data == buf)
+			ctx->buffers[x].busy = false;
+
+	MTY_CondSignalAll(ctx->cond);
+	MTY_MutexUnlock(ctx->mutex);
+}
+
+static void io_push(struct io *ctx, const struct io_job *tmpl, void *buf)
+{
+	if (!ctx || !buf)
+		return;
+
+	MTY_MutexLock(ctx->mutex);
+
+	for (uint32_t x = 0; x < IO_BUFFERS; x++) {
+		struct io_buffer *b = &ctx->buffers[x];
+
+		if (b->data == buf) {
+			struct io_job *job = &ctx->jobs[ctx->head % IO_BUFFERS];
+			*job = *tmpl;
+			job->buf = b;
+
+			ctx->head++;
+			MTY_CondSignalAll(ctx->cond);
+			break;
+		}
+	}
+
+	MTY_MutexUnlock(ctx->mutex);
+}
+
+void io_write(struct io *ctx, const char *path, void *buf, size_t size, bool compress)
+{
+	struct io_job job = {0};
+	snprintf(job.path, MTY_PATH_MAX, "%s", path);
+	job.size = size;
+	job.compress = compress;
+
+	io_push(ctx, &job, buf);
+}
+
+void io_append(struct io *ctx, const char *path, uint32_t tag, uint64_t id, void *buf,
+	size_t size, bool compress)
+{
+	// Appends are ordered with every other job, so a file built from records is
+	// always a valid prefix even if the process dies mid-stream
+	struct io_job job = {0};
+	snprintf(job.path, MTY_PATH_MAX, "%s", path);
+	job.size = size;
+	job.compress = compress;
+	job.append = true;
+	job.tag = tag;
+	job.id = id;
+
+	io_push(ctx, &job, buf);
+}
+
+void io_write_state(struct io *ctx, const char *path, void *buf, size_t size,
+	const struct io_state_info *info)
+{
+	struct io_job job = {0};
+	snprintf(job.path, MTY_PATH_MAX, "%s", path);
+	job.size = size;
+	job.state = true;
+	job.info = *info;
+
+	io_push(ctx, &job, buf);
+}
+
+void io_flush(struct io *ctx)
+{
+	if (!ctx)
+		return;
+
+	MTY_MutexLock(ctx->mutex);
+
+	while (ctx->head != ctx->tail)
+		MTY_CondWait(ctx->cond, ctx->mutex, -1);
+
+	MTY_MutexUnlock(ctx->mutex);
+}
+
+void *io_read_file(const char *path, size_t *size)
+{
+	size_t fsize = 0;
+	uint8_t *data = MTY_ReadFile(path, &fsize);
+	if (!data)
+		return NULL;
+
+	uint32_t magic = 0;
+	if (fsize >= IO_HEADER)
+		memcpy(&magic, data, 4);
+
+	// Files written without compression are returned as is
+	if (magic != IO_MAGIC) {
+		*size = fsize;
+		return data;
+	}
+
+	uint64_t raw = 0;
+	memcpy(&raw, data + 8, 8);
+
+	uint8_t *out = raw > 0 && raw <= SIZE_MAX ? MTY_Alloc((size_t) raw, 1) : NULL;
+
+	if (out && !io_decompress(data + IO_HEADER, fsize - IO_HEADER, out, (size_t) raw)) {
+		MTY_Free(out);
+		out = NULL;
+	}
+
+	MTY_Free(data);
+
+	if (out)
+		*size = (size_t) raw;
+
+	return out;
+}
+
+static bool io_read_state_chunks(const struct io_state_header *header, const uint8_t *data, size_t fsize,
+	struct io_state_chunk *table, void *out)
+{
+	size_t size = (size_t) header->size;
+
+	for (uint32_t x = 0; x < header->num_chunks; x++) {
+		size_t len = size - (size_t) x * IO_STATE_CHUNK;
+		if (len > IO_STATE_CHUNK)
+			len = IO_STATE_CHUNK;
+
+		if (table[x].offset > fsize || table[x].stored > fsize - table[x].offset || table[x].stored > len)
+			return false;
+	}
+
+	struct io_chunks chunks = {0};
+	chunks.in = data;
+	chunks.out = out;
+	chunks.size = size;
+	chunks.table = table;
+	chunks.num_chunks = header->num_chunks;
+
+	return io_chunks_run(&chunks);
+}
+
+void *io_read_state(struct io *ctx, const char *path, size_t *size, struct io_state_info *info)
+{
+	memset(info, 0, sizeof(struct io_state_info));
+
+	struct fmap *fm = fmap_open(path, false);
+	if (!fm)
+		return NULL;
+
+	const uint8_t *data = fmap_get_data(fm);
+	size_t fsize = fmap_get_size(fm);
+	struct io_state_chunk *table = NULL;
+	void *out = NULL;
+
+	struct io_state_header header = {0};
+	if (fsize >= sizeof(struct io_state_header))
+		memcpy(&header, data, sizeof(struct io_state_header));
+
+	// States saved before the container existed are raw or a single LZ stream
+	if (header.magic != IO_STATE_MAGIC) {
+		fmap_close(&fm);
+
+		size_t raw = 0;
+		void *state = io_read_file(path, &raw);
+
+		out = state ? io_get_buffer(ctx, raw) : NULL;
+		if (out) {
+			memcpy(out, state, raw);
+			*size = raw;
+		}
+
+		MTY_Free(state);
+
+		return out;
+	}
+
+	size_t table_size = (size_t) header.num_chunks * sizeof(struct io_state_chunk);
+
+	bool r = header.version == IO_STATE_VERSION && header.chunk_size == IO_STATE_CHUNK &&
+		header.size > 0 && header.size <= SIZE_MAX &&
+		header.num_chunks == (header.size + IO_STATE_CHUNK - 1) / IO_STATE_CHUNK &&
+		table_size <= fsize - sizeof(struct io_state_header);
+
+	if (!r)
+		goto except;
+
+	// Aligned copy of the table, chunks are decompressed straight out of the mapping
+	table = MTY_Dup(data + sizeof(struct io_state_header), table_size);
+
+	r = MTY_CRC32(0, table, table_size) == header.hash;
+	if (!r)
+		goto except;
+
+	out = io_get_buffer(ctx, (size_t) header.size);
+
+	r = out && io_read_state_chunks(&header, data, fsize, table, out);
+
+	if (r) {
+		memcpy(info->core, header.core, IO_STATE_NAME_MAX);
+		memcpy(info->core_version, header.core_version, IO_STATE_NAME_MAX);
+		info->core[IO_STATE_NAME_MAX - 1] = '\0';
+		info->core_version[IO_STATE_NAME_MAX - 1] = '\0';
+
+		*size = (size_t) header.size;
+	}
+
+	except:
+
+	if (!r && out) {
+		io_release_buffer(ctx, out);
+		out = NULL;
+	}
+
+	MTY_Free(table);
+	fmap_close(&fm);
+
+	return out;
+}
+
+bool io_next_record(const void *buf, size_t size, size_t *pos, struct io_record *rec)
+{
+	const uint8_t *p = buf;
+
+	if (*pos > size || size - *pos < IO_RECORD_HEADER)
+		return false;
+
+	uint32_t flags = 0;
+	uint64_t raw = 0;
+	uint64_t stored = 0;
+
+	memcpy(&rec->tag, p + *pos, 4);
+	memcpy(&flags, p + *pos + 4, 4);
+	memcpy(&rec->id, p + *pos + 8, 8);
+	memcpy(&raw, p + *pos + 16, 8);
+	memcpy(&stored, p + *pos + 24, 8);
+
+	// A truncated tail is where a crashed writer stopped
+	if (stored > size - *pos - IO_RECORD_HEADER || raw > SIZE_MAX)
+		return false;
+
+	rec->data = p + *pos + IO_RECORD_HEADER;
+	rec->size = (size_t) stored;
+	rec->raw_size = (size_t) raw;
+	rec->compressed = flags & IO_RECORD_COMPRESSED;
+
+	*pos += IO_RECORD_HEADER + rec->size;
+
+	return true;
+}
+
+bool io_unpack_record(const struct io_record *rec, void *out)
+{
+	if (!rec->compressed) {
+		if (rec->size != rec->raw_size)
+			return false;
+
+		memcpy(out, rec->data, rec->size);
+		return true;
+	}
+
+	return io_decompress(rec->data, rec->size, out, rec->raw_size);
+}
@@ -0,0 +1,44 @@
+// Copyright (c) Christopher D. Dickson <cdd@matoya.group>
+//
+// This Source Code Form is subject to the terms of the MIT License.
+// If a copy of the MIT License was not distributed with this file,
+// You can obtain one at https://spdx.org/licenses/MIT.html.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define IO_STATE_NAME_MAX 64
+
+struct io;
+
+struct io_state_info {
+	char core[IO_STATE_NAME_MAX];
+	char core_version[IO_STATE_NAME_MAX];
+};
+
+struct io_record {
+	uint32_t tag;
+	uint64_t id;
+	const void *data;
+	size_t size;
+	size_t raw_size;
+	bool compressed;
+};
+
+struct io *io_create(void);
+void io_destroy(struct io **io);
+void *io_get_buffer(struct io *ctx, size_t size);
+void io_release_buffer(struct io *ctx, void *buf);
+void io_write(struct io *ctx, const char *path, void *buf, size_t size, bool compress);
+void io_append(struct io *ctx, const char *path, uint32_t tag, uint64_t id, void *buf,
+	size_t size, bool compress);
+void io_write_state(struct io *ctx, const char *path, void *buf, size_t size,
+	const struct io_state_info *info);
+void io_flush(struct io *ctx);
+void *io_read_file(const char *path, size_t *size);
+void *io_read_state(struct io *ctx, const char *path, size_t *size, struct io_state_info *info);
+bool io_next_record(const void *buf, size_t size, size_t *pos, struct io_record *rec);
+bool io_unpack_record(const struct io_record *rec, void *out);
@@ -0,0 +1,190 @@
+// Copyright (c) Christopher D. Dickson <cdd@matoya.group>
+//
+// This Source Code Form is subject to the terms of the MIT License.
+// If a copy of the MIT License was not distributed with this file,
+// You can obtain one at https://spdx.org/licenses/MIT.html.
+
+#include "latency.h"
+
+#include <string.h>
+
+// Frames the screen must hold still before an input is traced, otherwise
+// ordinary animation would be taken for the response
+#define LATENCY_STATIC  2
+
+// Frames without a change before an input is given up on
+#define LATENCY_TIMEOUT 60
+
+struct latency {
+	MTY_Mutex *mutex;
+
+	// Only touched by the thread running the core
+	MTY_Time input;
+	MTY_Time pending;
+	MTY_Time pending_latch;
+	uint32_t pending_frames;
+	uint32_t hash;
+	bool hashed;
+	uint32_t static_frames;
+
+	struct latency_stats stats;
+};
+
+
+// Stats
+
+static void latency_add_frames(struct latency *ctx, uint32_t frames, float latch_ms)
+{
+	struct latency_stats *s = &ctx->stats;
+
+	s->responses++;
+	s->frames += ((float) frames - s->frames) / (float) s->responses;
+	s->latch_ms += (latch_ms - s->latch_ms) / (float) s->responses;
+	s->frames_min = s->responses == 1 || frames < s->frames_min ? frames : s->frames_min;
+	s->frames_max = frames > s->frames_max ? frames : s->frames_max;
+}
+
+static void latency_add_ms(struct latency *ctx, float ms)
+{
+	struct latency_stats *s = &ctx->stats;
+
+	s->presents++;
+	s->ms += (ms - s->ms) / (float) s->presents;
+	s->ms_min = s->presents == 1 || ms < s->ms_min ? ms : s->ms_min;
+	s->ms_max = ms > s->ms_max ? ms : s->ms_max;
+}
+
+
+// Frames
+
+static uint32_t latency_hash(const void *buf, uint32_t width, uint32_t height, size_t pitch,
+	enum core_color_format format)
+{
+	size_t bpp = format == CORE_COLOR_FORMAT_BGRA ? 4 : 2;
+	uint32_t crc = 0;
+
+	// Row padding is whatever the core left there
+	for (uint32_t y = 0; y < height; y++)
+		crc = MTY_CRC32(crc, (const uint8_t *) buf + y * pitch, width * bpp);
+
+	return crc;
+}
+
+
+// Public
+
+struct latency *latency_create(void)
+{
+	struct latency *ctx = MTY_Alloc(1, sizeof(struct latency));
+
+	ctx->mutex = MTY_MutexCreate();
+
+	return ctx;
+}
+
+void latency_destroy(struct latency **latency)
+{
+	if (!latency || !*latency)
+		return;
+
+	struct latency *ctx = *latency;
+
+	MTY_MutexDestroy(&ctx->mutex);
+
+	MTY_Free(ctx);
+	*latency = NULL;
+}
+
+void latency_reset(struct latency *ctx)
+{
+	MTY_MutexLock(ctx->mutex);
+
+	ctx->input = 0;
+	ctx->pending = 0;
+	ctx->pending_frames = 0;
+	ctx->hashed = false;
+	ctx->static_frames = 0;
+	memset(&ctx->stats, 0, sizeof(struct latency_stats));
+
+	MTY_MutexUnlock(ctx->mutex);
+}
+
+bool latency_is_static(struct latency *ctx)
+{
+	return ctx->static_frames >= LATENCY_STATIC;
+}
+
+bool latency_is_pending(struct latency *ctx)
+{
+	return ctx->pending != 0;
+}
+
+MTY_Time latency_video(struct latency *ctx, MTY_Time input, MTY_Time latch, const void *buf,
+	uint32_t width, uint32_t height, size_t pitch, enum core_color_format format)
+{
+	MTY_Time trace = 0;
+
+	// A NULL buffer repeats the previous frame
+	bool changed = false;
+
+	if (buf) {
+		uint32_t hash = latency_hash(buf, width, height, pitch, format);
+
+		changed = ctx->hashed && hash != ctx->hash;
+		ctx->hash = hash;
+		ctx->hashed = true;
+	}
+
+	MTY_MutexLock(ctx->mutex);
+
+	// The snapshot this frame ran with holds input that is new since the last
+	// one, this frame is the first that could respond to it
+	if (input != 0 && input != ctx->input) {
+		ctx->input = input;
+
+		if (ctx->pending == 0 && latency_is_static(ctx)) {
+			ctx->pending = input;
+			ctx->pending_latch = latch;
+			ctx->pending_frames = 0;
+
+		} else if (ctx->pending == 0) {
+			ctx->stats.ignored++;
+		}
+	}
+
+	if (ctx->pending != 0) {
+		ctx->pending_frames++;
+
+		if (changed) {
+			latency_add_frames(ctx, ctx->pending_frames, MTY_TimeDiff(ctx->pending, ctx->pending_latch));
+			trace = ctx->pending;
+			ctx->pending = 0;
+
+		} else if (ctx->pending_frames >= LATENCY_TIMEOUT) {
+			ctx->stats.timeouts++;
+			ctx->pending = 0;
+		}
+	}
+
+	MTY_MutexUnlock(ctx->mutex);
+
+	ctx->static_frames = changed ? 0 : ctx->static_frames + 1;
+
+	return trace;
+}
+
+void latency_present(struct latency *ctx, MTY_Time input)
+{
+	float ms = MTY_TimeDiff(input, MTY_GetTime());
+
+	MTY_MutexLock(ctx->mutex);
+	latency_add_ms(ctx, ms);
+	MTY_MutexUnlock(ctx->mutex);
+}
+
+void latency_get_stats(struct latency *ctx, struct latency_stats *stats)
+{
+	MTY_MutexLock(ctx->mutex);
+	*stats = ctx->stats;
+	MTY_MutexUnlock(ctx->mutex);
+}
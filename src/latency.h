@@ -0,0 +1,49 @@
+// Copyright (c) Christopher D. Dickson <cdd@matoya.group>
+//
+// This Source Code Form is subject to the terms of the MIT License.
+// If a copy of the MIT License was not distributed with this file,
+// You can obtain one at https://spdx.org/licenses/MIT.html.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "matoya.h"
+#include "core.h"
+
+struct latency_stats {
+	// Shown frames from the one that latched the input through the first one
+	// that changed, inclusive
+	uint32_t responses;
+	float frames;
+	uint32_t frames_min;
+	uint32_t frames_max;
+
+	// Input event to the present of that frame returning
+	uint32_t presents;
+	float ms;
+	float ms_min;
+	float ms_max;
+
+	// Input event to the core latching it
+	float latch_ms;
+
+	// Inputs dropped because the screen was already changing, and inputs with
+	// no visible response
+	uint32_t ignored;
+	uint32_t timeouts;
+};
+
+struct latency;
+
+struct latency *latency_create(void);
+void latency_destroy(struct latency **latency);
+void latency_reset(struct latency *ctx);
+bool latency_is_static(struct latency *ctx);
+bool latency_is_pending(struct latency *ctx);
+MTY_Time latency_video(struct latency *ctx, MTY_Time input, MTY_Time latch, const void *buf,
+	uint32_t width, uint32_t height, size_t pitch, enum core_color_format format);
+void latency_present(struct latency *ctx, MTY_Time input);
+void latency_get_stats(struct latency *ctx, struct latency_stats *stats);
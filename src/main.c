@@ -18,43 +18,127 @@
 #include "app.h"
 #include "core.h"
 #include "config.h"
+#include "archive.h"
+#include "pool.h"
+#include "host.h"
+#include "autosave.h"
+#include "io.h"
+#include "latency.h"
+#include "movie.h"
+#include "netplay.h"
+#include "pace.h"
 #include "rsp.h"
+#include "rewind.h"
+#include "search.h"
 
 #include "assets/font/font.h"
 
 #define PCM_BUFFER  75
+#define PCM_MAX     512
 #define SAMPLE_RATE 48000
 
+#define POOL_CORES 2
+
+#define MOVIE_KEYFRAME_SECS 10
+
+#define NETPLAY_HOST_MAX 256
+
+#define FB_COUNT 3
+#define FB_ALIGN 64
+#define FB_INDEX 0x03
+#define FB_FRESH 0x04
+
 struct main_audio_packet {
-	double fps;
 	uint32_t sample_rate;
 	int16_t data[CORE_SAMPLES_MAX];
 	size_t frames;
 };
 
+struct main_frame {
+	void *buf;
+	size_t size;
+	uint32_t width;
+	uint32_t height;
+	size_t pitch;
+	enum core_color_format format;
+	float aspect_ratio;
+
+	// Input stamp when this is the first frame to respond to it
+	MTY_Time trace;
+};
+
 struct main {
 	struct core *core;
+	struct pool *pool;
+	struct rewind *rewind;
+	struct search *search;
+	struct io *io;
+	struct autosave *autosave;
+	struct movie *movie;
+	struct netplay *netplay;
+	MTY_Mutex *core_mutex;
+	struct pace *pace;
+	struct latency *latency;
+
+	// Triple buffer between the emulation and render threads: the emulation
+	// thread owns fb_back, the render thread owns fb_front, and fb_ready is
+	// swapped atomically with FB_FRESH set when it holds an unseen frame
+	struct main_frame fb[FB_COUNT];
+	uint32_t fb_back;
+	uint32_t fb_front;
+	MTY_Atomic32 fb_ready;
+	MTY_Atomic32 has_frame;
+	MTY_Mutex *fb_mutex;
+	MTY_Cond *fb_cond;
 
 	char *content_name;
+	const char *exe;
 	MTY_App *app;
 	MTY_JSON *systems;
 	MTY_JSON *core_options;
 	MTY_JSON *core_exts;
+	MTY_JSON *frame_delays;
 	MTY_Window window;
 	MTY_Queue *rt_q;
 	MTY_Queue *mt_q;
+	MTY_Queue *gfx_q;
 	MTY_Queue *a_q;
+	MTY_Atomic32 audio_occupancy;
+	MTY_Atomic32 audio_underrun;
+	MTY_Atomic32 audio_latency;
 	struct config cfg;
-	bool got_frame;
 	bool running;
 	bool paused;
 	bool loaded;
+	bool rewinding;
+	bool fast_forward;
+	bool skip_audio;
+	uint32_t rewind_frame;
+	float rewind_cost;
+
+	// The render thread's copy of what the UI shows, only refreshed while it
+	// holds core_mutex
+	struct ui_args ui;
+	bool ui_ready;
+	struct core_variable *ui_variables;
+	char (*ui_values)[CORE_OPT_NAME_MAX];
+	uint32_t ui_variables_version;
 
 	struct {
 		uint32_t req;
 		char file[MTY_PATH_MAX];
 		char name[MTY_PATH_MAX];
 	} core_fetch;
+
+	struct {
+		bool enabled;
+		bool connected;
+		bool desync;
+		uint8_t player;
+		uint16_t port;
+		uint16_t remote_port;
+		char host[NETPLAY_HOST_MAX];
+	} np;
 };
 
 
@@ -78,7 +162,7 @@ static const enum core_button NES_KEYBOARD_MAP[MTY_KEY_MAX] = {
 
 // Config
 
-static struct config main_load_config(MTY_JSON **core_options, MTY_JSON **core_exts)
+static struct config main_load_config(MTY_JSON **core_options, MTY_JSON **core_exts, MTY_JSON **frame_delays)
 {
 	struct config cfg = {0};
 
@@ -96,10 +180,20 @@ static struct config main_load_config(MTY_JSON **core_options, MTY_JSON **core_e
 		if (!MTY_JSONObjGetString(jcfg, #name, cfg.name, size)) snprintf(cfg.name, size, def);
 
 	CFG_GET_BOOL(bg_pause, false);
+	CFG_GET_BOOL(isolate_core, false);
+	CFG_GET_BOOL(vrr, false);
+	CFG_GET_BOOL(auto_delay, true);
+	CFG_GET_BOOL(latch_on_read, false);
+	CFG_GET_BOOL(lag_trace, false);
 	CFG_GET_BOOL(console, false);
 	CFG_GET_BOOL(fullscreen, false);
 	CFG_GET_BOOL(mute, false);
+	CFG_GET_BOOL(run_ahead_instance, false);
 	CFG_GET_UINT(reduce_latency, 0);
+	CFG_GET_UINT(fast_forward, 4);
+	CFG_GET_UINT(run_ahead, 0);
+	CFG_GET_UINT(rewind_budget, 0);
+	CFG_GET_UINT(rewind_interval, 2);
 	CFG_GET_UINT(frame_size, 0);
 	CFG_GET_UINT(gfx, MTY_GetDefaultGFX());
 	CFG_GET_UINT(filter, MTY_FILTER_GAUSSIAN_SHARP);
@@ -120,6 +214,8 @@ static struct config main_load_config(MTY_JSON **core_options, MTY_JSON **core_e
 	CFG_GET_STR(core.snes, CONFIG_CORE_MAX, "bsnes");
 	CFG_GET_STR(core.tg16, CONFIG_CORE_MAX, "mednafen-pce");
 
+	MTY_JSONObjGetString(jcfg, "last_system", cfg.last_system, SYSTEM_NAME_MAX);
+
 	const MTY_JSON *obj = MTY_JSONObjGetItem(jcfg, "core_options");
 	*core_options = obj ? MTY_JSONDuplicate(obj) : MTY_JSONObjCreate();
 
@@ -140,12 +236,16 @@ static struct config main_load_config(MTY_JSON **core_options, MTY_JSON **core_e
 		MTY_JSONObjSetString(*core_exts, "snes", "smc|sfc|bs");
 	}
 
+	obj = MTY_JSONObjGetItem(jcfg, "frame_delays");
+	*frame_delays = obj ? MTY_JSONDuplicate(obj) : MTY_JSONObjCreate();
+
 	MTY_JSONDestroy(&jcfg);
 
 	return cfg;
 }
 
-static void main_save_config(struct config *cfg, const MTY_JSON *core_options, const MTY_JSON *core_exts)
+static void main_save_config(struct config *cfg, const MTY_JSON *core_options, const MTY_JSON *core_exts,
+	const MTY_JSON *frame_delays)
 {
 	MTY_JSON *jcfg = MTY_JSONObjCreate();
 
@@ -159,10 +259,20 @@ static void main_save_config(struct config *cfg, const MTY_JSON *core_options, c
 		MTY_JSONObjSetString(jcfg, #name, cfg->name)
 
 	CFG_SET_BOOL(bg_pause);
+	CFG_SET_BOOL(isolate_core);
+	CFG_SET_BOOL(vrr);
+	CFG_SET_BOOL(auto_delay);
+	CFG_SET_BOOL(latch_on_read);
+	CFG_SET_BOOL(lag_trace);
 	CFG_SET_BOOL(console);
 	CFG_SET_BOOL(fullscreen);
 	CFG_SET_BOOL(mute);
+	CFG_SET_BOOL(run_ahead_instance);
 	CFG_SET_UINT(reduce_latency);
+	CFG_SET_UINT(fast_forward);
+	CFG_SET_UINT(run_ahead);
+	CFG_SET_UINT(rewind_budget);
+	CFG_SET_UINT(rewind_interval);
 	CFG_SET_UINT(frame_size);
 	CFG_SET_UINT(gfx);
 	CFG_SET_UINT(filter);
@@ -182,9 +292,11 @@ static void main_save_config(struct config *cfg, const MTY_JSON *core_options, c
 	CFG_SET_STR(core.ps);
 	CFG_SET_STR(core.snes);
 	CFG_SET_STR(core.tg16);
+	CFG_SET_STR(last_system);
 
 	MTY_JSONObjSetItem(jcfg, "core_options", MTY_JSONDuplicate(core_options));
 	MTY_JSONObjSetItem(jcfg, "core_exts", MTY_JSONDuplicate(core_exts));
+	MTY_JSONObjSetItem(jcfg, "frame_delays", MTY_JSONDuplicate(frame_delays));
 
 	MTY_JSONWriteFile(MTY_JoinPath(MTY_GetProcessDir(), "config.json"), jcfg);
 
@@ -310,45 +422,106 @@ static void main_poll_core_fetch(struct main *ctx)
 
 // Core
 
+static void main_frame_reserve(struct main_frame *frame, size_t size)
+{
+	if (frame->size < size) {
+		MTY_FreeAligned(frame->buf);
+		frame->buf = MTY_AllocAligned(size, FB_ALIGN);
+		frame->size = size;
+	}
+}
+
 static void main_video(const void *buf, uint32_t width, uint32_t height, size_t pitch, void *opaque)
 {
 	struct main *ctx = (struct main *) opaque;
-	ctx->got_frame = true;
 
-	// A NULL buffer means we should render the previous frame
-	enum core_color_format format = buf ? core_get_color_format(ctx->core) :
-		CORE_COLOR_FORMAT_UNKNOWN;
+	// Frames are hashed to find the first one that changed after new input
+	MTY_Time trace = 0;
 
-	MTY_RenderDesc desc = {0};
-	desc.format =
-		format == CORE_COLOR_FORMAT_BGRA ? MTY_COLOR_FORMAT_BGRA :
-		format == CORE_COLOR_FORMAT_B5G6R5 ? MTY_COLOR_FORMAT_BGR565 :
-		format == CORE_COLOR_FORMAT_B5G5R5A1 ? MTY_COLOR_FORMAT_BGRA5551 :
-		MTY_COLOR_FORMAT_UNKNOWN;
+	if (ctx->cfg.lag_trace) {
+		MTY_Time input = 0;
+		MTY_Time latch = 0;
+		core_get_input_stamps(ctx->core, &input, &latch);
 
-	desc.imageWidth = (uint32_t) (format == CORE_COLOR_FORMAT_BGRA ? pitch / 4 : pitch / 2);
-	desc.imageHeight = height;
-	desc.cropWidth = width;
-	desc.cropHeight = height;
-	desc.scale = (float) ctx->cfg.frame_size;
-	desc.filter = ctx->cfg.filter;
-	desc.effect = ctx->cfg.effect;
+		trace = latency_video(ctx->latency, input, latch, buf, width, height, pitch,
+			core_get_color_format(ctx->core));
+	}
 
-	desc.aspectRatio = ctx->cfg.aspect_ratio.y == 0 ?
-		core_get_aspect_ratio(ctx->core) : (float) ctx->cfg.aspect_ratio.x / (float) ctx->cfg.aspect_ratio.y;
+	// A NULL buffer repeats the previous frame, which stays up on its own
+	if (!buf)
+		return;
 
-	MTY_WindowDrawQuad(ctx->app, ctx->window, buf, &desc);
+	// Frames from cores that rendered into main_framebuffer are already here
+	struct main_frame *frame = &ctx->fb[ctx->fb_back];
+
+	if (buf != frame->buf) {
+		main_frame_reserve(frame, pitch * height);
+		memcpy(frame->buf, buf, pitch * height);
+	}
+
+	frame->width = width;
+	frame->height = height;
+	frame->pitch = pitch;
+	frame->format = core_get_color_format(ctx->core);
+	frame->aspect_ratio = core_get_aspect_ratio(ctx->core);
+	frame->trace = trace;
+
+	int32_t ready = 0;
+
+	do {
+		ready = MTY_Atomic32Get(&ctx->fb_ready);
+	} while (!MTY_Atomic32CAS(&ctx->fb_ready, ready, (int32_t) ctx->fb_back | FB_FRESH));
+
+	ctx->fb_back = ready & FB_INDEX;
+
+	MTY_Atomic32Set(&ctx->has_frame, 1);
+
+	// Wakes a renderer that presents as soon as frames arrive
+	MTY_MutexLock(ctx->fb_mutex);
+	MTY_CondSignal(ctx->fb_cond);
+	MTY_MutexUnlock(ctx->fb_mutex);
+}
+
+static void *main_framebuffer(uint32_t width, uint32_t height, enum core_color_format format,
+	size_t *pitch, void *opaque)
+{
+	struct main *ctx = opaque;
+
+	if (format == CORE_COLOR_FORMAT_UNKNOWN)
+		return NULL;
+
+	// Cores render straight into the back buffer and it is published to the
+	// renderer as is, rows are padded out to keep every row aligned for the upload
+	size_t bpp = format == CORE_COLOR_FORMAT_BGRA ? 4 : 2;
+	*pitch = ((size_t) width * bpp + FB_ALIGN - 1) & ~((size_t) FB_ALIGN - 1);
+
+	struct main_frame *frame = &ctx->fb[ctx->fb_back];
+	main_frame_reserve(frame, *pitch * height);
+
+	return frame->buf;
+}
+
+static void main_free_framebuffers(struct main *ctx)
+{
+	for (uint32_t x = 0; x < FB_COUNT; x++) {
+		MTY_FreeAligned(ctx->fb[x].buf);
+		memset(&ctx->fb[x], 0, sizeof(struct main_frame));
+	}
 }
 
 static void main_audio(const int16_t *buf, size_t frames, void *opaque)
 {
 	struct main *ctx = opaque;
 
+	// Audio played backwards is just noise, and fast-forward only keeps the
+	// audio of the frame that is shown
+	if (ctx->rewinding || ctx->skip_audio)
+		return;
+
 	struct main_audio_packet *pkt = MTY_QueueGetInputBuffer(ctx->a_q);
 
 	if (pkt) {
 		pkt->sample_rate = core_get_sample_rate(ctx->core);
-		pkt->fps = core_get_frame_rate(ctx->core);
 		pkt->frames = frames;
 
 		memcpy(pkt->data, buf, frames * 4);
@@ -362,6 +535,16 @@ static void main_log(const char *msg, void *opaque)
 	printf("%s", msg);
 }
 
+static const char *main_get_core_name(const char *core)
+{
+	return MTY_SprintfDL("%s.%s", core, MTY_GetSOExtension());
+}
+
+static const char *main_get_core_path(const char *core)
+{
+	return MTY_JoinPath(MTY_JoinPath(MTY_GetProcessDir(), "cores"), main_get_core_name(core));
+}
+
 static void main_get_system_by_ext(struct main *ctx, const char *name,
 	const char **core, const char **system)
 {
@@ -386,6 +569,21 @@ static void main_get_system_by_ext(struct main *ctx, const char *name,
 	}
 }
 
+static bool main_archive_filter(const char *name, void *opaque)
+{
+	struct main *ctx = opaque;
+
+	const char *ext = MTY_GetFileExtension(name);
+	if (!ext || !ext[0])
+		return false;
+
+	const char *core = NULL;
+	const char *system = NULL;
+	main_get_system_by_ext(ctx, name, &core, &system);
+
+	return core != NULL;
+}
+
 static void main_set_core_options(struct main *ctx)
 {
 	uint32_t len = MTY_JSONGetLength(ctx->core_options);
@@ -398,10 +596,13 @@ static void main_set_core_options(struct main *ctx)
 	}
 }
 
-static void main_read_sram(struct core *core, const char *content_name)
+static void main_read_sram(struct core *core, struct io *io, const char *content_name)
 {
 	const char *name = MTY_SprintfDL("%s.srm", content_name);
 
+	// Don't read underneath a queued write of the same file
+	io_flush(io);
+
 	size_t size = 0;
 	void *sram = MTY_ReadFile(MTY_JoinPath(core_get_save_dir(core), name), &size);
 	if (sram) {
@@ -410,41 +611,199 @@ static void main_read_sram(struct core *core, const char *content_name)
 	}
 }
 
-static void main_save_sram(struct core *core, const char *content_name)
+static void main_save_sram(struct core *core, struct io *io, const char *content_name)
 {
 	if (!content_name)
 		return;
 
 	size_t size = 0;
-	void *sram = core_get_sram(core, &size);
-	if (sram) {
+	const void *sram = core_get_sram_buffer(core, &size);
+	void *buf = sram ? io_get_buffer(io, size) : NULL;
+
+	if (buf) {
+		memcpy(buf, sram, size);
+
+		// Left uncompressed so .srm files stay compatible with other frontends
 		const char *name = MTY_SprintfDL("%s.srm", content_name);
+		io_write(io, MTY_JoinPath(core_get_save_dir(core), name), buf, size, false);
+	}
+}
 
-		MTY_WriteFile(MTY_JoinPath(core_get_save_dir(core), name), sram, size);
-		MTY_Free(sram);
+static const char *main_content_key(struct main *ctx)
+{
+	return MTY_SprintfDL("%s/%s", core_get_library_name(ctx->core), ctx->content_name);
+}
+
+static void main_save_frame_delay(struct main *ctx)
+{
+	if (!ctx->content_name || !ctx->cfg.auto_delay)
+		return;
+
+	// Stored in microseconds per core and content
+	uint32_t us = (uint32_t) lrint(pace_get_delay(ctx->pace) * 1000.0f);
+	MTY_JSONObjSetUInt(ctx->frame_delays, main_content_key(ctx), us);
+}
+
+static void main_read_frame_delay(struct main *ctx)
+{
+	uint32_t us = 0;
+	MTY_JSONObjGetUInt(ctx->frame_delays, main_content_key(ctx), &us);
+
+	pace_set_delay(ctx->pace, us / 1000.0f);
+}
+
+static void main_log_latency(struct main *ctx)
+{
+	if (!ctx->content_name || !ctx->cfg.lag_trace)
+		return;
+
+	struct latency_stats stats = {0};
+	latency_get_stats(ctx->latency, &stats);
+
+	if (stats.responses == 0)
+		return;
+
+	main_log(MTY_SprintfDL("[LAG] %s: %.2f frames (%u-%u), %.2f ms (%.1f-%.1f), latch %.2f ms, "
+		"%u samples, run-ahead %u, frame delay %.1f ms\n", main_content_key(ctx),
+		stats.frames, stats.frames_min, stats.frames_max, stats.ms, stats.ms_min, stats.ms_max,
+		stats.latch_ms, stats.responses, ctx->cfg.run_ahead, pace_get_delay(ctx->pace)), NULL);
+}
+
+static void main_autosave(struct main *ctx)
+{
+	size_t size = 0;
+	const void *sram = core_get_sram_buffer(ctx->core, &size);
+	uint32_t frames = (uint32_t) lrint(core_get_frame_rate(ctx->core));
+
+	if (autosave_step(ctx->autosave, sram, size, frames))
+		main_save_sram(ctx->core, ctx->io, ctx->content_name);
+}
+
+static void main_start_netplay(struct main *ctx)
+{
+	if (!ctx->np.enabled)
+		return;
+
+	// Peers only talk to each other when they loaded content with the same name
+	uint32_t content = MTY_CRC32(0, ctx->content_name, strlen(ctx->content_name));
+
+	ctx->netplay = netplay_create(ctx->core, ctx->np.port, ctx->np.host, ctx->np.remote_port,
+		ctx->np.player, content);
+
+	ctx->np.connected = false;
+	ctx->np.desync = false;
+
+	ui_set_message(ctx->netplay ? "Waiting for netplay peer" : "Failed to start netplay", 3000);
+}
+
+static void main_netplay_status(struct main *ctx)
+{
+	struct netplay_stats stats = {0};
+	netplay_get_stats(ctx->netplay, &stats);
+
+	if (stats.connected && !ctx->np.connected)
+		ui_set_message(MTY_SprintfDL("Netplay connected as player %u", ctx->np.player + 1), 3000);
+
+	if (stats.desync && !ctx->np.desync)
+		ui_set_message(MTY_SprintfDL("Netplay desync at frame %llu", (unsigned long long) stats.desync_frame), 5000);
+
+	ctx->np.connected = stats.connected;
+	ctx->np.desync = stats.desync;
+}
+
+static void main_parse_netplay(struct main *ctx, int32_t argc, char **argv)
+{
+	// --netplay <player> <host>[:port] [local port]
+	for (int32_t x = 1; x + 2 < argc; x++) {
+		if (strcmp(argv[x], "--netplay"))
+			continue;
+
+		ctx->np.enabled = true;
+		ctx->np.player = atoi(argv[x + 1]) == 1 ? 1 : 0;
+		ctx->np.port = x + 3 < argc ? (uint16_t) atoi(argv[x + 3]) : NETPLAY_PORT;
+		ctx->np.remote_port = NETPLAY_PORT;
+		snprintf(ctx->np.host, NETPLAY_HOST_MAX, "%s", argv[x + 2]);
+
+		char *port = strrchr(ctx->np.host, ':');
+		if (port) {
+			*port = '\0';
+			ctx->np.remote_port = (uint16_t) atoi(port + 1);
+		}
+
+		break;
+	}
+}
+
+static void main_release_core(struct main *ctx)
+{
+	// Hosted cores own their process and are never pooled
+	if (core_is_hosted(ctx->core)) {
+		core_unload(&ctx->core);
+
+	} else {
+		pool_release(ctx->pool, &ctx->core);
 	}
 }
 
 static void main_load_game(struct main *ctx, const char *name, bool fetch_core)
 {
+	// Pick the first member a configured system can run
+	char member_path[MTY_PATH_MAX];
+
+	if (archive_is_supported(name)) {
+		char member[MTY_PATH_MAX];
+		if (!archive_find_member(name, main_archive_filter, ctx, member, MTY_PATH_MAX))
+			return;
+
+		// A truncated path would name a different member
+		int32_t len = snprintf(member_path, MTY_PATH_MAX, "%s%c%s", name, ARCHIVE_SEPARATOR, member);
+		if (len < 0 || len >= MTY_PATH_MAX)
+			return;
+
+		name = member_path;
+	}
+
+	const char *member = archive_get_member(name);
+
 	const char *core = NULL;
 	const char *system = NULL;
 	main_get_system_by_ext(ctx, name, &core, &system);
 	if (!core)
 		return;
 
-	const char *cname = MTY_SprintfDL("%s.%s", core, MTY_GetSOExtension());
-	const char *core_path = MTY_JoinPath(MTY_JoinPath(MTY_GetProcessDir(), "cores"), cname);
+	const char *cname = main_get_core_name(core);
+	const char *core_path = main_get_core_path(core);
 
 	// If core is on the system, try to use it
 	if (MTY_FileExists(core_path)) {
-		main_save_sram(ctx->core, ctx->content_name);
+		main_save_sram(ctx->core, ctx->io, ctx->content_name);
+		main_save_frame_delay(ctx);
+		main_log_latency(ctx);
 		MTY_Free(ctx->content_name);
 		ctx->content_name = NULL;
 
-		core_unload(&ctx->core);
+		core_log_perf_counters(ctx->core);
+		search_clear(ctx->search);
+		movie_destroy(&ctx->movie);
+		netplay_destroy(&ctx->netplay);
+		main_release_core(ctx);
+		rewind_reset(ctx->rewind);
+		MTY_Atomic32Set(&ctx->has_frame, 0);
+
+		// A core in its own process can crash without taking the frontend down,
+		// if the process can't be started fall back to running it here
+		if (ctx->cfg.isolate_core) {
+			ctx->core = core_load_hosted(core_path, ctx->exe);
+
+			if (!ctx->core)
+				ui_set_message("Failed to start core process, running in-process", 3000);
+		}
+
+		// Cores stay initialized in the pool, switching games on the same system
+		// only costs retro_unload_game / retro_load_game
+		if (!ctx->core)
+			ctx->core = pool_acquire(ctx->pool, core_path);
 
-		ctx->core = core_load(core_path);
 		if (!ctx->core)
 			return;
 
@@ -453,15 +812,27 @@ static void main_load_game(struct main *ctx, const char *name, bool fetch_core)
 		core_set_log_func(main_log, &ctx);
 		core_set_audio_func(ctx->core, main_audio, ctx);
 		core_set_video_func(ctx->core, main_video, ctx);
+		core_set_framebuffer_func(ctx->core, main_framebuffer, ctx);
 
 		ctx->loaded = core_load_game(ctx->core, name);
 		if (!ctx->loaded)
 			return;
 
 		ui_set_message("Press ESC to access the menu", 3000);
+		snprintf(ctx->cfg.last_system, SYSTEM_NAME_MAX, "%s", system);
 
-		ctx->content_name = MTY_Strdup(MTY_GetFileName(name, false));
-		main_read_sram(ctx->core, ctx->content_name);
+		uint32_t num_regions = 0;
+		const struct core_memory_region *regions = core_get_memory_regions(ctx->core, &num_regions);
+
+		for (uint32_t x = 0; x < num_regions; x++)
+			search_add_region(ctx->search, regions[x].ptr, regions[x].size, regions[x].start);
+
+		ctx->content_name = MTY_Strdup(MTY_GetFileName(member ? member : name, false));
+		main_read_sram(ctx->core, ctx->io, ctx->content_name);
+		main_read_frame_delay(ctx);
+		latency_reset(ctx->latency);
+		autosave_reset(ctx->autosave);
+		main_start_netplay(ctx);
 
 		struct app_event evt = {0};
 		evt.type = APP_EVENT_TITLE;
@@ -475,13 +846,192 @@ static void main_load_game(struct main *ctx, const char *name, bool fetch_core)
 }
 
 
+// State slots
+
+// Movies and netplay replay inputs against a state they know, anything that
+// replaces it behind their back desyncs them
+static bool main_state_is_locked(struct main *ctx, const char *what)
+{
+	if (!ctx->movie && !ctx->netplay)
+		return false;
+
+	ui_set_message(MTY_SprintfDL("%s is disabled during %s", what, ctx->netplay ? "netplay" : "movies"), 3000);
+
+	return true;
+}
+
+static void main_save_state(struct main *ctx, uint8_t index)
+{
+	if (!ctx->content_name)
+		return;
+
+	// Only retro_serialize runs here, compression and the write happen on the
+	// io thread
+	size_t size = core_get_state_size(ctx->core);
+	void *state = io_get_buffer(ctx->io, size);
+
+	if (state) {
+		if (!core_copy_state(ctx->core, state, size)) {
+			io_release_buffer(ctx->io, state);
+			return;
+		}
+
+		const char *path = MTY_JoinPath(MTY_GetProcessDir(), "state");
+		MTY_Mkdir(path);
+
+		struct io_state_info info = {0};
+		snprintf(info.core, IO_STATE_NAME_MAX, "%s", core_get_library_name(ctx->core));
+		snprintf(info.core_version, IO_STATE_NAME_MAX, "%s", core_get_library_version(ctx->core));
+
+		const char *name = MTY_SprintfDL("%s.state%u", ctx->content_name, index);
+		io_write_state(ctx->io, MTY_JoinPath(path, name), state, size, &info);
+
+		ui_set_message(MTY_SprintfDL("State saved to slot %u", index), 3000);
+	}
+}
+
+static void main_load_state(struct main *ctx, uint8_t index)
+{
+	if (!ctx->content_name || main_state_is_locked(ctx, "Loading states"))
+		return;
+
+	const char *path = MTY_JoinPath(MTY_GetProcessDir(), "state");
+	MTY_Mkdir(path);
+
+	const char *name = MTY_SprintfDL("%s.state%u", ctx->content_name, index);
+
+	// A save to the same slot may still be in flight
+	io_flush(ctx->io);
+
+	path = MTY_JoinPath(path, name);
+
+	if (!MTY_FileExists(path)) {
+		ui_set_message(MTY_SprintfDL("State does not exist for slot %u", index), 3000);
+		return;
+	}
+
+	size_t size = 0;
+	struct io_state_info info = {0};
+	void *state = io_read_state(ctx->io, path, &size, &info);
+	const char *msg = NULL;
+
+	// Older states carry no header and are passed to the core unchecked
+	if (state && info.core[0] && strcmp(info.core, core_get_library_name(ctx->core))) {
+		msg = MTY_SprintfDL("State in slot %u was saved by %s", index, info.core);
+
+	} else if (state && core_set_state(ctx->core, state, size)) {
+		msg = MTY_SprintfDL("State loaded from slot %u", index);
+		rewind_reset(ctx->rewind);
+
+	} else {
+		msg = MTY_SprintfDL("Error loading state from slot %u", index);
+	}
+
+	io_release_buffer(ctx->io, state);
+
+	if (msg)
+		ui_set_message(msg, 3000);
+}
+
+static void main_reset_game(struct main *ctx)
+{
+	if (main_state_is_locked(ctx, "Reset"))
+		return;
+
+	core_reset_game(ctx->core);
+	rewind_reset(ctx->rewind);
+}
+
+
+// Cheats
+
+static void main_search_event(struct main *ctx, const struct app_event *evt)
+{
+	struct search *search = ctx->search;
+
+	switch (evt->search.op) {
+		case APP_SEARCH_START:
+			search_start(search, evt->search.size);
+			break;
+		case APP_SEARCH_FILTER:
+			search_filter(search, evt->search.cmp, evt->search.prev, evt->search.value);
+			break;
+		case APP_SEARCH_LIVE:
+			search_set_live(search, evt->search.enabled, evt->search.cmp, evt->search.prev,
+				evt->search.value);
+			break;
+		case APP_SEARCH_FREEZE:
+			search_freeze(search, evt->search.address, evt->search.size, evt->search.value);
+			break;
+		case APP_SEARCH_UNFREEZE:
+			search_unfreeze(search, evt->search.address);
+			break;
+		case APP_SEARCH_UNFREEZE_ALL:
+			search_unfreeze_all(search);
+			break;
+	}
+}
+
+
+// Movies
+
+static const char *main_movie_path(struct main *ctx)
+{
+	const char *dir = MTY_JoinPath(MTY_GetProcessDir(), "movie");
+	MTY_Mkdir(dir);
+
+	return MTY_JoinPath(dir, MTY_SprintfDL("%s.%s", ctx->content_name, MOVIE_EXT));
+}
+
+static void main_movie_event(struct main *ctx, const struct app_event *evt)
+{
+	// Both own the core's input hook
+	if (!ctx->content_name || ctx->netplay)
+		return;
+
+	switch (evt->type) {
+		case APP_EVENT_MOVIE_REC: {
+			movie_destroy(&ctx->movie);
+
+			uint32_t interval = (uint32_t) lrint(core_get_frame_rate(ctx->core) * MOVIE_KEYFRAME_SECS);
+			ctx->movie = movie_record(ctx->core, ctx->io, main_movie_path(ctx), interval);
+
+			ui_set_message(ctx->movie ? "Recording movie" : "Failed to start recording", 3000);
+			break;
+		}
+		case APP_EVENT_MOVIE_PLAY:
+			movie_destroy(&ctx->movie);
+			io_flush(ctx->io);
+
+			ctx->movie = movie_play(ctx->core, main_movie_path(ctx));
+			rewind_reset(ctx->rewind);
+
+			ui_set_message(ctx->movie ? "Playing movie" : "No movie recorded for this game", 3000);
+			break;
+		case APP_EVENT_MOVIE_STOP:
+			movie_destroy(&ctx->movie);
+			break;
+		case APP_EVENT_MOVIE_SEEK: {
+			int64_t frame = (int64_t) movie_get_frame(ctx->movie) + evt->seek;
+			movie_seek(ctx->movie, frame > 0 ? (uint64_t) frame : 0);
+			rewind_reset(ctx->rewind);
+			break;
+		}
+		default:
+			break;
+	}
+}
+
+
 // App events
 
 static void main_push_app_event(const struct app_event *evt, void *opaque)
 {
 	struct main *ctx = opaque;
 
-	MTY_Queue *q = evt->rt ? ctx->rt_q : ctx->mt_q;
+	// Graphics changes belong to the render thread, everything else flagged rt
+	// touches the core and runs on the emulation thread
+	MTY_Queue *q = evt->type == APP_EVENT_GFX ? ctx->gfx_q : evt->rt ? ctx->rt_q : ctx->mt_q;
 
 	struct app_event *qbuf = MTY_QueueGetInputBuffer(q);
 	if (qbuf) {
@@ -538,8 +1088,16 @@ static void main_poll_app_events(struct main *ctx, MTY_Queue *q)
 				main_load_game(ctx, evt->game, evt->fetch_core);
 				break;
 			case APP_EVENT_UNLOAD_GAME: {
+				main_save_sram(ctx->core, ctx->io, ctx->content_name);
+				main_save_frame_delay(ctx);
+				main_log_latency(ctx);
+				search_clear(ctx->search);
+				movie_destroy(&ctx->movie);
+				netplay_destroy(&ctx->netplay);
+				autosave_reset(ctx->autosave);
 				core_unload_game(ctx->core);
-				ctx->got_frame = false;
+				rewind_reset(ctx->rewind);
+				MTY_Atomic32Set(&ctx->has_frame, 0);
 
 				struct app_event tevt = {0};
 				tevt.type = APP_EVENT_TITLE;
@@ -556,6 +1114,24 @@ static void main_poll_app_events(struct main *ctx, MTY_Queue *q)
 				MTY_JSONObjSetString(ctx->core_options, evt->opt.key, evt->opt.val);
 				core_set_variable(ctx->core, evt->opt.key, evt->opt.val);
 				break;
+			case APP_EVENT_MOVIE_REC:
+			case APP_EVENT_MOVIE_PLAY:
+			case APP_EVENT_MOVIE_STOP:
+			case APP_EVENT_MOVIE_SEEK:
+				main_movie_event(ctx, evt);
+				break;
+			case APP_EVENT_RESET:
+				main_reset_game(ctx);
+				break;
+			case APP_EVENT_SAVE_STATE:
+				main_save_state(ctx, evt->slot);
+				break;
+			case APP_EVENT_LOAD_STATE:
+				main_load_state(ctx, evt->slot);
+				break;
+			case APP_EVENT_SEARCH:
+				main_search_event(ctx, evt);
+				break;
 			default:
 				break;
 		}
@@ -571,9 +1147,9 @@ static void *main_audio_thread(void *opaque)
 {
 	struct main *ctx = opaque;
 
-	MTY_Audio *audio = MTY_AudioCreate(48000, PCM_BUFFER, PCM_BUFFER * 2);
-	if (!audio)
-		return NULL;
+	uint32_t buffer = PCM_BUFFER;
+	uint32_t failed = 0;
+	MTY_Audio *audio = NULL;
 
 	struct rsp *rsp = rsp_create();
 
@@ -585,16 +1161,45 @@ static void *main_audio_thread(void *opaque)
 	while (ctx->running) {
 		struct main_audio_packet *pkt = NULL;
 
-		while (MTY_QueueGetOutputBuffer(ctx->a_q, 10, (void **) &pkt, NULL)) {
-			#define TARGET_RATE(rate, fps) \
-				((double) (rate) * (1.0 - ((60.0 - (fps)) / (fps))))
+		// Cores may ask for more latency, the device is recreated with larger buffers
+		uint32_t latency = MTY_Atomic32Get(&ctx->audio_latency);
+		latency = latency > PCM_MAX ? PCM_MAX : latency < PCM_BUFFER ? PCM_BUFFER : latency;
 
-			// Reset resampler on sample rate changes
+		if (!audio || (latency != buffer && latency != failed)) {
+			MTY_AudioDestroy(&audio);
+			audio = MTY_AudioCreate(48000, latency, latency * 2);
+
+			// A size the device refuses is not asked for again, the previous one
+			// is restored and a missing device is retried on later passes
+			if (audio) {
+				buffer = latency;
+				failed = 0;
+
+			} else {
+				failed = latency;
+				audio = MTY_AudioCreate(48000, buffer, buffer * 2);
+			}
+
+			correct_high = correct_low = false;
+		}
+
+		if (!audio) {
+			while (MTY_QueueGetOutputBuffer(ctx->a_q, 0, (void **) &pkt, NULL))
+				MTY_QueuePop(ctx->a_q);
+
+			MTY_Atomic32Set(&ctx->audio_occupancy, -1);
+			MTY_Sleep(100);
+			continue;
+		}
+
+		while (MTY_QueueGetOutputBuffer(ctx->a_q, 10, (void **) &pkt, NULL)) {
+			// Emulation is paced by the core's own frame rate, so audio arrives in
+			// real time and only clock drift needs correcting
 			if (sample_rate != pkt->sample_rate) {
 				rsp_reset(rsp);
 
 				sample_rate = pkt->sample_rate;
-				target_rate = lrint(TARGET_RATE(SAMPLE_RATE, pkt->fps));
+				target_rate = SAMPLE_RATE;
 				correct_high = correct_low = false;
 			}
 
@@ -607,9 +1212,9 @@ static void *main_audio_thread(void *opaque)
 			}
 
 			// Correct buffer drift by tweaking the output sample rate
-			uint32_t low = PCM_BUFFER / 2;
-			uint32_t mid = PCM_BUFFER;
-			uint32_t high = PCM_BUFFER + low;
+			uint32_t low = buffer / 2;
+			uint32_t mid = buffer;
+			uint32_t high = buffer + low;
 			uint32_t queued = MTY_AudioGetQueued(audio);
 
 			if (queued <= mid)
@@ -621,21 +1226,29 @@ static void *main_audio_thread(void *opaque)
 			if (!correct_high && !correct_low) {
 				if (queued >= high) {
 					correct_high = true;
-					target_rate = lrint(TARGET_RATE(SAMPLE_RATE, pkt->fps) * 0.995);
+					target_rate = lrint(SAMPLE_RATE * 0.995);
 
 				} else if (queued <= low) {
 					correct_low = true;
-					target_rate = lrint(TARGET_RATE(SAMPLE_RATE, pkt->fps) * 1.005);
+					target_rate = lrint(SAMPLE_RATE * 1.005);
 
 				} else {
-					target_rate = lrint(TARGET_RATE(SAMPLE_RATE, pkt->fps));
+					target_rate = SAMPLE_RATE;
 				}
 			}
 
 			MTY_QueuePop(ctx->a_q);
 		}
+
+		// Sampled every pass so a stalled core is seen as a draining buffer
+		uint32_t queued = MTY_AudioGetQueued(audio);
+
+		MTY_Atomic32Set(&ctx->audio_occupancy, ctx->cfg.mute ? -1 : (int32_t) (queued * 100 / (buffer * 2)));
+		MTY_Atomic32Set(&ctx->audio_underrun, queued <= buffer / 2);
 	}
 
+	MTY_Atomic32Set(&ctx->audio_occupancy, -1);
+
 	rsp_destroy(&rsp);
 	MTY_AudioDestroy(&audio);
 
@@ -643,80 +1256,399 @@ static void *main_audio_thread(void *opaque)
 }
 
 
-// Render thread
+// Rewind
 
-static void main_im_root(void *opaque)
+static void main_rewind_capture(struct main *ctx)
 {
-	struct main *ctx = (struct main *) opaque;
+	size_t budget = (size_t) ctx->cfg.rewind_budget * 1024 * 1024;
 
-	struct ui_args args = {0};
-	args.content_name = ctx->content_name;
-	args.systems = ctx->systems;
-	args.core = ctx->core;
-	args.cfg = &ctx->cfg;
-	args.paused = ctx->paused;
-	args.show_menu = !ctx->loaded;
-	args.fullscreen = MTY_WindowIsFullscreen(ctx->app, ctx->window);
-	args.gfx = MTY_WindowGetGFX(ctx->app, ctx->window);
-	ctx->loaded = true;
+	struct rewind_stats stats = {0};
+	rewind_get_stats(ctx->rewind, &stats);
+
+	if (stats.budget != budget) {
+		rewind_destroy(&ctx->rewind);
+
+		if (budget > 0)
+			ctx->rewind = rewind_create(budget);
+	}
+
+	if (!ctx->rewind)
+		return;
+
+	uint32_t interval = ctx->cfg.rewind_interval > 0 ? ctx->cfg.rewind_interval : 1;
+
+	if (++ctx->rewind_frame < interval)
+		return;
 
-	ui_root(&args, main_push_app_event, ctx);
+	ctx->rewind_frame = 0;
+
+	MTY_Time stamp = MTY_GetTime();
+
+	size_t size = 0;
+	const void *state = core_get_state_buffer(ctx->core, &size);
+	if (state)
+		rewind_push(ctx->rewind, state, size);
+
+	// Amortized over the capture interval
+	float cost = MTY_TimeDiff(stamp, MTY_GetTime()) / (float) interval;
+	ctx->rewind_cost = ctx->rewind_cost * 0.9f + cost * 0.1f;
 }
 
-static uint32_t main_calc_interval(MTY_GFX gfx, uint32_t rr, MTY_Time stamp, float *rem)
+static bool main_rewind_step(struct main *ctx)
 {
-	float i = (float) rr / 60.0f;
-	float ims = 1000.0f / (float) rr;
+	if (!ctx->rewinding || !ctx->rewind)
+		return false;
+
+	size_t size = 0;
+	const void *state = rewind_pop(ctx->rewind, &size);
+	if (!state)
+		return false;
 
-	float diff = MTY_TimeDiff(stamp, MTY_GetTime());
-	float next = roundf(i + *rem);
-	float missed = floorf(diff / ims);
+	ctx->rewind_frame = 0;
+
+	return core_set_state(ctx->core, state, size);
+}
 
-	// D3D9 is not aware of frame skipping
-	if (gfx == MTY_GFX_D3D9 && missed >= 1.0f) {
-		next -= missed;
-		*rem = 0;
 
-		if (next < 1.0f)
-			next = 1.0f;
+// Emulation thread
 
+static void main_fast_forward(struct main *ctx, MTY_Time stamp, float period)
+{
+	ctx->skip_audio = true;
+
+	// A ratio of N runs N frames per paced frame, the last one is shown by the
+	// regular core_run_frame call
+	if (ctx->cfg.fast_forward > 0) {
+		for (uint32_t x = 1; x < ctx->cfg.fast_forward; x++) {
+			if (!ctx->movie)
+				search_apply_freezes(ctx->search);
+
+			core_skip_frame(ctx->core);
+		}
+
+	// Uncapped fills most of the frame period, leaving room for the shown frame
 	} else {
-		*rem += i - next;
+		while (core_game_is_loaded(ctx->core) && MTY_TimeDiff(stamp, MTY_GetTime()) < period * 0.75f) {
+			if (!ctx->movie)
+				search_apply_freezes(ctx->search);
 
-		if (*rem > 1.0f)
-			*rem = 0.0f;
+			core_skip_frame(ctx->core);
+		}
 	}
 
-	return lrint(next);
+	ctx->skip_audio = false;
 }
 
-static void *main_render_thread(void *opaque)
+static void main_run_frame(struct main *ctx, MTY_Time stamp, float period)
+{
+	// Netplay peers must see the same inputs on the same frames, anything
+	// that changes the state outside of that is off. Movies replay against
+	// their keyframes and are held to the same rule
+	bool np = ctx->netplay != NULL;
+	bool locked = np || ctx->movie != NULL;
+	bool rewound = !locked && main_rewind_step(ctx);
+
+	// Lets cores that support it skip rendering when audio is about to underrun
+	int32_t occupancy = MTY_Atomic32Get(&ctx->audio_occupancy);
+	core_set_audio_buffer_status(ctx->core, occupancy >= 0, occupancy >= 0 ? occupancy : 0,
+		MTY_Atomic32Get(&ctx->audio_underrun) != 0);
+
+	core_set_fast_forward(ctx->core, ctx->fast_forward && !np, ctx->cfg.fast_forward);
+	core_set_input_latch(ctx->core, ctx->cfg.latch_on_read ? CORE_LATCH_STATE : CORE_LATCH_POLL);
+
+	if (ctx->fast_forward && !rewound && !np)
+		main_fast_forward(ctx, stamp, period);
+
+	if (np) {
+		core_set_run_ahead(ctx->core, 0, false);
+
+		// Stalled waiting on the peer, the last frame stays up
+		netplay_run_frame(ctx->netplay);
+		main_netplay_status(ctx);
+
+	} else {
+		if (!locked)
+			search_apply_freezes(ctx->search);
+
+		core_set_run_ahead(ctx->core, ctx->cfg.run_ahead, ctx->cfg.run_ahead_instance);
+		core_run_frame(ctx->core);
+	}
+
+	search_update(ctx->search);
+	main_autosave(ctx);
+
+	if (ctx->content_name && core_is_hosted(ctx->core) && !core_game_is_loaded(ctx->core)) {
+		MTY_Free(ctx->content_name);
+		ctx->content_name = NULL;
+		ui_set_message("The core crashed, reload the game to continue", 5000);
+	}
+
+	if (movie_is_done(ctx->movie)) {
+		movie_destroy(&ctx->movie);
+		ui_set_message("Movie finished", 3000);
+	}
+
+	MTY_Atomic32Set(&ctx->audio_latency, core_get_audio_latency(ctx->core));
+
+	if (!rewound && !locked)
+		main_rewind_capture(ctx);
+}
+
+static void *main_emu_thread(void *opaque)
 {
 	struct main *ctx = opaque;
-	float rem = 0.0f;
 
-	MTY_WindowSetGFX(ctx->app, ctx->window, ctx->cfg.gfx, true);
-	MTY_WindowMakeCurrent(ctx->app, ctx->window, true);
+	MTY_MutexLock(ctx->core_mutex);
+
+	ctx->search = search_create();
+	ctx->io = io_create();
+	ctx->autosave = autosave_create();
+	ctx->pool = pool_create(POOL_CORES);
+
+	// Load the core for the most recently played system while the window comes up
+	if (ctx->cfg.last_system[0]) {
+		const char *core_path = main_get_core_path(CONFIG_GET_CORE(&ctx->cfg, ctx->cfg.last_system));
+
+		if (MTY_FileExists(core_path))
+			pool_prewarm(ctx->pool, core_path);
+	}
+
+	MTY_MutexUnlock(ctx->core_mutex);
 
 	while (ctx->running) {
 		MTY_Time stamp = MTY_GetTime();
 
+		// The render thread only takes the core while building the UI
+		MTY_MutexLock(ctx->core_mutex);
+
 		main_poll_app_events(ctx, ctx->rt_q);
 		main_poll_core_fetch(ctx);
 
-		if (MTY_WindowIsActive(ctx->app, ctx->window) || !ctx->cfg.bg_pause) {
-			ctx->got_frame = false;
+		bool active = (MTY_WindowIsActive(ctx->app, ctx->window) || !ctx->cfg.bg_pause) &&
+			!ctx->paused && core_game_is_loaded(ctx->core);
 
-			// Wait longer for input to come in before running frame
-			if (ctx->cfg.reduce_latency > 0)
-				MTY_Sleep(ctx->cfg.reduce_latency);
+		pace_set_rate(ctx->pace, core_get_frame_rate(ctx->core), ctx->cfg.vrr);
+		pace_set_delay_mode(ctx->pace, ctx->cfg.auto_delay, (float) ctx->cfg.reduce_latency);
+		bool steady = !ctx->fast_forward && !ctx->rewinding;
+		float period = pace_get_period(ctx->pace);
 
-			if (!ctx->paused) {
-				core_run_frame(ctx->core);
+		MTY_MutexUnlock(ctx->core_mutex);
 
-			} else {
-				main_video(NULL, 0, 0, 0, ctx);
-			}
+		// Input is polled at the top of the loop, the frame delay applied by
+		// pace_wait holds it off until just enough time is left to run the frame
+		if (active) {
+			MTY_Time fstamp = MTY_GetTime();
+
+			MTY_MutexLock(ctx->core_mutex);
+			main_run_frame(ctx, stamp, period);
+			MTY_MutexUnlock(ctx->core_mutex);
+
+			pace_wait(ctx->pace, MTY_TimeDiff(fstamp, MTY_GetTime()), steady);
+
+		} else {
+			MTY_Sleep(8);
+			pace_reset(ctx->pace);
+		}
+	}
+
+	MTY_MutexLock(ctx->core_mutex);
+
+	main_save_sram(ctx->core, ctx->io, ctx->content_name);
+	main_save_frame_delay(ctx);
+	main_log_latency(ctx);
+	MTY_Free(ctx->content_name);
+	ctx->content_name = NULL;
+
+	movie_destroy(&ctx->movie);
+	netplay_destroy(&ctx->netplay);
+	core_log_perf_counters(ctx->core);
+	core_unload(&ctx->core);
+	pool_destroy(&ctx->pool);
+	io_destroy(&ctx->io);
+	autosave_destroy(&ctx->autosave);
+	rewind_destroy(&ctx->rewind);
+	search_destroy(&ctx->search);
+
+	MTY_MutexUnlock(ctx->core_mutex);
+
+	return NULL;
+}
+
+
+// Render thread
+
+static void main_snapshot_variables(struct main *ctx)
+{
+	struct ui_args *ui = &ctx->ui;
+
+	uint32_t len = 0;
+	const struct core_variable *vars = core_get_variables(ctx->core, &len);
+	uint32_t version = core_get_variables_version(ctx->core);
+
+	// Definitions are large and only change when the core sends a new set
+	if (version != ctx->ui_variables_version || len != ui->num_variables) {
+		MTY_Free(ctx->ui_variables);
+		MTY_Free(ctx->ui_values);
+
+		ctx->ui_variables = len > 0 ? MTY_Dup(vars, len * sizeof(struct core_variable)) : NULL;
+		ctx->ui_values = len > 0 ? MTY_Alloc(len, CORE_OPT_NAME_MAX) : NULL;
+		ctx->ui_variables_version = version;
+
+		ui->variables = ctx->ui_variables;
+		ui->values = (const char (*)[CORE_OPT_NAME_MAX]) ctx->ui_values;
+		ui->num_variables = len;
+	}
+
+	for (uint32_t x = 0; x < len; x++) {
+		const char *cur = core_get_variable(ctx->core, vars[x].key);
+		snprintf(ctx->ui_values[x], CORE_OPT_NAME_MAX, "%s", cur ? cur : vars[x].opts[0]);
+	}
+}
+
+static void main_snapshot_search(struct main *ctx)
+{
+	struct search *search = ctx->search;
+	struct ui_search *s = &ctx->ui.search;
+
+	memset(s, 0, sizeof(struct ui_search));
+
+	s->available = search != NULL;
+	if (!search)
+		return;
+
+	s->active = search_is_active(search);
+	s->live = search_is_live(search);
+	s->size = search_get_size(search);
+	s->count = search_get_count(search);
+
+	if (s->active && s->count <= UI_SEARCH_RESULTS) {
+		s->num_results = search_get_results(search, s->results, UI_SEARCH_RESULTS);
+
+		for (uint32_t x = 0; x < s->num_results; x++)
+			s->frozen[x] = search_is_frozen(search, s->results[x].address);
+	}
+}
+
+static void main_snapshot_ui(struct main *ctx)
+{
+	struct ui_args *ui = &ctx->ui;
+
+	ui->show_menu = !ctx->loaded;
+	ctx->loaded = true;
+
+	ui->rewind_cost = ctx->rewind_cost;
+	rewind_get_stats(ctx->rewind, &ui->rewind);
+
+	ui->game_loaded = core_game_is_loaded(ctx->core);
+	ui->frame_rate = core_get_frame_rate(ctx->core);
+
+	const char *path = core_get_game_path(ctx->core);
+	snprintf(ui->game_path, MTY_PATH_MAX, "%s", path ? path : "");
+
+	main_snapshot_variables(ctx);
+	main_snapshot_search(ctx);
+
+	ui->movie.active = ctx->movie != NULL;
+	ui->movie.recording = movie_is_recording(ctx->movie);
+	ui->movie.frame = movie_get_frame(ctx->movie);
+	ui->movie.length = movie_get_length(ctx->movie);
+
+	ctx->ui_ready = true;
+}
+
+static void main_im_root(void *opaque)
+{
+	struct main *ctx = (struct main *) opaque;
+
+	struct ui_args *args = &ctx->ui;
+	args->systems = ctx->systems;
+	args->cfg = &ctx->cfg;
+	args->paused = ctx->paused;
+	args->fullscreen = MTY_WindowIsFullscreen(ctx->app, ctx->window);
+	args->gfx = MTY_WindowGetGFX(ctx->app, ctx->window);
+	pace_get_stats(ctx->pace, &args->pace);
+	latency_get_stats(ctx->latency, &args->latency);
+
+	ui_root(args, main_push_app_event, ctx);
+
+	// Only shown on the first build
+	args->show_menu = false;
+}
+
+static MTY_Time main_draw_frame(struct main *ctx)
+{
+	const void *buf = NULL;
+
+	// Takes the newest published frame, otherwise the last one is drawn again
+	if (MTY_Atomic32Get(&ctx->fb_ready) & FB_FRESH) {
+		int32_t ready = 0;
+
+		do {
+			ready = MTY_Atomic32Get(&ctx->fb_ready);
+		} while (!MTY_Atomic32CAS(&ctx->fb_ready, ready, (int32_t) ctx->fb_front));
+
+		ctx->fb_front = ready & FB_INDEX;
+		buf = ctx->fb[ctx->fb_front].buf;
+	}
+
+	const struct main_frame *frame = &ctx->fb[ctx->fb_front];
+	enum core_color_format format = buf ? frame->format : CORE_COLOR_FORMAT_UNKNOWN;
+
+	MTY_RenderDesc desc = {0};
+	desc.format =
+		format == CORE_COLOR_FORMAT_BGRA ? MTY_COLOR_FORMAT_BGRA :
+		format == CORE_COLOR_FORMAT_B5G6R5 ? MTY_COLOR_FORMAT_BGR565 :
+		format == CORE_COLOR_FORMAT_B5G5R5A1 ? MTY_COLOR_FORMAT_BGRA5551 :
+		MTY_COLOR_FORMAT_UNKNOWN;
+
+	desc.imageWidth = (uint32_t) (format == CORE_COLOR_FORMAT_BGRA ? frame->pitch / 4 : frame->pitch / 2);
+	desc.imageHeight = frame->height;
+	desc.cropWidth = frame->width;
+	desc.cropHeight = frame->height;
+	desc.scale = (float) ctx->cfg.frame_size;
+	desc.filter = ctx->cfg.filter;
+	desc.effect = ctx->cfg.effect;
+
+	desc.aspectRatio = ctx->cfg.aspect_ratio.y == 0 ?
+		frame->aspect_ratio : (float) ctx->cfg.aspect_ratio.x / (float) ctx->cfg.aspect_ratio.y;
+
+	MTY_WindowDrawQuad(ctx->app, ctx->window, buf, &desc);
+
+	// Only the first present of a traced frame counts
+	return buf ? frame->trace : 0;
+}
+
+static void main_wait_frame(struct main *ctx, float period)
+{
+	MTY_MutexLock(ctx->fb_mutex);
+
+	// Bounded so the UI keeps drawing while nothing is running
+	if (!(MTY_Atomic32Get(&ctx->fb_ready) & FB_FRESH))
+		MTY_CondWait(ctx->fb_cond, ctx->fb_mutex, (int32_t) ceilf(period));
+
+	MTY_MutexUnlock(ctx->fb_mutex);
+}
+
+static void *main_render_thread(void *opaque)
+{
+	struct main *ctx = opaque;
+	const MTY_DrawData *dd = NULL;
+
+	MTY_WindowSetGFX(ctx->app, ctx->window, ctx->cfg.gfx, true);
+	MTY_WindowMakeCurrent(ctx->app, ctx->window, true);
+
+	while (ctx->running) {
+		main_poll_app_events(ctx, ctx->gfx_q);
+
+		if (MTY_WindowIsActive(ctx->app, ctx->window) || !ctx->cfg.bg_pause) {
+			uint32_t interval = pace_get_interval(ctx->pace);
+
+			// Variable refresh, the present is the frame's own refresh
+			if (interval == 0)
+				main_wait_frame(ctx, pace_get_period(ctx->pace));
+
+			bool has_frame = MTY_Atomic32Get(&ctx->has_frame) != 0;
+			MTY_Time trace = has_frame ? main_draw_frame(ctx) : 0;
 
 			uint32_t window_width = 0;
 			uint32_t window_height = 0;
@@ -732,14 +1664,30 @@ static void *main_render_thread(void *opaque)
 				MTY_Free(font);
 			}
 
-			const MTY_DrawData *dd = im_draw(window_width, window_height, scale,
-				!ctx->got_frame, main_im_root, ctx);
+			// The core is only held long enough to copy what the UI shows, the UI
+			// itself is built without it and drives the core through events. If a
+			// frame is still running the previous copy is shown
+			bool locked = MTY_MutexTryLock(ctx->core_mutex);
+
+			if (!locked && !ctx->ui_ready) {
+				MTY_MutexLock(ctx->core_mutex);
+				locked = true;
+			}
+
+			if (locked) {
+				main_snapshot_ui(ctx);
+				MTY_MutexUnlock(ctx->core_mutex);
+			}
+
+			dd = im_draw(window_width, window_height, scale, !has_frame, main_im_root, ctx);
 
 			MTY_WindowDrawUI(ctx->app, ctx->window, dd);
 
-			MTY_GFX gfx = MTY_WindowGetGFX(ctx->app, ctx->window);
-			uint32_t rr = MTY_WindowGetRefreshRate(ctx->app, ctx->window);
-			MTY_WindowPresent(ctx->app, ctx->window, main_calc_interval(gfx, rr, stamp, &rem));
+			MTY_WindowPresent(ctx->app, ctx->window, interval);
+			pace_present(ctx->pace, MTY_WindowGetRefreshRate(ctx->app, ctx->window));
+
+			if (trace != 0)
+				latency_present(ctx->latency, trace);
 
 		} else {
 			MTY_Sleep(8);
@@ -748,13 +1696,11 @@ static void *main_render_thread(void *opaque)
 
 	MTY_WindowSetGFX(ctx->app, ctx->window, MTY_GFX_NONE, false);
 
-	main_save_sram(ctx->core, ctx->content_name);
-	MTY_Free(ctx->content_name);
-
-	core_unload(&ctx->core);
-
 	ui_destroy();
 
+	MTY_Free(ctx->ui_variables);
+	MTY_Free(ctx->ui_values);
+
 	return NULL;
 }
 
@@ -781,6 +1727,12 @@ static void main_event_func(const MTY_Event *evt, void *opaque)
 			break;
 		}
 		case MTY_EVENT_KEY: {
+			if (evt->key.key == MTY_KEY_BACKSPACE)
+				ctx->rewinding = evt->key.pressed;
+
+			if (evt->key.key == MTY_KEY_TAB)
+				ctx->fast_forward = evt->key.pressed;
+
 			enum core_button button = NES_KEYBOARD_MAP[evt->key.key];
 			if (button != 0)
 				core_set_button(ctx->core, 0, button, evt->key.pressed);
@@ -836,14 +1788,20 @@ static void main_mty_log_callback(const char *msg, void *opaque)
 
 int32_t main(int32_t argc, char **argv)
 {
+	// Relaunched as the process that runs an isolated core
+	if (argc >= 3 && !strcmp(argv[1], HOST_ARG))
+		return host_main(argv[2]);
+
 	im_create();
 	main_write_default_systems();
 
 	MTY_HttpAsyncCreate(4);
 
 	struct main ctx = {0};
-	ctx.cfg = main_load_config(&ctx.core_options, &ctx.core_exts);
+	ctx.cfg = main_load_config(&ctx.core_options, &ctx.core_exts, &ctx.frame_delays);
 	ctx.running = true;
+	ctx.exe = argv[0];
+	main_parse_netplay(&ctx, argc, argv);
 
 	if (ctx.cfg.console)
 		MTY_OpenConsole(APP_NAME);
@@ -856,7 +1814,18 @@ int32_t main(int32_t argc, char **argv)
 
 	ctx.rt_q = MTY_QueueCreate(50, sizeof(struct app_event));
 	ctx.mt_q = MTY_QueueCreate(50, sizeof(struct app_event));
+	ctx.gfx_q = MTY_QueueCreate(5, sizeof(struct app_event));
 	ctx.a_q = MTY_QueueCreate(5, sizeof(struct main_audio_packet));
+	MTY_Atomic32Set(&ctx.audio_occupancy, -1);
+
+	ctx.core_mutex = MTY_MutexCreate();
+	ctx.fb_mutex = MTY_MutexCreate();
+	ctx.fb_cond = MTY_CondCreate();
+	ctx.pace = pace_create();
+	ctx.latency = latency_create();
+	ctx.fb_back = 0;
+	ctx.fb_front = 2;
+	MTY_Atomic32Set(&ctx.fb_ready, 1);
 
 	if (argc >= 2) {
 		struct app_event evt = {0};
@@ -880,13 +1849,18 @@ int32_t main(int32_t argc, char **argv)
 	if (ctx.window == -1)
 		goto except;
 
+	MTY_Thread *et = MTY_ThreadCreate(main_emu_thread, &ctx);
 	MTY_Thread *rt = MTY_ThreadCreate(main_render_thread, &ctx);
 	MTY_Thread *at = MTY_ThreadCreate(main_audio_thread, &ctx);
 	MTY_AppRun(ctx.app);
 	MTY_ThreadDestroy(&at);
 	MTY_ThreadDestroy(&rt);
+	MTY_ThreadDestroy(&et);
+
+	// Both sides of the triple buffer are stopped
+	main_free_framebuffers(&ctx);
 
-	main_save_config(&ctx.cfg, ctx.core_options, ctx.core_exts);
+	main_save_config(&ctx.cfg, ctx.core_options, ctx.core_exts, ctx.frame_delays);
 
 	except:
 
@@ -894,11 +1868,19 @@ int32_t main(int32_t argc, char **argv)
 	MTY_AppDestroy(&ctx.app);
 	MTY_QueueDestroy(&ctx.rt_q);
 	MTY_QueueDestroy(&ctx.mt_q);
+	MTY_QueueDestroy(&ctx.gfx_q);
 	MTY_QueueDestroy(&ctx.a_q);
 	MTY_JSONDestroy(&ctx.systems);
 	MTY_JSONDestroy(&ctx.core_options);
 	MTY_JSONDestroy(&ctx.core_exts);
-
+	MTY_JSONDestroy(&ctx.frame_delays);
+	MTY_MutexDestroy(&ctx.core_mutex);
+	MTY_CondDestroy(&ctx.fb_cond);
+	MTY_MutexDestroy(&ctx.fb_mutex);
+	pace_destroy(&ctx.pace);
+	latency_destroy(&ctx.latency);
+
+	archive_clear_cache();
 	MTY_HttpAsyncDestroy();
 
 	im_destroy();
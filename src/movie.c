@@ -0,0 +1,359 @@
+// Copyright (c) Christopher D. Dickson <cdd@matoya.group>
+//
+// This Source Code Form is subject to the terms of the MIT License.
+// If a copy of the MIT License was not distributed with this file,
+// You can obtain one at https://spdx.org/licenses/MIT.html.
+
+#include "movie.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "matoya.h"
+#include "fmap.h"
+
+#define MOVIE_VERSION 1
+#define MOVIE_BATCH   60
+
+// A movie is a stream of io records: a header, the starting state as keyframe
+// 0, then input batches interleaved with keyframes
+enum movie_tag {
+	MOVIE_TAG_HEADER = 0x44484D4D, // MMHD
+	MOVIE_TAG_INPUT  = 0x4E494D4D, // MMIN
+	MOVIE_TAG_STATE  = 0x54534D4D, // MMST
+};
+
+struct movie_header {
+	uint32_t version;
+	uint32_t players;
+	uint32_t input_size;
+	uint32_t keyframe_interval;
+};
+
+struct movie_keyframe {
+	uint64_t frame;
+	struct io_record rec;
+};
+
+typedef struct core_input movie_frame[CORE_PLAYERS_MAX];
+
+struct movie {
+	struct core *core;
+	struct io *io;
+	char path[MTY_PATH_MAX];
+	bool recording;
+	bool done;
+
+	uint64_t frame;
+	uint64_t length;
+	uint32_t interval;
+
+	// Recording
+	movie_frame batch[MOVIE_BATCH];
+	uint32_t batch_len;
+
+	// Playback
+	struct fmap *fm;
+	movie_frame *inputs;
+	struct movie_keyframe *keyframes;
+	uint32_t num_keyframes;
+	void *state;
+	size_t state_cap;
+};
+
+
+// Recording
+
+static bool movie_append(struct movie *ctx, enum movie_tag tag, uint64_t id, const void *data,
+	size_t size, bool compress)
+{
+	void *buf = io_get_buffer(ctx->io, size);
+	if (!buf)
+		return false;
+
+	memcpy(buf, data, size);
+	io_append(ctx->io, ctx->path, tag, id, buf, size, compress);
+
+	return true;
+}
+
+static bool movie_write_keyframe(struct movie *ctx)
+{
+	size_t size = core_get_state_size(ctx->core);
+
+	void *buf = io_get_buffer(ctx->io, size);
+	if (!buf)
+		return false;
+
+	if (!core_copy_state(ctx->core, buf, size)) {
+		io_release_buffer(ctx->io, buf);
+		return false;
+	}
+
+	io_append(ctx->io, ctx->path, MOVIE_TAG_STATE, ctx->frame, buf, size, true);
+
+	return true;
+}
+
+static void movie_flush_batch(struct movie *ctx)
+{
+	if (ctx->batch_len == 0)
+		return;
+
+	movie_append(ctx, MOVIE_TAG_INPUT, ctx->frame - ctx->batch_len, ctx->batch,
+		ctx->batch_len * sizeof(movie_frame), true);
+
+	ctx->batch_len = 0;
+}
+
+
+// Playback
+
+static bool movie_load_keyframe(struct movie *ctx, const struct movie_keyframe *kf)
+{
+	if (ctx->state_cap < kf->rec.raw_size) {
+		MTY_Free(ctx->state);
+		ctx->state = MTY_Alloc(kf->rec.raw_size, 1);
+		ctx->state_cap = kf->rec.raw_size;
+	}
+
+	if (!io_unpack_record(&kf->rec, ctx->state))
+		return false;
+
+	if (!core_set_state(ctx->core, ctx->state, kf->rec.raw_size))
+		return false;
+
+	ctx->frame = kf->frame;
+	ctx->done = false;
+
+	return true;
+}
+
+static bool movie_parse(struct movie *ctx)
+{
+	const void *buf = fmap_get_data(ctx->fm);
+	size_t size = fmap_get_size(ctx->fm);
+	size_t pos = 0;
+
+	struct io_record rec = {0};
+	if (!io_next_record(buf, size, &pos, &rec) || rec.tag != MOVIE_TAG_HEADER ||
+		rec.raw_size != sizeof(struct movie_header))
+		return false;
+
+	struct movie_header header = {0};
+	if (!io_unpack_record(&rec, &header))
+		return false;
+
+	if (header.version != MOVIE_VERSION || header.players != CORE_PLAYERS_MAX ||
+		header.input_size != sizeof(struct core_input))
+		return false;
+
+	ctx->interval = header.keyframe_interval;
+
+	uint64_t cap = 0;
+
+	while (io_next_record(buf, size, &pos, &rec)) {
+		if (rec.tag == MOVIE_TAG_STATE) {
+			ctx->keyframes = MTY_Realloc(ctx->keyframes, ctx->num_keyframes + 1, sizeof(struct movie_keyframe));
+			ctx->keyframes[ctx->num_keyframes].frame = rec.id;
+			ctx->keyframes[ctx->num_keyframes].rec = rec;
+			ctx->num_keyframes++;
+
+		} else if (rec.tag == MOVIE_TAG_INPUT && rec.raw_size % sizeof(movie_frame) == 0) {
+			uint64_t end = rec.id + rec.raw_size / sizeof(movie_frame);
+
+			// Batches are contiguous, anything else means the file was tampered with
+			if (rec.id != ctx->length)
+				return false;
+
+			if (end > cap) {
+				cap = end * 2;
+				ctx->inputs = MTY_Realloc(ctx->inputs, (size_t) cap, sizeof(movie_frame));
+			}
+
+			if (!io_unpack_record(&rec, ctx->inputs + rec.id))
+				return false;
+
+			ctx->length = end;
+		}
+	}
+
+	return ctx->num_keyframes > 0 && ctx->keyframes[0].frame == 0;
+}
+
+
+// Input hook, runs when the core latches input at the start of every frame
+
+static void movie_input(struct core_input *input, uint8_t players, void *opaque)
+{
+	struct movie *ctx = opaque;
+
+	if (ctx->recording) {
+		// Keyframes hold the state before this frame's input is applied
+		if (ctx->frame > 0 && ctx->interval > 0 && ctx->frame % ctx->interval == 0) {
+			movie_flush_batch(ctx);
+			movie_write_keyframe(ctx);
+		}
+
+		memcpy(ctx->batch[ctx->batch_len++], input, sizeof(movie_frame));
+		ctx->frame++;
+
+		if (ctx->batch_len == MOVIE_BATCH)
+			movie_flush_batch(ctx);
+
+		return;
+	}
+
+	if (ctx->frame < ctx->length) {
+		memcpy(input, ctx->inputs[ctx->frame], sizeof(movie_frame));
+		ctx->frame++;
+
+	} else {
+		ctx->done = true;
+	}
+}
+
+
+// Public
+
+struct movie *movie_record(struct core *core, struct io *io, const char *path, uint32_t keyframe_interval)
+{
+	if (!core_game_is_loaded(core) || !io)
+		return NULL;
+
+	struct movie *ctx = MTY_Alloc(1, sizeof(struct movie));
+	ctx->core = core;
+	ctx->io = io;
+	ctx->recording = true;
+	ctx->interval = keyframe_interval;
+	snprintf(ctx->path, MTY_PATH_MAX, "%s", path);
+
+	// Records are appended, so anything still queued for the old file lands first
+	io_flush(io);
+	MTY_DeleteFile(path);
+
+	struct movie_header header = {0};
+	header.version = MOVIE_VERSION;
+	header.players = CORE_PLAYERS_MAX;
+	header.input_size = sizeof(struct core_input);
+	header.keyframe_interval = keyframe_interval;
+
+	bool r = movie_append(ctx, MOVIE_TAG_HEADER, 0, &header, sizeof(struct movie_header), false);
+
+	if (r)
+		r = movie_write_keyframe(ctx);
+
+	if (!r) {
+		MTY_Free(ctx);
+		return NULL;
+	}
+
+	core_set_input_func(core, movie_input, ctx);
+
+	return ctx;
+}
+
+struct movie *movie_play(struct core *core, const char *path)
+{
+	if (!core_game_is_loaded(core))
+		return NULL;
+
+	struct movie *ctx = MTY_Alloc(1, sizeof(struct movie));
+	ctx->core = core;
+	snprintf(ctx->path, MTY_PATH_MAX, "%s", path);
+
+	bool r = true;
+
+	ctx->fm = fmap_open(path, false);
+	if (!ctx->fm) {
+		r = false;
+		goto except;
+	}
+
+	r = movie_parse(ctx);
+	if (!r)
+		goto except;
+
+	r = movie_load_keyframe(ctx, &ctx->keyframes[0]);
+	if (!r)
+		goto except;
+
+	core_set_input_func(core, movie_input, ctx);
+
+	except:
+
+	if (!r)
+		movie_destroy(&ctx);
+
+	return ctx;
+}
+
+void movie_destroy(struct movie **movie)
+{
+	if (!movie || !*movie)
+		return;
+
+	struct movie *ctx = *movie;
+
+	if (ctx->recording)
+		movie_flush_batch(ctx);
+
+	core_set_input_func(ctx->core, NULL, NULL);
+
+	fmap_close(&ctx->fm);
+
+	MTY_Free(ctx->inputs);
+	MTY_Free(ctx->keyframes);
+	MTY_Free(ctx->state);
+
+	MTY_Free(ctx);
+	*movie = NULL;
+}
+
+bool movie_seek(struct movie *ctx, uint64_t frame)
+{
+	if (!ctx || ctx->recording || ctx->num_keyframes == 0)
+		return false;
+
+	if (frame > ctx->length)
+		frame = ctx->length;
+
+	// Closest keyframe at or before the target, then replay the remainder
+	const struct movie_keyframe *kf = &ctx->keyframes[0];
+
+	for (uint32_t x = 1; x < ctx->num_keyframes; x++)
+		if (ctx->keyframes[x].frame <= frame)
+			kf = &ctx->keyframes[x];
+
+	if (!movie_load_keyframe(ctx, kf))
+		return false;
+
+	// The core may crash or unload mid replay and stop advancing the frame
+	while (ctx->frame < frame && core_game_is_loaded(ctx->core))
+		core_skip_frame(ctx->core);
+
+	return true;
+}
+
+bool movie_is_recording(struct movie *ctx)
+{
+	return ctx && ctx->recording;
+}
+
+bool movie_is_done(struct movie *ctx)
+{
+	return ctx && ctx->done;
+}
+
+uint64_t movie_get_frame(struct movie *ctx)
+{
+	return ctx ? ctx->frame : 0;
+}
+
+uint64_t movie_get_length(struct movie *ctx)
+{
+	if (!ctx)
+		return 0;
+
+	return ctx->recording ? ctx->frame : ctx->length;
+}
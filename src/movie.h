@@ -0,0 +1,26 @@
+// Copyright (c) Christopher D. Dickson <cdd@matoya.group>
+//
+// This Source Code Form is subject to the terms of the MIT License.
+// If a copy of the MIT License was not distributed with this file,
+// You can obtain one at https://spdx.org/licenses/MIT.html.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "core.h"
+#include "io.h"
+
+#define MOVIE_EXT "mmov"
+
+struct movie;
+
+struct movie *movie_record(struct core *core, struct io *io, const char *path, uint32_t keyframe_interval);
+struct movie *movie_play(struct core *core, const char *path);
+void movie_destroy(struct movie **movie);
+bool movie_seek(struct movie *ctx, uint64_t frame);
+bool movie_is_recording(struct movie *ctx);
+bool movie_is_done(struct movie *ctx);
+uint64_t movie_get_frame(struct movie *ctx);
+uint64_t movie_get_length(struct movie *ctx);
@@ -0,0 +1,610 @@
+// Copyright (c) Christopher D. Dickson <cdd@matoya.group>
+//
+// This Source Code Form is subject to the terms of the MIT License.
+// If a copy of the MIT License was not distributed with this file,
+// You can obtain one at https://spdx.org/licenses/MIT.html.
+
+// getaddrinfo is POSIX.1-2001
+#if !defined(_WIN32)
+	#define _XOPEN_SOURCE 700
+#endif
+
+#include "netplay.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
+
+#if defined(_WIN32)
+	#include <winsock2.h>
+	#include <ws2tcpip.h>
+
+	typedef SOCKET NETPLAY_SOCKET;
+	#define NETPLAY_SOCKET_NONE INVALID_SOCKET
+	#define netplay_close_socket closesocket
+#else
+	#include <sys/types.h>
+	#include <sys/socket.h>
+	#include <netinet/in.h>
+	#include <netdb.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+
+	typedef int32_t NETPLAY_SOCKET;
+	#define NETPLAY_SOCKET_NONE -1
+	#define netplay_close_socket close
+#endif
+
+#include "matoya.h"
+
+#define NETPLAY_MAGIC    0x504E4D4D // MMNP
+#define NETPLAY_VERSION  1
+
+#define NETPLAY_HISTORY  128
+#define NETPLAY_STATES   16
+#define NETPLAY_AHEAD    12
+#define NETPLAY_SEND_MAX 32
+#define NETPLAY_HASHES   8
+
+#define NETPLAY_DELAY_MAX      4
+#define NETPLAY_DELAY_INTERVAL 60
+#define NETPLAY_HASH_INTERVAL  60
+#define NETPLAY_ADVANTAGE      2.0
+
+#define NETPLAY_FLAG_SEEN 0x01
+#define NETPLAY_FLAG_PONG 0x02
+#define NETPLAY_FLAG_HASH 0x04
+
+// Every packet carries the sender's unacknowledged input, so a lost packet is
+// covered by the next one and there is no separate ack or retransmit
+struct netplay_packet {
+	uint32_t magic;
+	uint16_t version;
+	uint8_t player;
+	uint8_t flags;
+	uint32_t content;
+	uint32_t ping;
+	uint32_t pong;
+	uint32_t hash;
+	uint64_t hash_frame;
+	uint64_t frame;
+	uint64_t ack;
+	uint64_t start;
+	uint32_t count;
+	uint32_t hold;
+	struct core_input inputs[NETPLAY_SEND_MAX];
+};
+
+struct netplay_state {
+	uint64_t frame;
+	void *buf;
+	size_t size;
+	size_t cap;
+};
+
+struct netplay_hash {
+	uint64_t frame;
+	uint32_t hash;
+	bool valid;
+};
+
+struct netplay {
+	struct core *core;
+	NETPLAY_SOCKET s;
+	uint8_t player;
+	uint32_t content;
+	MTY_Time epoch;
+	double frame_ms;
+
+	bool seen;
+	bool connected;
+	bool replaying;
+	bool waited;
+
+	// Frames are numbered from the moment both sides connected
+	uint64_t frame;
+	uint64_t sim;
+	uint64_t local_next;
+	uint64_t remote_next;
+	uint64_t remote_ack;
+	uint64_t remote_frame;
+	uint64_t rollback;
+	uint32_t delay;
+
+	struct core_input local[NETPLAY_HISTORY];
+	struct core_input remote[NETPLAY_HISTORY];
+	struct core_input used[NETPLAY_HISTORY];
+	struct netplay_state states[NETPLAY_STATES];
+
+	// Round trip, the peer echoes our clock along with how long it held it
+	uint32_t pong;
+	uint32_t pong_time;
+	bool has_pong;
+	float rtt;
+
+	uint64_t hash_next;
+	struct netplay_hash local_hash[NETPLAY_HASHES];
+	struct netplay_hash remote_hash[NETPLAY_HASHES];
+	struct netplay_hash last_hash;
+
+	struct netplay_stats stats;
+};
+
+
+// Sockets
+
+static NETPLAY_SOCKET netplay_socket(uint16_t port, const char *host, uint16_t remote_port)
+{
+	char service[8];
+	snprintf(service, 8, "%u", remote_port);
+
+	struct addrinfo hints = {0};
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;
+
+	struct addrinfo *ai = NULL;
+	if (getaddrinfo(host, service, &hints, &ai) != 0 || !ai)
+		return NETPLAY_SOCKET_NONE;
+
+	bool r = true;
+
+	NETPLAY_SOCKET s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (s == NETPLAY_SOCKET_NONE) {
+		r = false;
+		goto except;
+	}
+
+	struct sockaddr_in addr = {0};
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+	// Connected so the kernel drops datagrams from anyone but the peer
+	r = bind(s, (struct sockaddr *) &addr, sizeof(addr)) == 0 &&
+		connect(s, ai->ai_addr, (int) ai->ai_addrlen) == 0;
+
+	if (!r)
+		goto except;
+
+	#if defined(_WIN32)
+		u_long nb = 1;
+		r = ioctlsocket(s, FIONBIO, &nb) == 0;
+	#else
+		r = fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK) == 0;
+	#endif
+
+	except:
+
+	freeaddrinfo(ai);
+
+	if (!r && s != NETPLAY_SOCKET_NONE) {
+		netplay_close_socket(s);
+		s = NETPLAY_SOCKET_NONE;
+	}
+
+	return s;
+}
+
+static uint32_t netplay_now(struct netplay *ctx)
+{
+	return (uint32_t) MTY_TimeDiff(ctx->epoch, MTY_GetTime());
+}
+
+
+// Input
+
+static bool netplay_input_equal(const struct core_input *a, const struct core_input *b)
+{
+	if (a->buttons != b->buttons)
+		return false;
+
+	for (uint8_t x = 0; x < CORE_AXIS_MAX; x++)
+		if (a->axes[x] != b->axes[x])
+			return false;
+
+	return true;
+}
+
+static struct core_input netplay_remote_input(struct netplay *ctx, uint64_t frame)
+{
+	if (frame < ctx->remote_next)
+		return ctx->remote[frame % NETPLAY_HISTORY];
+
+	// Predicted as whatever the peer was last known to be holding
+	if (ctx->remote_next > 0)
+		return ctx->remote[(ctx->remote_next - 1) % NETPLAY_HISTORY];
+
+	struct core_input none = {0};
+
+	return none;
+}
+
+static void netplay_input(struct core_input *input, uint8_t players, void *opaque)
+{
+	struct netplay *ctx = opaque;
+
+	uint64_t f = ctx->sim;
+
+	// Local input is scheduled delay frames out, a shrinking delay leaves
+	// frames already scheduled alone and a growing one repeats the sample
+	if (!ctx->replaying) {
+		for (; ctx->local_next <= f + ctx->delay; ctx->local_next++)
+			ctx->local[ctx->local_next % NETPLAY_HISTORY] = input[0];
+	}
+
+	struct core_input *used = &ctx->used[f % NETPLAY_HISTORY];
+	*used = netplay_remote_input(ctx, f);
+
+	memset(input, 0, players * sizeof(struct core_input));
+	input[ctx->player] = ctx->local[f % NETPLAY_HISTORY];
+	input[ctx->player ^ 1] = *used;
+}
+
+
+// Desync detection
+
+static void netplay_compare_hash(struct netplay *ctx, uint64_t frame)
+{
+	const struct netplay_hash *l = &ctx->local_hash[(frame / NETPLAY_HASH_INTERVAL) % NETPLAY_HASHES];
+	const struct netplay_hash *r = &ctx->remote_hash[(frame / NETPLAY_HASH_INTERVAL) % NETPLAY_HASHES];
+
+	if (!l->valid || !r->valid || l->frame != frame || r->frame != frame)
+		return;
+
+	if (l->hash != r->hash && !ctx->stats.desync) {
+		ctx->stats.desync = true;
+		ctx->stats.desync_frame = frame;
+	}
+}
+
+static void netplay_set_hash(struct netplay_hash *hashes, uint64_t frame, uint32_t hash)
+{
+	struct netplay_hash *h = &hashes[(frame / NETPLAY_HASH_INTERVAL) % NETPLAY_HASHES];
+	h->frame = frame;
+	h->hash = hash;
+	h->valid = true;
+}
+
+static void netplay_update_hash(struct netplay *ctx)
+{
+	// A state is final once every input before it is confirmed, the ring state
+	// has already been rewritten by any rollback that touched it
+	while (ctx->hash_next < ctx->frame && ctx->hash_next <= ctx->remote_next) {
+		const struct netplay_state *st = &ctx->states[ctx->hash_next % NETPLAY_STATES];
+
+		if (st->frame == ctx->hash_next) {
+			uint32_t hash = MTY_CRC32(0, st->buf, st->size);
+
+			netplay_set_hash(ctx->local_hash, ctx->hash_next, hash);
+			ctx->last_hash = ctx->local_hash[(ctx->hash_next / NETPLAY_HASH_INTERVAL) % NETPLAY_HASHES];
+			netplay_compare_hash(ctx, ctx->hash_next);
+		}
+
+		ctx->hash_next += NETPLAY_HASH_INTERVAL;
+	}
+}
+
+
+// Network
+
+static void netplay_send(struct netplay *ctx)
+{
+	struct netplay_packet pkt = {0};
+	pkt.magic = NETPLAY_MAGIC;
+	pkt.version = NETPLAY_VERSION;
+	pkt.player = ctx->player;
+	pkt.content = ctx->content;
+	pkt.ping = netplay_now(ctx);
+	pkt.frame = ctx->frame;
+	pkt.ack = ctx->remote_next;
+
+	if (ctx->seen)
+		pkt.flags |= NETPLAY_FLAG_SEEN;
+
+	if (ctx->has_pong) {
+		pkt.flags |= NETPLAY_FLAG_PONG;
+		pkt.pong = ctx->pong;
+		pkt.hold = pkt.ping - ctx->pong_time;
+	}
+
+	if (ctx->last_hash.valid) {
+		pkt.flags |= NETPLAY_FLAG_HASH;
+		pkt.hash_frame = ctx->last_hash.frame;
+		pkt.hash = ctx->last_hash.hash;
+	}
+
+	if (ctx->connected) {
+		uint64_t count = ctx->local_next - ctx->remote_ack;
+		if (count > NETPLAY_SEND_MAX)
+			count = NETPLAY_SEND_MAX;
+
+		pkt.start = ctx->remote_ack;
+		pkt.count = (uint32_t) count;
+
+		for (uint32_t x = 0; x < pkt.count; x++)
+			pkt.inputs[x] = ctx->local[(pkt.start + x) % NETPLAY_HISTORY];
+	}
+
+	size_t size = offsetof(struct netplay_packet, inputs) + pkt.count * sizeof(struct core_input);
+
+	send(ctx->s, (const char *) &pkt, (int) size, 0);
+}
+
+static void netplay_begin(struct netplay *ctx)
+{
+	// Both sides start from a fresh boot of the same content
+	core_reset_game(ctx->core);
+
+	ctx->connected = true;
+	ctx->frame = 0;
+	ctx->local_next = 0;
+	ctx->remote_next = 0;
+	ctx->remote_ack = 0;
+	ctx->remote_frame = 0;
+	ctx->rollback = UINT64_MAX;
+	ctx->hash_next = 0;
+}
+
+static void netplay_receive_inputs(struct netplay *ctx, const struct netplay_packet *pkt)
+{
+	if (pkt->ack > ctx->remote_ack && pkt->ack <= ctx->local_next)
+		ctx->remote_ack = pkt->ack;
+
+	if (pkt->frame > ctx->remote_frame)
+		ctx->remote_frame = pkt->frame;
+
+	uint64_t end = pkt->start + pkt->count;
+
+	// Only the contiguous continuation is taken, gaps are filled by later packets
+	for (uint64_t f = ctx->remote_next; f >= pkt->start && f < end; f++) {
+		if (f >= ctx->frame + NETPLAY_HISTORY / 2)
+			break;
+
+		const struct core_input *in = &pkt->inputs[f - pkt->start];
+		ctx->remote[f % NETPLAY_HISTORY] = *in;
+
+		if (f < ctx->frame && f < ctx->rollback && !netplay_input_equal(in, &ctx->used[f % NETPLAY_HISTORY]))
+			ctx->rollback = f;
+
+		ctx->remote_next = f + 1;
+	}
+
+	if (pkt->flags & NETPLAY_FLAG_HASH) {
+		netplay_set_hash(ctx->remote_hash, pkt->hash_frame, pkt->hash);
+		netplay_compare_hash(ctx, pkt->hash_frame);
+	}
+}
+
+static void netplay_receive(struct netplay *ctx)
+{
+	struct netplay_packet pkt;
+	size_t header = offsetof(struct netplay_packet, inputs);
+
+	while (true) {
+		int32_t n = (int32_t) recv(ctx->s, (char *) &pkt, sizeof(struct netplay_packet), 0);
+		if (n < 0)
+			break;
+
+		if ((size_t) n < header || pkt.magic != NETPLAY_MAGIC || pkt.version != NETPLAY_VERSION ||
+			pkt.content != ctx->content || pkt.player == ctx->player || pkt.count > NETPLAY_SEND_MAX ||
+			(size_t) n < header + pkt.count * sizeof(struct core_input))
+			continue;
+
+		uint32_t now = netplay_now(ctx);
+
+		ctx->seen = true;
+		ctx->pong = pkt.ping;
+		ctx->pong_time = now;
+		ctx->has_pong = true;
+
+		if (pkt.flags & NETPLAY_FLAG_PONG) {
+			int64_t rtt = (int64_t) now - pkt.pong - pkt.hold;
+			if (rtt < 0)
+				rtt = 0;
+
+			ctx->rtt = ctx->rtt == 0.0f ? (float) rtt : ctx->rtt * 0.9f + (float) rtt * 0.1f;
+		}
+
+		if (!ctx->connected) {
+			if (!(pkt.flags & NETPLAY_FLAG_SEEN))
+				continue;
+
+			netplay_begin(ctx);
+		}
+
+		netplay_receive_inputs(ctx, &pkt);
+	}
+}
+
+
+// Rollback
+
+static void netplay_save_state(struct netplay *ctx, uint64_t frame)
+{
+	struct netplay_state *st = &ctx->states[frame % NETPLAY_STATES];
+
+	size_t size = core_get_state_size(ctx->core);
+
+	if (size > st->cap) {
+		MTY_Free(st->buf);
+		st->buf = MTY_Alloc(size, 1);
+		st->cap = size;
+	}
+
+	// Serialized straight into the ring, nothing is allocated per frame
+	st->size = size;
+	st->frame = core_copy_state(ctx->core, st->buf, size) ? frame : UINT64_MAX;
+}
+
+static void netplay_rollback(struct netplay *ctx)
+{
+	uint64_t from = ctx->rollback;
+	const struct netplay_state *st = &ctx->states[from % NETPLAY_STATES];
+
+	if (st->frame != from || !core_set_state(ctx->core, st->buf, st->size)) {
+		if (!ctx->stats.desync) {
+			ctx->stats.desync = true;
+			ctx->stats.desync_frame = from;
+		}
+
+		return;
+	}
+
+	ctx->replaying = true;
+
+	for (uint64_t f = from; f < ctx->frame; f++) {
+		if (f > from)
+			netplay_save_state(ctx, f);
+
+		ctx->sim = f;
+		core_replay_frame(ctx->core);
+	}
+
+	ctx->replaying = false;
+
+	ctx->stats.rollbacks++;
+	ctx->stats.replayed += ctx->frame - from;
+}
+
+static void netplay_update_delay(struct netplay *ctx)
+{
+	if (ctx->frame % NETPLAY_DELAY_INTERVAL != 0)
+		return;
+
+	// Delay hides the one way trip, rollback covers jitter on top of it
+	uint32_t delay = (uint32_t) ceil(ctx->rtt / 2.0 / ctx->frame_ms);
+
+	ctx->delay = delay > NETPLAY_DELAY_MAX ? NETPLAY_DELAY_MAX : delay;
+}
+
+static bool netplay_should_wait(struct netplay *ctx)
+{
+	// Out of rollback room
+	if (ctx->frame >= ctx->remote_next + NETPLAY_AHEAD)
+		return true;
+
+	// The side that is ahead of the peer's clock gives up a frame now and then
+	// so neither keeps rolling back the other
+	double peer = (double) ctx->remote_frame + ctx->rtt / 2.0 / ctx->frame_ms;
+	bool wait = (double) ctx->frame - peer >= NETPLAY_ADVANTAGE && !ctx->waited;
+
+	ctx->waited = wait;
+
+	return wait;
+}
+
+static bool netplay_advance(struct netplay *ctx)
+{
+	if (ctx->rollback < ctx->frame)
+		netplay_rollback(ctx);
+
+	ctx->rollback = UINT64_MAX;
+
+	netplay_update_hash(ctx);
+	netplay_update_delay(ctx);
+
+	if (netplay_should_wait(ctx)) {
+		ctx->stats.stalls++;
+		return false;
+	}
+
+	netplay_save_state(ctx, ctx->frame);
+
+	ctx->sim = ctx->frame;
+	core_run_frame(ctx->core);
+	ctx->frame++;
+
+	return true;
+}
+
+
+// Public
+
+struct netplay *netplay_create(struct core *core, uint16_t port, const char *host,
+	uint16_t remote_port, uint8_t player, uint32_t content)
+{
+	if (!core_game_is_loaded(core) || !host || player > 1)
+		return NULL;
+
+	#if defined(_WIN32)
+		WSADATA wsa = {0};
+		if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0)
+			return NULL;
+	#endif
+
+	struct netplay *ctx = MTY_Alloc(1, sizeof(struct netplay));
+	ctx->core = core;
+	ctx->player = player;
+	ctx->content = content;
+	ctx->epoch = MTY_GetTime();
+	ctx->rollback = UINT64_MAX;
+
+	double fps = core_get_frame_rate(core);
+	ctx->frame_ms = 1000.0 / (fps > 0.0 ? fps : 60.0);
+
+	for (uint32_t x = 0; x < NETPLAY_STATES; x++)
+		ctx->states[x].frame = UINT64_MAX;
+
+	ctx->s = netplay_socket(port, host, remote_port);
+
+	if (ctx->s == NETPLAY_SOCKET_NONE) {
+		netplay_destroy(&ctx);
+		return NULL;
+	}
+
+	core_set_input_func(core, netplay_input, ctx);
+
+	return ctx;
+}
+
+void netplay_destroy(struct netplay **netplay)
+{
+	if (!netplay || !*netplay)
+		return;
+
+	struct netplay *ctx = *netplay;
+
+	if (ctx->s != NETPLAY_SOCKET_NONE) {
+		core_set_input_func(ctx->core, NULL, NULL);
+		netplay_close_socket(ctx->s);
+	}
+
+	for (uint32_t x = 0; x < NETPLAY_STATES; x++)
+		MTY_Free(ctx->states[x].buf);
+
+	#if defined(_WIN32)
+		WSACleanup();
+	#endif
+
+	MTY_Free(ctx);
+	*netplay = NULL;
+}
+
+bool netplay_run_frame(struct netplay *ctx)
+{
+	if (!ctx)
+		return false;
+
+	netplay_receive(ctx);
+
+	bool ran = ctx->connected && netplay_advance(ctx);
+
+	netplay_send(ctx);
+
+	return ran;
+}
+
+void netplay_get_stats(struct netplay *ctx, struct netplay_stats *stats)
+{
+	memset(stats, 0, sizeof(struct netplay_stats));
+
+	if (!ctx)
+		return;
+
+	*stats = ctx->stats;
+	stats->connected = ctx->connected;
+	stats->frame = ctx->frame;
+	stats->delay = ctx->delay;
+	stats->rtt = (uint32_t) lrintf(ctx->rtt);
+}
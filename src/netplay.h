@@ -0,0 +1,34 @@
+// Copyright (c) Christopher D. Dickson <cdd@matoya.group>
+//
+// This Source Code Form is subject to the terms of the MIT License.
+// If a copy of the MIT License was not distributed with this file,
+// You can obtain one at https://spdx.org/licenses/MIT.html.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "core.h"
+
+#define NETPLAY_PORT 7840
+
+struct netplay;
+
+struct netplay_stats {
+	bool connected;
+	bool desync;
+	uint64_t frame;
+	uint64_t desync_frame;
+	uint32_t delay;
+	uint32_t rtt;
+	uint64_t rollbacks;
+	uint64_t replayed;
+	uint64_t stalls;
+};
+
+struct netplay *netplay_create(struct core *core, uint16_t port, const char *host,
+	uint16_t remote_port, uint8_t player, uint32_t content);
+void netplay_destroy(struct netplay **netplay);
+bool netplay_run_frame(struct netplay *ctx);
+void netplay_get_stats(struct netplay *ctx, struct netplay_stats *stats);
@@ -0,0 +1,455 @@
+// Copyright (c) Christopher D. Dickson <cdd@matoya.group>
+//
+// This Source Code Form is subject to the terms of the MIT License.
+// If a copy of the MIT License was not distributed with this file,
+// You can obtain one at https://spdx.org/licenses/MIT.html.
+
+#include "pace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "matoya.h"
+
+// A core within this of a multiple of the display is run at the display's rate,
+// the audio drift correction absorbs the difference
+#define PACE_SYNC_TOLERANCE 0.005
+
+// Fraction of a refresh kept clear on either side of the renderer picking up
+// a frame after each present
+#define PACE_MARGIN 0.15
+
+#define PACE_SPIN_MIN 1.0f
+#define PACE_SPIN_MAX 4.0f
+
+// Automatic frame delay: ms kept clear before the next pickup, the largest
+// fraction of the window it may take, ms it grows by per frame, and frames it
+// is held after backing off
+#define PACE_DELAY_MARGIN 1.0
+#define PACE_DELAY_MAX    0.9
+#define PACE_DELAY_STEP   0.05
+#define PACE_DELAY_HOLD   300
+
+struct pace {
+	MTY_Mutex *mutex;
+
+	double fps;
+	bool vrr;
+	uint32_t refresh_hint;
+
+	// Measured by the render thread from present timestamps
+	double refresh;
+	MTY_Time last_present;
+	bool presented;
+
+	enum pace_mode mode;
+	uint32_t interval;
+	double period;
+
+	// Emulation clock, the deadline is ms since origin so the period can change
+	// without losing the accumulated schedule
+	MTY_Time origin;
+	double deadline;
+	double exec;
+
+	// Frame delay, in automatic mode the largest one that still publishes the
+	// frame before the next pickup is learned from p99 timings
+	bool auto_delay;
+	double delay;
+	uint32_t hold;
+
+	// Rolling timings, exec is sampled by the emulation thread and present
+	// lateness by the render thread
+	float exec_ring[PACE_WINDOW];
+	float present_ring[PACE_WINDOW];
+	uint32_t exec_n;
+	uint32_t present_n;
+	float exec_p99;
+	float present_p99;
+
+	// Only touched by the emulation thread
+	float spin;
+
+	struct pace_stats stats;
+};
+
+
+// Mode selection
+
+static void pace_update(struct pace *ctx)
+{
+	double fps = ctx->fps > 0.0 ? ctx->fps : 60.0;
+	double refresh = ctx->refresh > 0.0 ? ctx->refresh : (double) ctx->refresh_hint;
+
+	// Frames are shown as they are ready and the display follows
+	if (ctx->vrr) {
+		ctx->mode = PACE_MODE_VRR;
+		ctx->interval = 0;
+		ctx->period = 1000.0 / fps;
+		return;
+	}
+
+	// An exact multiple swaps every N refreshes with emulation locked to them
+	if (refresh > 0.0) {
+		double ratio = refresh / fps;
+		double n = round(ratio);
+
+		if (n >= 1.0 && fabs(ratio - n) / n < PACE_SYNC_TOLERANCE) {
+			ctx->mode = PACE_MODE_SYNC;
+			ctx->interval = (uint32_t) n;
+			ctx->period = n * 1000.0 / refresh;
+			return;
+		}
+	}
+
+	// Anything else runs at the core's rate and frames are repeated or dropped
+	// on a regular cadence
+	ctx->mode = PACE_MODE_REPEAT;
+	ctx->interval = 1;
+	ctx->period = 1000.0 / fps;
+}
+
+
+// Frame delay
+
+static int32_t pace_compare(const void *a, const void *b)
+{
+	float fa = *(const float *) a;
+	float fb = *(const float *) b;
+
+	return fa < fb ? -1 : fa > fb ? 1 : 0;
+}
+
+static float pace_p99(const float *ring, uint32_t n)
+{
+	float sorted[PACE_WINDOW];
+	uint32_t count = n < PACE_WINDOW ? n : PACE_WINDOW;
+
+	if (count == 0)
+		return 0.0f;
+
+	memcpy(sorted, ring, count * sizeof(float));
+	qsort(sorted, count, sizeof(float), pace_compare);
+
+	return sorted[count * 99 / 100];
+}
+
+static void pace_sample(float *ring, uint32_t *n, float *p99, float val)
+{
+	ring[*n % PACE_WINDOW] = val;
+	(*n)++;
+
+	if (*n % 16 == 0 || *n < PACE_WINDOW / 4)
+		*p99 = pace_p99(ring, *n);
+}
+
+static void pace_tune(struct pace *ctx, float exec)
+{
+	double window = ctx->period;
+
+	pace_sample(ctx->exec_ring, &ctx->exec_n, &ctx->exec_p99, exec);
+
+	if (!ctx->auto_delay)
+		return;
+
+	// The frame finished after the next pickup and will be shown a refresh late,
+	// back off past the overrun right away and hold there for a while
+	double overrun = ctx->delay + exec - window;
+
+	if (overrun > 0.0) {
+		ctx->delay -= overrun + PACE_DELAY_MARGIN;
+		ctx->delay = ctx->delay < 0.0 ? 0.0 : ctx->delay;
+		ctx->hold = PACE_DELAY_HOLD;
+		return;
+	}
+
+	if (ctx->exec_n < PACE_WINDOW / 4)
+		return;
+
+	double target = window - ctx->exec_p99 - ctx->present_p99 - PACE_DELAY_MARGIN;
+	target = target < 0.0 ? 0.0 : target > window * PACE_DELAY_MAX ? window * PACE_DELAY_MAX : target;
+
+	// Drops right away when the timings get worse, grows slowly once a full
+	// window of frames backs it up
+	if (target < ctx->delay) {
+		ctx->delay = target;
+
+	} else if (ctx->hold > 0) {
+		ctx->hold--;
+
+	} else if (ctx->exec_n >= PACE_WINDOW) {
+		ctx->delay += target - ctx->delay < PACE_DELAY_STEP ? target - ctx->delay : PACE_DELAY_STEP;
+	}
+}
+
+
+// Waiting
+
+static double pace_now(struct pace *ctx)
+{
+	return MTY_TimeDiff(ctx->origin, MTY_GetTime());
+}
+
+static void pace_sleep(struct pace *ctx, double target)
+{
+	// Coarse sleeps while well ahead, then spin the rest for sub-millisecond
+	// accuracy. The spin window follows how late MTY_Sleep(1) has been waking up
+	while (target - pace_now(ctx) > ctx->spin) {
+		MTY_Time stamp = MTY_GetTime();
+		MTY_Sleep(1);
+
+		float late = MTY_TimeDiff(stamp, MTY_GetTime()) + 0.25f;
+		ctx->spin = late > ctx->spin ? late : ctx->spin - 0.001f;
+
+		if (ctx->spin < PACE_SPIN_MIN)
+			ctx->spin = PACE_SPIN_MIN;
+
+		if (ctx->spin > PACE_SPIN_MAX)
+			ctx->spin = PACE_SPIN_MAX;
+	}
+
+	while (pace_now(ctx) < target)
+		;
+}
+
+
+// Public
+
+struct pace *pace_create(void)
+{
+	struct pace *ctx = MTY_Alloc(1, sizeof(struct pace));
+
+	ctx->mutex = MTY_MutexCreate();
+	ctx->origin = MTY_GetTime();
+	ctx->spin = PACE_SPIN_MIN;
+
+	pace_update(ctx);
+
+	return ctx;
+}
+
+void pace_destroy(struct pace **pace)
+{
+	if (!pace || !*pace)
+		return;
+
+	struct pace *ctx = *pace;
+
+	MTY_MutexDestroy(&ctx->mutex);
+
+	MTY_Free(ctx);
+	*pace = NULL;
+}
+
+void pace_set_rate(struct pace *ctx, double fps, bool vrr)
+{
+	MTY_MutexLock(ctx->mutex);
+
+	if (fps != ctx->fps || vrr != ctx->vrr) {
+		ctx->fps = fps;
+		ctx->vrr = vrr;
+
+		memset(&ctx->stats, 0, sizeof(struct pace_stats));
+		pace_update(ctx);
+	}
+
+	MTY_MutexUnlock(ctx->mutex);
+}
+
+float pace_get_period(struct pace *ctx)
+{
+	MTY_MutexLock(ctx->mutex);
+
+	float period = (float) ctx->period;
+
+	MTY_MutexUnlock(ctx->mutex);
+
+	return period;
+}
+
+uint32_t pace_get_interval(struct pace *ctx)
+{
+	MTY_MutexLock(ctx->mutex);
+
+	uint32_t interval = ctx->interval;
+
+	MTY_MutexUnlock(ctx->mutex);
+
+	return interval;
+}
+
+void pace_set_delay_mode(struct pace *ctx, bool automatic, float manual)
+{
+	MTY_MutexLock(ctx->mutex);
+
+	ctx->auto_delay = automatic;
+
+	if (!automatic)
+		ctx->delay = manual;
+
+	MTY_MutexUnlock(ctx->mutex);
+}
+
+void pace_set_delay(struct pace *ctx, float delay)
+{
+	MTY_MutexLock(ctx->mutex);
+
+	// New content starts from what it learned last time with fresh timings
+	ctx->delay = delay;
+	ctx->hold = 0;
+	ctx->exec_n = 0;
+	ctx->exec_p99 = 0.0f;
+
+	MTY_MutexUnlock(ctx->mutex);
+}
+
+float pace_get_delay(struct pace *ctx)
+{
+	MTY_MutexLock(ctx->mutex);
+
+	float delay = (float) ctx->delay;
+
+	MTY_MutexUnlock(ctx->mutex);
+
+	return delay;
+}
+
+void pace_reset(struct pace *ctx)
+{
+	MTY_MutexLock(ctx->mutex);
+
+	ctx->origin = MTY_GetTime();
+	ctx->deadline = 0.0;
+
+	MTY_MutexUnlock(ctx->mutex);
+}
+
+void pace_wait(struct pace *ctx, float exec, bool steady)
+{
+	MTY_MutexLock(ctx->mutex);
+
+	// Fast forward and rewind are not a measure of the content
+	bool delayed = steady && ctx->mode == PACE_MODE_SYNC;
+
+	if (delayed)
+		pace_tune(ctx, exec);
+
+	ctx->exec = ctx->exec * 0.9 + (double) exec * 0.1;
+	ctx->deadline += ctx->period;
+
+	double now = pace_now(ctx);
+	double target = ctx->deadline;
+
+	// More than a couple of frames behind, start over rather than run a burst
+	// of frames to catch up
+	if (now > ctx->deadline + ctx->period * 2.0) {
+		ctx->deadline = now;
+		target = now;
+
+	} else if (ctx->mode == PACE_MODE_SYNC && ctx->presented && ctx->refresh > 0.0) {
+		// Locked rates nudge the clock onto the renderer's pickup, the frame delay
+		// then holds off the frame and its input for as much of the window as
+		// it can spare
+		double pickup = MTY_TimeDiff(ctx->origin, ctx->last_present);
+		double phase = fmod(ctx->deadline - pickup, ctx->period) / ctx->period;
+
+		if (phase < 0.0)
+			phase += 1.0;
+
+		if (phase > 0.5)
+			phase -= 1.0;
+
+		ctx->deadline -= phase * ctx->period * 0.05;
+		target = ctx->deadline + (delayed ? ctx->delay : 0.0);
+
+	} else if (ctx->mode == PACE_MODE_REPEAT && ctx->presented && ctx->refresh > 0.0) {
+		double refresh = 1000.0 / ctx->refresh;
+
+		// Where the next frame is published relative to the renderer's pickup
+		double pickup = MTY_TimeDiff(ctx->origin, ctx->last_present);
+		double phase = fmod(ctx->deadline + ctx->exec - pickup, refresh) / refresh;
+
+		if (phase < 0.0)
+			phase += 1.0;
+
+		// A frame landing right on the pickup would be shown a refresh early or
+		// late at random, it is held until just after it instead
+		if (phase < PACE_MARGIN) {
+			target += (PACE_MARGIN - phase) * refresh;
+
+		} else if (phase > 1.0 - PACE_MARGIN) {
+			target += (1.0 - phase + PACE_MARGIN) * refresh;
+		}
+	}
+
+	MTY_MutexUnlock(ctx->mutex);
+
+	pace_sleep(ctx, target);
+}
+
+void pace_present(struct pace *ctx, uint32_t refresh)
+{
+	MTY_Time now = MTY_GetTime();
+
+	MTY_MutexLock(ctx->mutex);
+
+	if (refresh != ctx->refresh_hint) {
+		ctx->refresh_hint = refresh;
+		ctx->refresh = 0.0;
+		ctx->presented = false;
+	}
+
+	if (ctx->presented) {
+		double delta = MTY_TimeDiff(ctx->last_present, now);
+		double expected = ctx->period;
+
+		if (ctx->mode != PACE_MODE_VRR) {
+			double hint = refresh > 0 ? 1000.0 / refresh : 0.0;
+			double vblank = delta / ctx->interval;
+
+			// Missed refreshes and stalls are not a measure of the display
+			if (vblank > hint * 0.8 && vblank < hint * 1.2)
+				ctx->refresh = ctx->refresh > 0.0 ? ctx->refresh * 0.99 + 0.01 * (1000.0 / vblank) : 1000.0 / vblank;
+
+			expected = ctx->refresh > 0.0 ? ctx->interval * 1000.0 / ctx->refresh : delta;
+		}
+
+		// Late presents eat into the window the frame delay can take
+		if (ctx->mode == PACE_MODE_SYNC && delta < expected * 2.0) {
+			float late = (float) (delta - expected);
+			pace_sample(ctx->present_ring, &ctx->present_n, &ctx->present_p99, late > 0.0f ? late : 0.0f);
+		}
+
+		int32_t bin = (int32_t) lrint((delta - expected) / PACE_BIN_MS) + PACE_BINS / 2;
+		bin = bin < 0 ? 0 : bin >= PACE_BINS ? PACE_BINS - 1 : bin;
+
+		ctx->stats.histogram[bin]++;
+		ctx->stats.presents++;
+
+		pace_update(ctx);
+	}
+
+	ctx->last_present = now;
+	ctx->presented = true;
+
+	MTY_MutexUnlock(ctx->mutex);
+}
+
+void pace_get_stats(struct pace *ctx, struct pace_stats *stats)
+{
+	MTY_MutexLock(ctx->mutex);
+
+	*stats = ctx->stats;
+	stats->mode = ctx->mode;
+	stats->fps = ctx->fps;
+	stats->refresh = ctx->refresh > 0.0 ? ctx->refresh : (double) ctx->refresh_hint;
+	stats->period = (float) ctx->period;
+	stats->interval = ctx->interval;
+	stats->delay = ctx->mode == PACE_MODE_SYNC ? (float) ctx->delay : 0.0f;
+	stats->exec_p99 = ctx->exec_p99;
+	stats->present_p99 = ctx->present_p99;
+	stats->auto_delay = ctx->auto_delay;
+
+	MTY_MutexUnlock(ctx->mutex);
+}
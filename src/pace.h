@@ -0,0 +1,57 @@
+// Copyright (c) Christopher D. Dickson <cdd@matoya.group>
+//
+// This Source Code Form is subject to the terms of the MIT License.
+// If a copy of the MIT License was not distributed with this file,
+// You can obtain one at https://spdx.org/licenses/MIT.html.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PACE_BINS   11
+#define PACE_BIN_MS 0.5f
+
+// Frame timings the automatic frame delay is derived from
+#define PACE_WINDOW 256
+
+enum pace_mode {
+	PACE_MODE_SYNC   = 0,
+	PACE_MODE_REPEAT = 1,
+	PACE_MODE_VRR    = 2,
+};
+
+struct pace_stats {
+	enum pace_mode mode;
+	double fps;
+	double refresh;
+	float period;
+	uint32_t interval;
+
+	// Time held back after the renderer picks up a frame before the next one
+	// starts, and the timings it was derived from
+	float delay;
+	float exec_p99;
+	float present_p99;
+	bool auto_delay;
+
+	// Present-to-present error against the expected interval, PACE_BIN_MS wide
+	// bins centered on zero, the outer bins collect everything beyond them
+	uint64_t histogram[PACE_BINS];
+	uint64_t presents;
+};
+
+struct pace;
+
+struct pace *pace_create(void);
+void pace_destroy(struct pace **pace);
+void pace_set_rate(struct pace *ctx, double fps, bool vrr);
+float pace_get_period(struct pace *ctx);
+uint32_t pace_get_interval(struct pace *ctx);
+void pace_set_delay_mode(struct pace *ctx, bool automatic, float manual);
+void pace_set_delay(struct pace *ctx, float delay);
+float pace_get_delay(struct pace *ctx);
+void pace_reset(struct pace *ctx);
+void pace_wait(struct pace *ctx, float exec, bool steady);
+void pace_present(struct pace *ctx, uint32_t refresh);
+void pace_get_stats(struct pace *ctx, struct pace_stats *stats);
@@ -0,0 +1,188 @@
+// Copyright (c) Christopher D. Dickson <cdd@matoya.group>
+//
+// This Source Code Form is subject to the terms of the MIT License.
+// If a copy of the MIT License was not distributed with this file,
+// You can obtain one at https://spdx.org/licenses/MIT.html.
+
+#include "perf.h"
+
+#include <stdbool.h>
+
+#include "deps/libretro.h"
+
+#if defined(_WIN32)
+	#include <windows.h>
+#else
+	#include <time.h>
+#endif
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+	#define PERF_X86
+
+	#if defined(_MSC_VER)
+		#include <intrin.h>
+	#else
+		#include <cpuid.h>
+		#include <x86intrin.h>
+	#endif
+
+#elif defined(__aarch64__) && !defined(_MSC_VER)
+	#define PERF_ARM64
+#endif
+
+
+// Clocks
+
+int64_t perf_get_usec(void)
+{
+	#if defined(_WIN32)
+	static LARGE_INTEGER freq;
+	if (freq.QuadPart == 0)
+		QueryPerformanceFrequency(&freq);
+
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+
+	// Split to avoid overflowing the multiply on long uptimes
+	return now.QuadPart / freq.QuadPart * 1000000 +
+		now.QuadPart % freq.QuadPart * 1000000 / freq.QuadPart;
+
+	#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	#endif
+}
+
+uint64_t perf_get_ticks(void)
+{
+	#if defined(PERF_X86)
+	return __rdtsc();
+
+	#elif defined(PERF_ARM64)
+	uint64_t ticks = 0;
+	__asm__ __volatile__("mrs %0, cntvct_el0" : "=r" (ticks));
+
+	return ticks;
+
+	#elif defined(_WIN32)
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+
+	return now.QuadPart;
+
+	#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+	#endif
+}
+
+
+// CPU features
+
+#if defined(PERF_X86)
+
+static void perf_cpuid(uint32_t leaf, uint32_t sub, uint32_t r[4])
+{
+	#if defined(_MSC_VER)
+	int v[4] = {0};
+	__cpuidex(v, leaf, sub);
+
+	for (uint8_t x = 0; x < 4; x++)
+		r[x] = (uint32_t) v[x];
+
+	#else
+	__cpuid_count(leaf, sub, r[0], r[1], r[2], r[3]);
+	#endif
+}
+
+static uint64_t perf_xgetbv(void)
+{
+	#if defined(_MSC_VER)
+	return _xgetbv(0);
+
+	#else
+	uint32_t lo = 0, hi = 0;
+	__asm__ __volatile__("xgetbv" : "=a" (lo), "=d" (hi) : "c" (0));
+
+	return (uint64_t) hi << 32 | lo;
+	#endif
+}
+
+static uint64_t perf_detect_cpu_features(void)
+{
+	uint64_t f = 0;
+	uint32_t r[4] = {0};
+
+	perf_cpuid(0, 0, r);
+	uint32_t max_leaf = r[0];
+
+	if (max_leaf < 1)
+		return f;
+
+	perf_cpuid(1, 0, r);
+	uint32_t ecx = r[2];
+	uint32_t edx = r[3];
+
+	if (edx & (1 << 15)) f |= RETRO_SIMD_CMOV;
+	if (edx & (1 << 23)) f |= RETRO_SIMD_MMX;
+	if (edx & (1 << 25)) f |= RETRO_SIMD_SSE | RETRO_SIMD_MMXEXT;
+	if (edx & (1 << 26)) f |= RETRO_SIMD_SSE2;
+	if (ecx & (1 << 0))  f |= RETRO_SIMD_SSE3;
+	if (ecx & (1 << 9))  f |= RETRO_SIMD_SSSE3;
+	if (ecx & (1 << 19)) f |= RETRO_SIMD_SSE4;
+	if (ecx & (1 << 20)) f |= RETRO_SIMD_SSE42;
+	if (ecx & (1 << 22)) f |= RETRO_SIMD_MOVBE;
+	if (ecx & (1 << 23)) f |= RETRO_SIMD_POPCNT;
+	if (ecx & (1 << 25)) f |= RETRO_SIMD_AES;
+
+	// AVX needs the OS to save the YMM registers on context switch
+	bool avx_os = (ecx & (1 << 27)) && (perf_xgetbv() & 0x6) == 0x6;
+
+	if (avx_os && (ecx & (1 << 28)))
+		f |= RETRO_SIMD_AVX;
+
+	if (avx_os && max_leaf >= 7) {
+		perf_cpuid(7, 0, r);
+
+		if (r[1] & (1 << 5))
+			f |= RETRO_SIMD_AVX2;
+	}
+
+	return f;
+}
+
+#else
+
+static uint64_t perf_detect_cpu_features(void)
+{
+	uint64_t f = 0;
+
+	#if defined(__aarch64__) || defined(_M_ARM64)
+	f |= RETRO_SIMD_NEON | RETRO_SIMD_ASIMD;
+
+	#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	f |= RETRO_SIMD_NEON;
+	#endif
+
+	return f;
+}
+
+#endif
+
+uint64_t perf_get_cpu_features(void)
+{
+	// Detection is idempotent so racing first calls are harmless
+	static bool DETECTED;
+	static uint64_t FEATURES;
+
+	if (!DETECTED) {
+		FEATURES = perf_detect_cpu_features();
+		DETECTED = true;
+	}
+
+	return FEATURES;
+}
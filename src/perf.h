@@ -0,0 +1,13 @@
+// Copyright (c) Christopher D. Dickson <cdd@matoya.group>
+//
+// This Source Code Form is subject to the terms of the MIT License.
+// If a copy of the MIT License was not distributed with this file,
+// You can obtain one at https://spdx.org/licenses/MIT.html.
+
+#pragma once
+
+#include <stdint.h>
+
+int64_t perf_get_usec(void);
+uint64_t perf_get_ticks(void);
+uint64_t perf_get_cpu_features(void);
@@ -0,0 +1,167 @@
+// Copyright (c) Christopher D. Dickson <cdd@matoya.group>
+//
+// This Source Code Form is subject to the terms of the MIT License.
+// If a copy of the MIT License was not distributed with this file,
+// You can obtain one at https://spdx.org/licenses/MIT.html.
+
+#include "pool.h"
+
+#include <string.h>
+
+#include "matoya.h"
+
+#define POOL_MAX 4
+
+struct pool_entry {
+	struct core *core;
+	uint64_t stamp;
+};
+
+struct pool {
+	uint32_t max;
+	uint64_t stamp;
+	struct pool_entry entries[POOL_MAX];
+
+	MTY_Thread *prewarm;
+	char *prewarm_path;
+	struct core *prewarm_core;
+};
+
+
+// Entries
+
+static struct pool_entry *pool_find(struct pool *ctx, const char *path)
+{
+	for (uint32_t x = 0; x < ctx->max; x++) {
+		struct pool_entry *e = &ctx->entries[x];
+
+		if (e->core && !strcmp(core_get_path(e->core), path))
+			return e;
+	}
+
+	return NULL;
+}
+
+static void pool_insert(struct pool *ctx, struct core *core)
+{
+	struct pool_entry *slot = NULL;
+
+	for (uint32_t x = 0; x < ctx->max; x++) {
+		struct pool_entry *e = &ctx->entries[x];
+
+		if (!e->core) {
+			slot = e;
+			break;
+		}
+
+		if (!slot || e->stamp < slot->stamp)
+			slot = e;
+	}
+
+	// Least recently used core is fully unloaded
+	core_unload(&slot->core);
+
+	slot->core = core;
+	slot->stamp = ++ctx->stamp;
+}
+
+
+// Prewarm
+
+static void *pool_prewarm_thread(void *opaque)
+{
+	struct pool *ctx = opaque;
+
+	ctx->prewarm_core = core_load(ctx->prewarm_path);
+
+	return NULL;
+}
+
+static void pool_join(struct pool *ctx)
+{
+	if (!ctx->prewarm)
+		return;
+
+	MTY_ThreadDestroy(&ctx->prewarm);
+
+	if (ctx->prewarm_core && !pool_find(ctx, ctx->prewarm_path)) {
+		pool_insert(ctx, ctx->prewarm_core);
+
+	} else {
+		core_unload(&ctx->prewarm_core);
+	}
+
+	ctx->prewarm_core = NULL;
+
+	MTY_Free(ctx->prewarm_path);
+	ctx->prewarm_path = NULL;
+}
+
+
+// Public
+
+struct pool *pool_create(uint32_t max)
+{
+	struct pool *ctx = MTY_Alloc(1, sizeof(struct pool));
+
+	ctx->max = max == 0 ? 1 : max > POOL_MAX ? POOL_MAX : max;
+
+	return ctx;
+}
+
+void pool_destroy(struct pool **pool)
+{
+	if (!pool || !*pool)
+		return;
+
+	struct pool *ctx = *pool;
+
+	pool_join(ctx);
+
+	for (uint32_t x = 0; x < ctx->max; x++)
+		core_unload(&ctx->entries[x].core);
+
+	MTY_Free(ctx);
+	*pool = NULL;
+}
+
+struct core *pool_acquire(struct pool *ctx, const char *path)
+{
+	pool_join(ctx);
+
+	struct pool_entry *e = pool_find(ctx, path);
+
+	if (e) {
+		struct core *core = e->core;
+		memset(e, 0, sizeof(struct pool_entry));
+
+		return core;
+	}
+
+	return core_load(path);
+}
+
+void pool_release(struct pool *ctx, struct core **core)
+{
+	if (!core || !*core)
+		return;
+
+	// Keeps the shared object loaded and retro_init'd, only the game goes away
+	core_unload_game(*core);
+
+	pool_join(ctx);
+	pool_insert(ctx, *core);
+
+	*core = NULL;
+}
+
+void pool_prewarm(struct pool *ctx, const char *path)
+{
+	pool_join(ctx);
+
+	if (pool_find(ctx, path))
+		return;
+
+	ctx->prewarm_path = MTY_Strdup(path);
+	ctx->prewarm = MTY_ThreadCreate(pool_prewarm_thread, ctx);
+}
@@ -0,0 +1,19 @@
+// Copyright (c) Christopher D. Dickson <cdd@matoya.group>
+//
+// This Source Code Form is subject to the terms of the MIT License.
+// If a copy of the MIT License was not distributed with this file,
+// You can obtain one at https://spdx.org/licenses/MIT.html.
+
+#pragma once
+
+#include <stdint.h>
+
+#include "core.h"
+
+struct pool;
+
+struct pool *pool_create(uint32_t max);
+void pool_destroy(struct pool **pool);
+struct core *pool_acquire(struct pool *ctx, const char *path);
+void pool_release(struct pool *ctx, struct core **core);
+void pool_prewarm(struct pool *ctx, const char *path);
@@ -0,0 +1,379 @@
+// Copyright (c) Christopher D. Dickson <cdd@matoya.group>
+//
+// This Source Code Form is subject to the terms of the MIT License.
+// If a copy of the MIT License was not distributed with this file,
+// You can obtain one at https://spdx.org/licenses/MIT.html.
+
+#include "rewind.h"
+
+#include <string.h>
+
+#include "matoya.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define REWIND_SSE2
+	#include <emmintrin.h>
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	#define REWIND_NEON
+	#include <arm_neon.h>
+#endif
+
+#define REWIND_ALIGN       64
+#define REWIND_ENTRIES_MAX 0x4000
+
+struct rewind_entry {
+	size_t offset;
+	size_t size;
+};
+
+struct rewind {
+	uint8_t *buf;
+	size_t budget;
+	size_t used;
+
+	// The most recent snapshot, every entry in the ring is the XOR delta that
+	// steps this snapshot back by one capture
+	uint8_t *cur;
+	uint8_t *delta;
+	uint8_t *cmp;
+	size_t size;
+	size_t padded;
+
+	struct rewind_entry entries[REWIND_ENTRIES_MAX];
+	uint32_t first;
+	uint32_t count;
+};
+
+
+// Delta
+
+static void rewind_delta(uint8_t *delta, uint8_t *cur, const uint8_t *state, size_t size)
+{
+	size_t x = 0;
+
+	// Produces state ^ cur and replaces cur with state in the same pass
+
+	#if defined(REWIND_SSE2)
+	for (; x + 64 <= size; x += 64) {
+		__m128i s0 = _mm_loadu_si128((const __m128i *) (state + x));
+		__m128i s1 = _mm_loadu_si128((const __m128i *) (state + x + 16));
+		__m128i s2 = _mm_loadu_si128((const __m128i *) (state + x + 32));
+		__m128i s3 = _mm_loadu_si128((const __m128i *) (state + x + 48));
+
+		__m128i *c = (__m128i *) (cur + x);
+		__m128i *d = (__m128i *) (delta + x);
+
+		_mm_store_si128(d, _mm_xor_si128(s0, _mm_load_si128(c)));
+		_mm_store_si128(d + 1, _mm_xor_si128(s1, _mm_load_si128(c + 1)));
+		_mm_store_si128(d + 2, _mm_xor_si128(s2, _mm_load_si128(c + 2)));
+		_mm_store_si128(d + 3, _mm_xor_si128(s3, _mm_load_si128(c + 3)));
+
+		_mm_store_si128(c, s0);
+		_mm_store_si128(c + 1, s1);
+		_mm_store_si128(c + 2, s2);
+		_mm_store_si128(c + 3, s3);
+	}
+
+	#elif defined(REWIND_NEON)
+	for (; x + 64 <= size; x += 64) {
+		for (uint32_t y = 0; y < 64; y += 16) {
+			uint8x16_t s = vld1q_u8(state + x + y);
+
+			vst1q_u8(delta + x + y, veorq_u8(s, vld1q_u8(cur + x + y)));
+			vst1q_u8(cur + x + y, s);
+		}
+	}
+	#endif
+
+	for (; x < size; x++) {
+		delta[x] = state[x] ^ cur[x];
+		cur[x] = state[x];
+	}
+}
+
+
+// Zero run-length encoding over 64-bit words, deltas between nearby frames are
+// overwhelmingly zero so this gets most of the benefit of a general purpose
+// compressor at a fraction of the cost
+
+static size_t rewind_put_varint(uint8_t *out, size_t v)
+{
+	size_t n = 0;
+
+	for (; v >= 0x80; v >>= 7)
+		out[n++] = (uint8_t) (v | 0x80);
+
+	out[n++] = (uint8_t) v;
+
+	return n;
+}
+
+// Returns 0 if the varint runs past the end of the input or overflows
+static size_t rewind_get_varint(const uint8_t *in, size_t size, size_t *v)
+{
+	size_t n = 0;
+	*v = 0;
+
+	for (uint32_t shift = 0; shift < sizeof(size_t) * 8; shift += 7) {
+		if (n >= size)
+			return 0;
+
+		uint8_t b = in[n++];
+		*v |= (size_t) (b & 0x7F) << shift;
+
+		if (!(b & 0x80))
+			return n;
+	}
+
+	return 0;
+}
+
+static size_t rewind_compress(const uint64_t *in, size_t n, uint8_t *out)
+{
+	size_t o = 0;
+
+	for (size_t x = 0; x < n;) {
+		size_t zeros = 0;
+		while (x + zeros < n && in[x + zeros] == 0)
+			zeros++;
+
+		x += zeros;
+
+		// Literal runs end at two consecutive zero words, a single zero word
+		// is cheaper to keep inline than to start a new run
+		size_t lits = 0;
+		while (x + lits < n && (in[x + lits] != 0 || (x + lits + 1 < n && in[x + lits + 1] != 0)))
+			lits++;
+
+		o += rewind_put_varint(out + o, zeros);
+		o += rewind_put_varint(out + o, lits);
+
+		memcpy(out + o, in + x, lits * sizeof(uint64_t));
+		o += lits * sizeof(uint64_t);
+		x += lits;
+	}
+
+	return o;
+}
+
+static bool rewind_apply(uint64_t *cur, size_t words, const uint8_t *in, size_t size)
+{
+	for (size_t o = 0, x = 0; o < size;) {
+		size_t zeros = 0;
+		size_t lits = 0;
+
+		size_t n = rewind_get_varint(in + o, size - o, &zeros);
+		if (n == 0)
+			return false;
+
+		o += n;
+
+		n = rewind_get_varint(in + o, size - o, &lits);
+		if (n == 0)
+			return false;
+
+		o += n;
+
+		// Runs must stay inside both the snapshot and the entry
+		if (zeros > words - x || lits > words - x - zeros || lits > (size - o) / sizeof(uint64_t))
+			return false;
+
+		x += zeros;
+
+		for (size_t y = 0; y < lits; y++, x++, o += sizeof(uint64_t)) {
+			uint64_t v = 0;
+			memcpy(&v, in + o, sizeof(uint64_t));
+
+			cur[x] ^= v;
+		}
+	}
+
+	return true;
+}
+
+
+// Ring
+
+static struct rewind_entry *rewind_newest(struct rewind *ctx)
+{
+	return &ctx->entries[(ctx->first + ctx->count - 1) % REWIND_ENTRIES_MAX];
+}
+
+static void rewind_evict(struct rewind *ctx)
+{
+	ctx->used -= ctx->entries[ctx->first].size;
+	ctx->first = (ctx->first + 1) % REWIND_ENTRIES_MAX;
+	ctx->count--;
+}
+
+static bool rewind_overlaps(const struct rewind_entry *e, size_t offset, size_t size)
+{
+	return e->offset < offset + size && offset < e->offset + e->size;
+}
+
+static void rewind_store(struct rewind *ctx, const uint8_t *data, size_t size)
+{
+	// A delta larger than the whole budget breaks the chain
+	if (size > ctx->budget) {
+		ctx->first = ctx->count = 0;
+		ctx->used = 0;
+		return;
+	}
+
+	if (ctx->count == REWIND_ENTRIES_MAX)
+		rewind_evict(ctx);
+
+	size_t offset = 0;
+
+	if (ctx->count > 0) {
+		const struct rewind_entry *newest = rewind_newest(ctx);
+		size_t end = newest->offset + newest->size;
+
+		offset = end;
+
+		// Wrapping, whatever is left past the newest entry is the tail of the
+		// previous lap and older than anything at the front
+		if (offset + size > ctx->budget) {
+			while (ctx->count > 0 && ctx->entries[ctx->first].offset >= end)
+				rewind_evict(ctx);
+
+			offset = 0;
+		}
+	}
+
+	// Entries are laid out in age order around the ring, so anything in the way
+	// of the new entry is always the oldest
+	while (ctx->count > 0 && rewind_overlaps(&ctx->entries[ctx->first], offset, size))
+		rewind_evict(ctx);
+
+	memcpy(ctx->buf + offset, data, size);
+
+	ctx->count++;
+
+	struct rewind_entry *e = rewind_newest(ctx);
+	e->offset = offset;
+	e->size = size;
+
+	ctx->used += size;
+}
+
+
+// Public
+
+struct rewind *rewind_create(size_t budget)
+{
+	struct rewind *ctx = MTY_Alloc(1, sizeof(struct rewind));
+
+	ctx->budget = budget;
+	ctx->buf = MTY_Alloc(budget, 1);
+
+	return ctx;
+}
+
+static void rewind_free_buffers(struct rewind *ctx)
+{
+	MTY_FreeAligned(ctx->cur);
+	MTY_FreeAligned(ctx->delta);
+	MTY_Free(ctx->cmp);
+
+	ctx->cur = NULL;
+	ctx->delta = NULL;
+	ctx->cmp = NULL;
+	ctx->size = 0;
+	ctx->padded = 0;
+}
+
+void rewind_destroy(struct rewind **rewind)
+{
+	if (!rewind || !*rewind)
+		return;
+
+	struct rewind *ctx = *rewind;
+
+	rewind_free_buffers(ctx);
+	MTY_Free(ctx->buf);
+
+	MTY_Free(ctx);
+	*rewind = NULL;
+}
+
+void rewind_push(struct rewind *ctx, const void *state, size_t size)
+{
+	if (!ctx || !state || size == 0)
+		return;
+
+	// First capture or the state size changed, start a new chain
+	if (size != ctx->size) {
+		rewind_reset(ctx);
+		rewind_free_buffers(ctx);
+
+		ctx->size = size;
+		ctx->padded = (size + REWIND_ALIGN - 1) & ~((size_t) REWIND_ALIGN - 1);
+
+		ctx->cur = MTY_AllocAligned(ctx->padded, REWIND_ALIGN);
+		ctx->delta = MTY_AllocAligned(ctx->padded, REWIND_ALIGN);
+		ctx->cmp = MTY_Alloc(ctx->padded + ctx->padded / 8 + 64, 1);
+
+		memset(ctx->cur, 0, ctx->padded);
+		memset(ctx->delta, 0, ctx->padded);
+		memcpy(ctx->cur, state, size);
+		return;
+	}
+
+	rewind_delta(ctx->delta, ctx->cur, state, size);
+
+	size_t csize = rewind_compress((const uint64_t *) ctx->delta, ctx->padded / sizeof(uint64_t), ctx->cmp);
+	rewind_store(ctx, ctx->cmp, csize);
+}
+
+const void *rewind_pop(struct rewind *ctx, size_t *size)
+{
+	if (!ctx || ctx->size == 0)
+		return NULL;
+
+	// Step back one capture, the oldest snapshot is returned repeatedly once
+	// the ring runs dry
+	if (ctx->count > 0) {
+		const struct rewind_entry *newest = rewind_newest(ctx);
+
+		// A bad entry leaves the snapshot half stepped, nothing in the chain can
+		// be trusted after that
+		size_t words = ctx->padded / sizeof(uint64_t);
+
+		if (!rewind_apply((uint64_t *) ctx->cur, words, ctx->buf + newest->offset, newest->size)) {
+			rewind_reset(ctx);
+			return NULL;
+		}
+
+		ctx->used -= newest->size;
+		ctx->count--;
+	}
+
+	*size = ctx->size;
+
+	return ctx->cur;
+}
+
+void rewind_reset(struct rewind *ctx)
+{
+	if (!ctx)
+		return;
+
+	ctx->first = ctx->count = 0;
+	ctx->used = 0;
+	ctx->size = 0;
+}
+
+void rewind_get_stats(struct rewind *ctx, struct rewind_stats *stats)
+{
+	memset(stats, 0, sizeof(struct rewind_stats));
+
+	if (!ctx)
+		return;
+
+	stats->used = ctx->used;
+	stats->budget = ctx->budget;
+	stats->raw = (size_t) ctx->count * ctx->size;
+	stats->states = ctx->count;
+}
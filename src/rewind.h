@@ -0,0 +1,26 @@
+// Copyright (c) Christopher D. Dickson <cdd@matoya.group>
+//
+// This Source Code Form is subject to the terms of the MIT License.
+// If a copy of the MIT License was not distributed with this file,
+// You can obtain one at https://spdx.org/licenses/MIT.html.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct rewind;
+
+struct rewind_stats {
+	size_t used;
+	size_t budget;
+	size_t raw;
+	uint32_t states;
+};
+
+struct rewind *rewind_create(size_t budget);
+void rewind_destroy(struct rewind **rewind);
+void rewind_push(struct rewind *ctx, const void *state, size_t size);
+const void *rewind_pop(struct rewind *ctx, size_t *size);
+void rewind_reset(struct rewind *ctx);
+void rewind_get_stats(struct rewind *ctx, struct rewind_stats *stats);
@@ -0,0 +1,604 @@
+// Copyright (c) Christopher D. Dickson <cdd@matoya.group>
+//
+// This Source Code Form is subject to the terms of the MIT License.
+// If a copy of the MIT License was not distributed with this file,
+// You can obtain one at https://spdx.org/licenses/MIT.html.
+
+#include "search.h"
+
+#include <string.h>
+
+#include "matoya.h"
+#include "deps/libretro.h"
+#include "perf.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+	#define SEARCH_X86
+	#include <immintrin.h>
+
+	#if defined(_MSC_VER)
+		#define SEARCH_TARGET_AVX2
+	#else
+		#define SEARCH_TARGET_AVX2 __attribute__((target("avx2")))
+	#endif
+
+#elif defined(__aarch64__) || defined(_M_ARM64)
+	#define SEARCH_NEON
+	#include <arm_neon.h>
+#endif
+
+// Candidates are kept as one bit per byte of memory so SIMD compare masks can
+// be ANDed in directly regardless of value size, only bits at offsets aligned
+// to the value size are ever set
+#define SEARCH_BLOCK 32
+
+typedef uint32_t (*SEARCH_MASK_FUNC)(const uint8_t *cur, const uint8_t *ref,
+	enum search_size size, enum search_cmp cmp);
+
+struct search_region {
+	uint8_t *ptr;
+	size_t size;
+	uint64_t start;
+	uint8_t *prev;
+	uint32_t *cand;
+	size_t blocks;
+};
+
+struct search_freeze {
+	uint8_t *ptr;
+	uint64_t address;
+	enum search_size size;
+	uint32_t value;
+};
+
+struct search {
+	SEARCH_MASK_FUNC mask;
+	enum search_size size;
+	uint64_t count;
+	bool active;
+
+	struct search_region regions[SEARCH_REGIONS_MAX];
+	uint32_t num_regions;
+
+	struct search_freeze freezes[SEARCH_FREEZES_MAX];
+	uint32_t num_freezes;
+
+	bool live;
+	enum search_cmp live_cmp;
+	bool live_prev;
+	uint32_t live_value;
+};
+
+
+// Scalar
+
+static uint32_t search_read(const uint8_t *p, enum search_size size)
+{
+	switch (size) {
+		case SEARCH_SIZE_8:
+			return *p;
+		case SEARCH_SIZE_16: {
+			uint16_t v = 0;
+			memcpy(&v, p, sizeof(uint16_t));
+			return v;
+		}
+		case SEARCH_SIZE_32: {
+			uint32_t v = 0;
+			memcpy(&v, p, sizeof(uint32_t));
+			return v;
+		}
+	}
+
+	return 0;
+}
+
+static void search_write(uint8_t *p, enum search_size size, uint32_t value)
+{
+	switch (size) {
+		case SEARCH_SIZE_8:
+			*p = (uint8_t) value;
+			break;
+		case SEARCH_SIZE_16: {
+			uint16_t v = (uint16_t) value;
+			memcpy(p, &v, sizeof(uint16_t));
+			break;
+		}
+		case SEARCH_SIZE_32:
+			memcpy(p, &value, sizeof(uint32_t));
+			break;
+	}
+}
+
+static bool search_cmp_scalar(uint32_t a, uint32_t b, enum search_cmp cmp)
+{
+	switch (cmp) {
+		case SEARCH_CMP_EQUAL:     return a == b;
+		case SEARCH_CMP_NOT_EQUAL: return a != b;
+		case SEARCH_CMP_GREATER:   return a > b;
+		case SEARCH_CMP_LESS:      return a < b;
+	}
+
+	return false;
+}
+
+static uint32_t search_mask_n(const uint8_t *cur, const uint8_t *ref, size_t n,
+	enum search_size size, enum search_cmp cmp)
+{
+	uint32_t mask = 0;
+
+	for (size_t x = 0; x + size <= n; x += size)
+		if (search_cmp_scalar(search_read(cur + x, size), search_read(ref + x, size), cmp))
+			mask |= 1u << x;
+
+	return mask;
+}
+
+static uint32_t search_mask_scalar(const uint8_t *cur, const uint8_t *ref,
+	enum search_size size, enum search_cmp cmp)
+{
+	return search_mask_n(cur, ref, SEARCH_BLOCK, size, cmp);
+}
+
+
+// SIMD, all compares are unsigned
+
+#if defined(SEARCH_X86)
+
+static uint32_t search_mask_sse2_16(__m128i a, __m128i b, enum search_size size, enum search_cmp cmp)
+{
+	__m128i r;
+
+	if (cmp == SEARCH_CMP_EQUAL || cmp == SEARCH_CMP_NOT_EQUAL) {
+		r = size == SEARCH_SIZE_8 ? _mm_cmpeq_epi8(a, b) :
+			size == SEARCH_SIZE_16 ? _mm_cmpeq_epi16(a, b) : _mm_cmpeq_epi32(a, b);
+
+		uint32_t mask = (uint32_t) _mm_movemask_epi8(r);
+
+		return cmp == SEARCH_CMP_NOT_EQUAL ? ~mask & 0xFFFF : mask;
+	}
+
+	// Flipping the sign bit turns the signed compare into an unsigned one
+	__m128i bias = size == SEARCH_SIZE_8 ? _mm_set1_epi8((char) 0x80) :
+		size == SEARCH_SIZE_16 ? _mm_set1_epi16((short) 0x8000) : _mm_set1_epi32((int) 0x80000000);
+
+	a = _mm_xor_si128(a, bias);
+	b = _mm_xor_si128(b, bias);
+
+	if (cmp == SEARCH_CMP_LESS) {
+		__m128i t = a;
+		a = b;
+		b = t;
+	}
+
+	r = size == SEARCH_SIZE_8 ? _mm_cmpgt_epi8(a, b) :
+		size == SEARCH_SIZE_16 ? _mm_cmpgt_epi16(a, b) : _mm_cmpgt_epi32(a, b);
+
+	return (uint32_t) _mm_movemask_epi8(r);
+}
+
+static uint32_t search_mask_sse2(const uint8_t *cur, const uint8_t *ref,
+	enum search_size size, enum search_cmp cmp)
+{
+	__m128i a0 = _mm_loadu_si128((const __m128i *) cur);
+	__m128i a1 = _mm_loadu_si128((const __m128i *) (cur + 16));
+	__m128i b0 = _mm_loadu_si128((const __m128i *) ref);
+	__m128i b1 = _mm_loadu_si128((const __m128i *) (ref + 16));
+
+	return search_mask_sse2_16(a0, b0, size, cmp) | search_mask_sse2_16(a1, b1, size, cmp) << 16;
+}
+
+SEARCH_TARGET_AVX2
+static uint32_t search_mask_avx2(const uint8_t *cur, const uint8_t *ref,
+	enum search_size size, enum search_cmp cmp)
+{
+	__m256i a = _mm256_loadu_si256((const __m256i *) cur);
+	__m256i b = _mm256_loadu_si256((const __m256i *) ref);
+	__m256i r;
+
+	if (cmp == SEARCH_CMP_EQUAL || cmp == SEARCH_CMP_NOT_EQUAL) {
+		r = size == SEARCH_SIZE_8 ? _mm256_cmpeq_epi8(a, b) :
+			size == SEARCH_SIZE_16 ? _mm256_cmpeq_epi16(a, b) : _mm256_cmpeq_epi32(a, b);
+
+		uint32_t mask = (uint32_t) _mm256_movemask_epi8(r);
+
+		return cmp == SEARCH_CMP_NOT_EQUAL ? ~mask : mask;
+	}
+
+	__m256i bias = size == SEARCH_SIZE_8 ? _mm256_set1_epi8((char) 0x80) :
+		size == SEARCH_SIZE_16 ? _mm256_set1_epi16((short) 0x8000) : _mm256_set1_epi32((int) 0x80000000);
+
+	a = _mm256_xor_si256(a, bias);
+	b = _mm256_xor_si256(b, bias);
+
+	if (cmp == SEARCH_CMP_LESS) {
+		__m256i t = a;
+		a = b;
+		b = t;
+	}
+
+	r = size == SEARCH_SIZE_8 ? _mm256_cmpgt_epi8(a, b) :
+		size == SEARCH_SIZE_16 ? _mm256_cmpgt_epi16(a, b) : _mm256_cmpgt_epi32(a, b);
+
+	return (uint32_t) _mm256_movemask_epi8(r);
+}
+
+#elif defined(SEARCH_NEON)
+
+static const uint8_t SEARCH_NEON_BITS[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+
+static uint32_t search_mask_neon_16(const uint8_t *cur, const uint8_t *ref,
+	enum search_size size, enum search_cmp cmp)
+{
+	uint8x16_t a = vld1q_u8(cur);
+	uint8x16_t b = vld1q_u8(ref);
+
+	if (cmp == SEARCH_CMP_LESS) {
+		uint8x16_t t = a;
+		a = b;
+		b = t;
+	}
+
+	bool eq = cmp == SEARCH_CMP_EQUAL || cmp == SEARCH_CMP_NOT_EQUAL;
+	uint8x16_t r;
+
+	if (size == SEARCH_SIZE_8) {
+		r = eq ? vceqq_u8(a, b) : vcgtq_u8(a, b);
+
+	} else if (size == SEARCH_SIZE_16) {
+		uint16x8_t a16 = vreinterpretq_u16_u8(a);
+		uint16x8_t b16 = vreinterpretq_u16_u8(b);
+		r = vreinterpretq_u8_u16(eq ? vceqq_u16(a16, b16) : vcgtq_u16(a16, b16));
+
+	} else {
+		uint32x4_t a32 = vreinterpretq_u32_u8(a);
+		uint32x4_t b32 = vreinterpretq_u32_u8(b);
+		r = vreinterpretq_u8_u32(eq ? vceqq_u32(a32, b32) : vcgtq_u32(a32, b32));
+	}
+
+	// No movemask on NEON, weight each lane by its bit and sum the halves
+	uint8x16_t m = vandq_u8(r, vld1q_u8(SEARCH_NEON_BITS));
+	uint32_t mask = vaddv_u8(vget_low_u8(m)) | (uint32_t) vaddv_u8(vget_high_u8(m)) << 8;
+
+	return cmp == SEARCH_CMP_NOT_EQUAL ? ~mask & 0xFFFF : mask;
+}
+
+static uint32_t search_mask_neon(const uint8_t *cur, const uint8_t *ref,
+	enum search_size size, enum search_cmp cmp)
+{
+	return search_mask_neon_16(cur, ref, size, cmp) | search_mask_neon_16(cur + 16, ref + 16, size, cmp) << 16;
+}
+
+#endif
+
+
+// Candidates
+
+static uint32_t search_popcount(uint32_t v)
+{
+	v = v - ((v >> 1) & 0x55555555);
+	v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+
+	return (((v + (v >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+}
+
+static uint32_t search_block_pattern(enum search_size size)
+{
+	return size == SEARCH_SIZE_8 ? 0xFFFFFFFF : size == SEARCH_SIZE_16 ? 0x55555555 : 0x11111111;
+}
+
+static uint64_t search_filter_region(struct search *ctx, struct search_region *r, const uint8_t *value,
+	enum search_cmp cmp, bool prev)
+{
+	uint64_t count = 0;
+	size_t full = r->size / SEARCH_BLOCK;
+
+	for (size_t x = 0; x < r->blocks; x++) {
+		uint32_t *cand = &r->cand[x];
+
+		// Blocks with no candidates left are never touched again
+		if (*cand == 0)
+			continue;
+
+		size_t offset = x * SEARCH_BLOCK;
+		const uint8_t *cur = r->ptr + offset;
+		const uint8_t *ref = prev ? r->prev + offset : value;
+
+		if (x < full) {
+			*cand &= ctx->mask(cur, ref, ctx->size, cmp);
+			memcpy(r->prev + offset, cur, SEARCH_BLOCK);
+
+		} else {
+			size_t n = r->size - offset;
+			*cand &= search_mask_n(cur, ref, n, ctx->size, cmp);
+			memcpy(r->prev + offset, cur, n);
+		}
+
+		count += search_popcount(*cand);
+	}
+
+	return count;
+}
+
+
+// Public
+
+struct search *search_create(void)
+{
+	struct search *ctx = MTY_Alloc(1, sizeof(struct search));
+
+	ctx->mask = search_mask_scalar;
+
+	#if defined(SEARCH_X86)
+	ctx->mask = (perf_get_cpu_features() & RETRO_SIMD_AVX2) ? search_mask_avx2 : search_mask_sse2;
+
+	#elif defined(SEARCH_NEON)
+	ctx->mask = search_mask_neon;
+	#endif
+
+	return ctx;
+}
+
+static void search_free_candidates(struct search *ctx)
+{
+	for (uint32_t x = 0; x < ctx->num_regions; x++) {
+		struct search_region *r = &ctx->regions[x];
+
+		MTY_Free(r->prev);
+		MTY_Free(r->cand);
+
+		r->prev = NULL;
+		r->cand = NULL;
+		r->blocks = 0;
+	}
+
+	ctx->active = false;
+	ctx->live = false;
+	ctx->count = 0;
+}
+
+void search_destroy(struct search **search)
+{
+	if (!search || !*search)
+		return;
+
+	struct search *ctx = *search;
+
+	search_clear(ctx);
+
+	MTY_Free(ctx);
+	*search = NULL;
+}
+
+void search_clear(struct search *ctx)
+{
+	if (!ctx)
+		return;
+
+	search_free_candidates(ctx);
+
+	ctx->num_regions = 0;
+	ctx->num_freezes = 0;
+}
+
+void search_add_region(struct search *ctx, void *ptr, size_t size, uint64_t start)
+{
+	if (!ctx || !ptr || size == 0 || ctx->num_regions == SEARCH_REGIONS_MAX)
+		return;
+
+	struct search_region *r = &ctx->regions[ctx->num_regions++];
+	memset(r, 0, sizeof(struct search_region));
+
+	r->ptr = ptr;
+	r->size = size;
+	r->start = start;
+}
+
+void search_start(struct search *ctx, enum search_size size)
+{
+	if (!ctx)
+		return;
+
+	search_free_candidates(ctx);
+
+	ctx->size = size;
+	ctx->active = true;
+
+	uint32_t pattern = search_block_pattern(size);
+
+	for (uint32_t x = 0; x < ctx->num_regions; x++) {
+		struct search_region *r = &ctx->regions[x];
+
+		r->blocks = (r->size + SEARCH_BLOCK - 1) / SEARCH_BLOCK;
+		r->prev = MTY_Alloc(r->size, 1);
+		r->cand = MTY_Alloc(r->blocks, sizeof(uint32_t));
+
+		memcpy(r->prev, r->ptr, r->size);
+
+		for (size_t y = 0; y < r->blocks; y++)
+			r->cand[y] = pattern;
+
+		// Values must fit entirely inside the region
+		size_t tail = r->size % SEARCH_BLOCK;
+
+		if (tail > 0) {
+			uint32_t *last = &r->cand[r->blocks - 1];
+
+			for (size_t y = 0; y < SEARCH_BLOCK; y++)
+				if (y + size > tail)
+					*last &= ~(1u << y);
+		}
+
+		for (size_t y = 0; y < r->blocks; y++)
+			ctx->count += search_popcount(r->cand[y]);
+	}
+}
+
+uint64_t search_filter(struct search *ctx, enum search_cmp cmp, bool prev, uint32_t value)
+{
+	if (!ctx || !ctx->active)
+		return 0;
+
+	// Comparing against a value uses the same kernels with a block of the
+	// value repeated in place of the previous snapshot
+	uint8_t ref[SEARCH_BLOCK];
+
+	for (uint32_t x = 0; x < SEARCH_BLOCK; x += ctx->size)
+		search_write(ref + x, ctx->size, value);
+
+	ctx->count = 0;
+
+	for (uint32_t x = 0; x < ctx->num_regions; x++)
+		ctx->count += search_filter_region(ctx, &ctx->regions[x], ref, cmp, prev);
+
+	return ctx->count;
+}
+
+void search_set_live(struct search *ctx, bool enabled, enum search_cmp cmp, bool prev, uint32_t value)
+{
+	if (!ctx)
+		return;
+
+	ctx->live = enabled;
+	ctx->live_cmp = cmp;
+	ctx->live_prev = prev;
+	ctx->live_value = value;
+}
+
+bool search_is_live(struct search *ctx)
+{
+	return ctx && ctx->live;
+}
+
+void search_update(struct search *ctx)
+{
+	if (!ctx || !ctx->active || !ctx->live)
+		return;
+
+	search_filter(ctx, ctx->live_cmp, ctx->live_prev, ctx->live_value);
+}
+
+bool search_is_active(struct search *ctx)
+{
+	return ctx && ctx->active;
+}
+
+enum search_size search_get_size(struct search *ctx)
+{
+	return ctx ? ctx->size : SEARCH_SIZE_8;
+}
+
+uint64_t search_get_count(struct search *ctx)
+{
+	return ctx ? ctx->count : 0;
+}
+
+uint32_t search_get_results(struct search *ctx, struct search_result *results, uint32_t max)
+{
+	if (!ctx || !ctx->active)
+		return 0;
+
+	uint32_t n = 0;
+
+	for (uint32_t x = 0; x < ctx->num_regions; x++) {
+		const struct search_region *r = &ctx->regions[x];
+
+		for (size_t y = 0; y < r->blocks; y++) {
+			uint32_t cand = r->cand[y];
+
+			for (uint32_t z = 0; cand != 0; z++, cand >>= 1) {
+				if (!(cand & 1))
+					continue;
+
+				if (n == max)
+					return n;
+
+				size_t offset = y * SEARCH_BLOCK + z;
+
+				results[n].address = r->start + offset;
+				results[n].value = search_read(r->ptr + offset, ctx->size);
+				results[n].prev = search_read(r->prev + offset, ctx->size);
+				n++;
+			}
+		}
+	}
+
+	return n;
+}
+
+
+// Freeze
+
+bool search_freeze(struct search *ctx, uint64_t address, enum search_size size, uint32_t value)
+{
+	if (!ctx)
+		return false;
+
+	uint8_t *ptr = NULL;
+
+	for (uint32_t x = 0; x < ctx->num_regions && !ptr; x++) {
+		const struct search_region *r = &ctx->regions[x];
+
+		if (address >= r->start && address + size <= r->start + r->size)
+			ptr = r->ptr + (address - r->start);
+	}
+
+	if (!ptr)
+		return false;
+
+	search_unfreeze(ctx, address);
+
+	if (ctx->num_freezes == SEARCH_FREEZES_MAX)
+		return false;
+
+	struct search_freeze *f = &ctx->freezes[ctx->num_freezes++];
+	f->ptr = ptr;
+	f->address = address;
+	f->size = size;
+	f->value = value;
+
+	return true;
+}
+
+void search_unfreeze(struct search *ctx, uint64_t address)
+{
+	if (!ctx)
+		return;
+
+	for (uint32_t x = 0; x < ctx->num_freezes; x++) {
+		if (ctx->freezes[x].address == address) {
+			ctx->freezes[x] = ctx->freezes[--ctx->num_freezes];
+			break;
+		}
+	}
+}
+
+void search_unfreeze_all(struct search *ctx)
+{
+	if (!ctx)
+		return;
+
+	ctx->num_freezes = 0;
+}
+
+bool search_is_frozen(struct search *ctx, uint64_t address)
+{
+	if (!ctx)
+		return false;
+
+	for (uint32_t x = 0; x < ctx->num_freezes; x++)
+		if (ctx->freezes[x].address == address)
+			return true;
+
+	return false;
+}
+
+void search_apply_freezes(struct search *ctx)
+{
+	if (!ctx)
+		return;
+
+	for (uint32_t x = 0; x < ctx->num_freezes; x++) {
+		const struct search_freeze *f = &ctx->freezes[x];
+		search_write(f->ptr, f->size, f->value);
+	}
+}
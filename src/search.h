@@ -0,0 +1,54 @@
+// Copyright (c) Christopher D. Dickson <cdd@matoya.group>
+//
+// This Source Code Form is subject to the terms of the MIT License.
+// If a copy of the MIT License was not distributed with this file,
+// You can obtain one at https://spdx.org/licenses/MIT.html.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define SEARCH_REGIONS_MAX 32
+#define SEARCH_FREEZES_MAX 64
+
+enum search_size {
+	SEARCH_SIZE_8  = 1,
+	SEARCH_SIZE_16 = 2,
+	SEARCH_SIZE_32 = 4,
+};
+
+enum search_cmp {
+	SEARCH_CMP_EQUAL     = 0,
+	SEARCH_CMP_NOT_EQUAL = 1,
+	SEARCH_CMP_GREATER   = 2,
+	SEARCH_CMP_LESS      = 3,
+};
+
+struct search_result {
+	uint64_t address;
+	uint32_t value;
+	uint32_t prev;
+};
+
+struct search;
+
+struct search *search_create(void);
+void search_destroy(struct search **search);
+void search_clear(struct search *ctx);
+void search_add_region(struct search *ctx, void *ptr, size_t size, uint64_t start);
+void search_start(struct search *ctx, enum search_size size);
+uint64_t search_filter(struct search *ctx, enum search_cmp cmp, bool prev, uint32_t value);
+void search_set_live(struct search *ctx, bool enabled, enum search_cmp cmp, bool prev, uint32_t value);
+bool search_is_live(struct search *ctx);
+void search_update(struct search *ctx);
+bool search_is_active(struct search *ctx);
+enum search_size search_get_size(struct search *ctx);
+uint64_t search_get_count(struct search *ctx);
+uint32_t search_get_results(struct search *ctx, struct search_result *results, uint32_t max);
+bool search_freeze(struct search *ctx, uint64_t address, enum search_size size, uint32_t value);
+void search_unfreeze(struct search *ctx, uint64_t address);
+void search_unfreeze_all(struct search *ctx);
+bool search_is_frozen(struct search *ctx, uint64_t address);
+void search_apply_freezes(struct search *ctx);
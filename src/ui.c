@@ -40,19 +40,43 @@ static struct component_state {
 	int64_t ts;
 	int32_t timeout;
 	char *msg;
+
+	uint32_t search_value;
 } CMP;
 
+// Messages and menu closes come from the emulation thread while the UI is
+// being built on the render thread
+static MTY_Atomic32 UI_MSG_LOCK;
+static MTY_Atomic32 UI_CLOSE_MENU;
+
+static void ui_lock(void)
+{
+	while (!MTY_Atomic32CAS(&UI_MSG_LOCK, 0, 1))
+		MTY_Sleep(0);
+}
+
+static void ui_unlock(void)
+{
+	MTY_Atomic32Set(&UI_MSG_LOCK, 0);
+}
+
 void ui_set_message(const char *msg, int32_t timeout)
 {
+	ui_lock();
+
 	free(CMP.msg);
 	CMP.msg = MTY_Strdup(msg);
 
 	CMP.ts = MTY_GetTime();
 	CMP.timeout = timeout;
+
+	ui_unlock();
 }
 
 static void ui_message(void)
 {
+	ui_lock();
+
 	if (CMP.ts != 0 && MTY_TimeDiff(CMP.ts, MTY_GetTime()) < CMP.timeout) {
 		im_push_color(ImGuiCol_WindowBg, COLOR_MSG_BG);
 
@@ -67,6 +91,8 @@ static void ui_message(void)
 
 		im_pop_color(1);
 	}
+
+	ui_unlock();
 }
 
 static void ui_open_rom(struct app_event *event)
@@ -123,51 +149,163 @@ static void ui_open_rom(struct app_event *event)
 	}
 }
 
-static void ui_save_state(struct core *core, const char *content_name, uint8_t index)
+static void ui_search_event(struct app_event *event, enum app_search_op op)
 {
-	size_t size = 0;
-	void *state = core_get_state(core, &size);
+	event->type = APP_EVENT_SEARCH;
+	event->rt = true;
+	event->search.op = op;
+}
 
-	if (state) {
-		const char *path = MTY_JoinPath(MTY_GetProcessDir(), "state");
-		MTY_Mkdir(path);
+static void ui_cheats(const struct ui_args *args, struct app_event *event)
+{
+	const struct ui_search *search = &args->search;
+
+	if (im_begin_menu("New Search", true)) {
+		const struct {
+			const char *name;
+			enum search_size size;
+		} sizes[] = {
+			{"8-bit",  SEARCH_SIZE_8},
+			{"16-bit", SEARCH_SIZE_16},
+			{"32-bit", SEARCH_SIZE_32},
+		};
+
+		for (uint32_t x = 0; x < sizeof(sizes) / sizeof(sizes[0]); x++) {
+			if (im_menu_item(sizes[x].name, "", false)) {
+				ui_search_event(event, APP_SEARCH_START);
+				event->search.size = sizes[x].size;
+			}
+		}
 
-		const char *name = MTY_SprintfDL("%s.state%u", content_name, index);
-		MTY_WriteFile(MTY_JoinPath(path, name), state, size);
+		im_end_menu();
+	}
 
-		ui_set_message(MTY_SprintfDL("State saved to slot %u", index), 3000);
+	if (im_menu_item("Unfreeze All", "", false))
+		ui_search_event(event, APP_SEARCH_UNFREEZE_ALL);
+
+	if (!search->active)
+		return;
+
+	// The first filters compare against the previous snapshot, the rest
+	// against the value entered below
+	const struct {
+		const char *name;
+		enum search_cmp cmp;
+		bool prev;
+	} filters[] = {
+		{"Changed",            SEARCH_CMP_NOT_EQUAL, true},
+		{"Unchanged",          SEARCH_CMP_EQUAL,     true},
+		{"Increased",          SEARCH_CMP_GREATER,   true},
+		{"Decreased",          SEARCH_CMP_LESS,      true},
+		{"Equal to Value",     SEARCH_CMP_EQUAL,     false},
+		{"Greater Than Value", SEARCH_CMP_GREATER,   false},
+		{"Less Than Value",    SEARCH_CMP_LESS,      false},
+	};
+
+	im_separator();
+
+	im_input_u32("Value", &CMP.search_value);
+
+	for (uint32_t x = 0; x < sizeof(filters) / sizeof(filters[0]); x++) {
+		if (im_menu_item(filters[x].name, "", false)) {
+			ui_search_event(event, APP_SEARCH_FILTER);
+			event->search.cmp = filters[x].cmp;
+			event->search.prev = filters[x].prev;
+			event->search.value = CMP.search_value;
+		}
+	}
+
+	if (im_begin_menu("Filter Every Frame", true)) {
+		for (uint32_t x = 0; x < sizeof(filters) / sizeof(filters[0]); x++) {
+			if (im_menu_item(filters[x].name, "", false)) {
+				ui_search_event(event, APP_SEARCH_LIVE);
+				event->search.enabled = true;
+				event->search.cmp = filters[x].cmp;
+				event->search.prev = filters[x].prev;
+				event->search.value = CMP.search_value;
+			}
+		}
+
+		im_separator();
+
+		if (im_menu_item("Stop", "", !search->live)) {
+			ui_search_event(event, APP_SEARCH_LIVE);
+			event->search.enabled = false;
+			event->search.cmp = SEARCH_CMP_EQUAL;
+			event->search.prev = true;
+		}
 
-		free(state);
+		im_end_menu();
+	}
+
+	im_separator();
+
+	im_text(MTY_SprintfDL("Candidates: %llu", (unsigned long long) search->count));
+
+	// Clicking a result freezes it at its current value
+	for (uint32_t x = 0; x < search->num_results; x++) {
+		const struct search_result *r = &search->results[x];
+		bool frozen = search->frozen[x];
+
+		const char *label = MTY_SprintfDL("%08llX: %u (%u)", (unsigned long long) r->address,
+			r->value, r->prev);
+
+		if (im_menu_item(label, "", frozen)) {
+			ui_search_event(event, frozen ? APP_SEARCH_UNFREEZE : APP_SEARCH_FREEZE);
+			event->search.address = r->address;
+			event->search.size = search->size;
+			event->search.value = r->value;
+		}
 	}
 }
 
-static void ui_load_state(struct core *core, const char *content_name, uint8_t index)
+static void ui_movie(const struct ui_args *args, struct app_event *event)
 {
-	const char *path = MTY_JoinPath(MTY_GetProcessDir(), "state");
-	MTY_Mkdir(path);
+	const struct ui_movie *movie = &args->movie;
 
-	const char *name = MTY_SprintfDL("%s.state%u", content_name, index);
+	if (!movie->active) {
+		if (im_menu_item("Record", "", false)) {
+			event->type = APP_EVENT_MOVIE_REC;
+			event->rt = true;
+		}
+
+		if (im_menu_item("Play", "", false)) {
+			event->type = APP_EVENT_MOVIE_PLAY;
+			event->rt = true;
+		}
 
-	size_t size = 0;
-	void *state = MTY_ReadFile(MTY_JoinPath(path, name), &size);
-	const char *msg = NULL;;
+	} else {
+		double fps = args->frame_rate;
+		uint64_t frame = movie->frame;
+		uint64_t length = movie->length;
 
-	if (state) {
-		if (core_set_state(core, state, size)) {
-			msg = MTY_SprintfDL("State loaded from slot %u", index);
+		if (movie->recording) {
+			im_text(MTY_SprintfDL("Recording: %.1f s", fps > 0 ? (double) length / fps : 0));
 
 		} else {
-			msg = MTY_SprintfDL("Error loading state from slot %u", index);
-		}
+			im_text(MTY_SprintfDL("Playing: %llu / %llu", (unsigned long long) frame,
+				(unsigned long long) length));
 
-		free(state);
+			int64_t step = (int64_t) (fps * 10.0);
 
-	} else {
-		msg = MTY_SprintfDL("State does not exist for slot %u", index);
-	}
+			if (im_menu_item("Back 10 s", "", false)) {
+				event->type = APP_EVENT_MOVIE_SEEK;
+				event->seek = -step;
+				event->rt = true;
+			}
+
+			if (im_menu_item("Forward 10 s", "", false)) {
+				event->type = APP_EVENT_MOVIE_SEEK;
+				event->seek = step;
+				event->rt = true;
+			}
+		}
 
-	if (msg)
-		ui_set_message(msg, 3000);
+		if (im_menu_item("Stop", "", false)) {
+			event->type = APP_EVENT_MOVIE_STOP;
+			event->rt = true;
+		}
+	}
 }
 
 static void ui_menu(const struct ui_args *args, struct app_event *event)
@@ -188,12 +326,13 @@ static void ui_menu(const struct ui_args *args, struct app_event *event)
 				event->type = APP_EVENT_PAUSE;
 
 			if (im_menu_item("Reset", "Ctrl+R", false)) {
-				core_reset_game(args->core);
+				event->type = APP_EVENT_RESET;
+				event->rt = true;
 			}
 
 			if (im_menu_item("Reload Game", "Ctrl+T", false)) {
-				const char *name = core_get_game_path(args->core);
-				if (name) {
+				const char *name = args->game_path;
+				if (name[0]) {
 					event->type = APP_EVENT_LOAD_GAME;
 					event->fetch_core = true;
 					event->rt = true;
@@ -210,8 +349,11 @@ static void ui_menu(const struct ui_args *args, struct app_event *event)
 					snprintf(label, 16, "Slot %u", x + 1);
 					snprintf(key, 8, "%u", x + 1);
 
-					if (im_menu_item(label, key, false))
-						ui_save_state(args->core, args->content_name, x + 1);
+					if (im_menu_item(label, key, false)) {
+						event->type = APP_EVENT_SAVE_STATE;
+						event->slot = x + 1;
+						event->rt = true;
+					}
 				}
 
 				im_end_menu();
@@ -224,8 +366,11 @@ static void ui_menu(const struct ui_args *args, struct app_event *event)
 					snprintf(label, 16, "Slot %u", x + 1);
 					snprintf(key, 8, "Ctrl+%u", x + 1);
 
-					if (im_menu_item(label, key, false))
-						ui_load_state(args->core, args->content_name, x + 1);
+					if (im_menu_item(label, key, false)) {
+						event->type = APP_EVENT_LOAD_STATE;
+						event->slot = x + 1;
+						event->rt = true;
+					}
 				}
 
 				im_end_menu();
@@ -233,10 +378,139 @@ static void ui_menu(const struct ui_args *args, struct app_event *event)
 
 			im_separator();
 
-			if (im_begin_menu("Reduce Latency", true)) {
-				for (uint32_t x = 0; x < 16; x++)
-					if (im_menu_item(MTY_SprintfDL("%u", x), "", args->cfg->reduce_latency == x))
+			if (im_begin_menu("Frame Delay", true)) {
+				if (im_menu_item("Auto", "", args->cfg->auto_delay))
+					event->cfg.auto_delay = true;
+
+				im_separator();
+
+				for (uint32_t x = 0; x < 16; x++) {
+					if (im_menu_item(MTY_SprintfDL("%u ms", x), "", !args->cfg->auto_delay && args->cfg->reduce_latency == x)) {
+						event->cfg.auto_delay = false;
 						event->cfg.reduce_latency = x;
+					}
+				}
+
+				im_end_menu();
+			}
+
+			if (im_menu_item("Latch Input on First Read", "", args->cfg->latch_on_read))
+				event->cfg.latch_on_read = !event->cfg.latch_on_read;
+
+			if (im_begin_menu("Run-Ahead", true)) {
+				for (uint32_t x = 0; x < 5; x++)
+					if (im_menu_item(MTY_SprintfDL("%u", x), "", args->cfg->run_ahead == x))
+						event->cfg.run_ahead = x;
+
+				im_separator();
+
+				if (im_menu_item("Second Instance", "", args->cfg->run_ahead_instance))
+					event->cfg.run_ahead_instance = !event->cfg.run_ahead_instance;
+
+				im_end_menu();
+			}
+
+			if (im_begin_menu("Fast-Forward", true)) {
+				const uint32_t ratios[] = {2, 3, 4, 8, 0};
+
+				for (uint32_t x = 0; x < sizeof(ratios) / sizeof(uint32_t); x++) {
+					const char *label = ratios[x] == 0 ? "Uncapped" : MTY_SprintfDL("%ux", ratios[x]);
+
+					if (im_menu_item(label, "", args->cfg->fast_forward == ratios[x]))
+						event->cfg.fast_forward = ratios[x];
+				}
+
+				im_separator();
+				im_text("Hold Tab to fast-forward");
+
+				im_end_menu();
+			}
+
+			if (im_begin_menu("Rewind", true)) {
+				const uint32_t budgets[] = {0, 16, 64, 256, 1024};
+
+				for (uint32_t x = 0; x < sizeof(budgets) / sizeof(uint32_t); x++) {
+					const char *label = budgets[x] == 0 ? "Off" : MTY_SprintfDL("%u MB", budgets[x]);
+
+					if (im_menu_item(label, "", args->cfg->rewind_budget == budgets[x]))
+						event->cfg.rewind_budget = budgets[x];
+				}
+
+				im_separator();
+
+				if (im_begin_menu("Interval", true)) {
+					for (uint32_t x = 1; x <= 8; x *= 2)
+						if (im_menu_item(MTY_SprintfDL("%u Frame%s", x, x > 1 ? "s" : ""), "", args->cfg->rewind_interval == x))
+							event->cfg.rewind_interval = x;
+
+					im_end_menu();
+				}
+
+				if (args->cfg->rewind_budget > 0) {
+					im_separator();
+					im_text("Hold Backspace to rewind");
+					im_text(MTY_SprintfDL("Capture: %.3f ms/frame", args->rewind_cost));
+					im_text(MTY_SprintfDL("Memory: %.1f / %u MB", (double) args->rewind.used / (1024.0 * 1024.0),
+						args->cfg->rewind_budget));
+					im_text(MTY_SprintfDL("States: %u (%.1f:1)", args->rewind.states,
+						args->rewind.used > 0 ? (double) args->rewind.raw / (double) args->rewind.used : 0.0));
+				}
+
+				im_end_menu();
+			}
+
+			if (im_begin_menu("Frame Pacing", true)) {
+				const struct pace_stats *pace = &args->pace;
+
+				if (im_menu_item("Variable Refresh Rate", "", args->cfg->vrr))
+					event->cfg.vrr = !event->cfg.vrr;
+
+				im_separator();
+
+				const char *mode = pace->mode == PACE_MODE_SYNC ? "Swap every %u refresh" :
+					pace->mode == PACE_MODE_REPEAT ? "Repeat frames" : "Variable refresh";
+
+				im_text(MTY_SprintfDL(mode, pace->interval));
+				im_text(MTY_SprintfDL("Core: %.3f Hz, display: %.3f Hz", pace->fps, pace->refresh));
+
+				if (pace->mode == PACE_MODE_SYNC) {
+					im_text(MTY_SprintfDL("Frame delay: %.1f ms%s", pace->delay, pace->auto_delay ? " (auto)" : ""));
+					im_text(MTY_SprintfDL("p99 frame: %.2f ms, present: %.2f ms", pace->exec_p99, pace->present_p99));
+				}
+
+				if (pace->presents > 0) {
+					im_separator();
+					im_text("Present error");
+
+					for (uint32_t x = 0; x < PACE_BINS; x++) {
+						float ms = ((int32_t) x - PACE_BINS / 2) * PACE_BIN_MS;
+						const char *edge = x == 0 ? "<" : x == PACE_BINS - 1 ? ">" : " ";
+
+						im_text(MTY_SprintfDL("%s%+.1f ms: %.1f%%", edge, ms,
+							(double) pace->histogram[x] * 100.0 / (double) pace->presents));
+					}
+				}
+
+				im_end_menu();
+			}
+
+			if (im_begin_menu("Input Lag", true)) {
+				const struct latency_stats *lag = &args->latency;
+
+				if (im_menu_item("Trace", "", args->cfg->lag_trace))
+					event->cfg.lag_trace = !event->cfg.lag_trace;
+
+				if (lag->responses > 0) {
+					im_separator();
+					im_text(MTY_SprintfDL("%.2f frames (%u-%u)", lag->frames, lag->frames_min, lag->frames_max));
+
+					if (lag->presents > 0)
+						im_text(MTY_SprintfDL("%.1f ms (%.1f-%.1f)", lag->ms, lag->ms_min, lag->ms_max));
+
+					im_text(MTY_SprintfDL("Latched after %.2f ms", lag->latch_ms));
+					im_text(MTY_SprintfDL("%u samples, %u ignored, %u no response",
+						lag->responses, lag->ignored, lag->timeouts));
+				}
 
 				im_end_menu();
 			}
@@ -244,6 +518,9 @@ static void ui_menu(const struct ui_args *args, struct app_event *event)
 			if (im_menu_item("Background Pause", "", args->cfg->bg_pause))
 				event->cfg.bg_pause = !event->cfg.bg_pause;
 
+			if (im_menu_item("Separate Core Process", "", args->cfg->isolate_core))
+				event->cfg.isolate_core = !event->cfg.isolate_core;
+
 			#if defined(_WIN32)
 			if (im_menu_item("Console Window", "", args->cfg->console))
 				event->cfg.console = !event->cfg.console;
@@ -302,17 +579,15 @@ static void ui_menu(const struct ui_args *args, struct app_event *event)
 				event->rt = true;
 			}
 
-			uint32_t vlen = 0;
-			const struct core_variable *vars = core_get_variables(args->core, &vlen);
+			uint32_t vlen = args->num_variables;
+			const struct core_variable *vars = args->variables;
 
 			if (vlen > 0)
 				im_separator();
 
 			for (uint32_t x = 0; x < vlen; x++) {
 				if (im_begin_menu(vars[x].desc, true)) {
-					const char *cur = core_get_variable(args->core, vars[x].key);
-					if (!cur)
-						cur = vars[x].opts[0];
+					const char *cur = args->values[x];
 
 					for (uint32_t y = 0; y < vars[x].nopts; y++) {
 						if (im_menu_item(vars[x].opts[y], "", !strcmp(cur, vars[x].opts[y]))) {
@@ -439,6 +714,16 @@ static void ui_menu(const struct ui_args *args, struct app_event *event)
 			im_end_menu();
 		}
 
+		if (args->search.available && args->game_loaded && im_begin_menu("Cheats", true)) {
+			ui_cheats(args, event);
+			im_end_menu();
+		}
+
+		if (args->game_loaded && im_begin_menu("Movie", true)) {
+			ui_movie(args, event);
+			im_end_menu();
+		}
+
 		im_end_main_menu();
 	}
 }
@@ -465,12 +750,14 @@ static void ui_hotkeys(const struct ui_args *args, struct app_event *event)
 	if (im_key(MTY_KEY_P) && im_ctrl())
 		event->type = APP_EVENT_PAUSE;
 
-	if (im_key(MTY_KEY_R) && im_ctrl())
-		core_reset_game(args->core);
+	if (im_key(MTY_KEY_R) && im_ctrl()) {
+		event->type = APP_EVENT_RESET;
+		event->rt = true;
+	}
 
 	if (im_key(MTY_KEY_T) && im_ctrl()) {
-		const char *name = core_get_game_path(args->core);
-		if (name) {
+		const char *name = args->game_path;
+		if (name[0]) {
 			event->type = APP_EVENT_LOAD_GAME;
 			event->fetch_core = true;
 			event->rt = true;
@@ -482,11 +769,10 @@ static void ui_hotkeys(const struct ui_args *args, struct app_event *event)
 		event->cfg.mute = !event->cfg.mute;
 
 	for (uint8_t x = 0; x < 8; x++) {
-		if (im_key(MTY_KEY_1 + x) && im_ctrl()) {
-			ui_load_state(args->core, args->content_name, x + 1);
-
-		} else if (im_key(MTY_KEY_1 + x)) {
-			ui_save_state(args->core, args->content_name, x + 1);
+		if (im_key(MTY_KEY_1 + x)) {
+			event->type = im_ctrl() ? APP_EVENT_LOAD_STATE : APP_EVENT_SAVE_STATE;
+			event->slot = x + 1;
+			event->rt = true;
 		}
 	}
 }
@@ -526,6 +812,9 @@ void ui_root(const struct ui_args *args,
 	im_push_style_f2(ImGuiStyleVar_FramePadding,    X(10), X(6));
 	im_push_style_f2(ImGuiStyleVar_WindowPadding,   X(10), X(10));
 
+	if (MTY_Atomic32CAS(&UI_CLOSE_MENU, 1, 0))
+		CMP.nav = NAV_NONE;
+
 	ui_hotkeys(args, &event);
 
 	if (args->show_menu)
@@ -553,14 +842,17 @@ void ui_root(const struct ui_args *args,
 
 void ui_close_menu(void)
 {
-	CMP.nav = NAV_NONE;
+	MTY_Atomic32Set(&UI_CLOSE_MENU, 1);
 }
 
 void ui_destroy(void)
 {
 	MTY_FreeFileList(&CMP.fl);
 
-	free(CMP.msg);
+	ui_lock();
 
+	free(CMP.msg);
 	memset(&CMP, 0, sizeof(struct component_state));
+
+	ui_unlock();
 }
@@ -8,9 +8,15 @@
 
 #include "config.h"
 #include "core.h"
+#include "latency.h"
+#include "pace.h"
+#include "rewind.h"
+#include "search.h"
 
 #define UI_LOG_LEN  128
 
+#define UI_SEARCH_RESULTS 32
+
 #define APP_TITLE_MAX 1024
 
 enum app_event_type {
@@ -24,6 +30,23 @@ enum app_event_type {
 	APP_EVENT_GFX         = 7,
 	APP_EVENT_CORE_OPT    = 8,
 	APP_EVENT_CLEAR_OPTS  = 9,
+	APP_EVENT_MOVIE_REC   = 10,
+	APP_EVENT_MOVIE_PLAY  = 11,
+	APP_EVENT_MOVIE_STOP  = 12,
+	APP_EVENT_MOVIE_SEEK  = 13,
+	APP_EVENT_RESET       = 14,
+	APP_EVENT_SAVE_STATE  = 15,
+	APP_EVENT_LOAD_STATE  = 16,
+	APP_EVENT_SEARCH      = 17,
+};
+
+enum app_search_op {
+	APP_SEARCH_START        = 0,
+	APP_SEARCH_FILTER       = 1,
+	APP_SEARCH_LIVE         = 2,
+	APP_SEARCH_FREEZE       = 3,
+	APP_SEARCH_UNFREEZE     = 4,
+	APP_SEARCH_UNFREEZE_ALL = 5,
 };
 
 struct app_event {
@@ -40,18 +63,59 @@ struct app_event {
 		char val[CORE_OPT_NAME_MAX];
 	} opt;
 	bool fetch_core;
+	int64_t seek;
+	uint8_t slot;
+	struct {
+		enum app_search_op op;
+		enum search_size size;
+		enum search_cmp cmp;
+		bool prev;
+		bool enabled;
+		uint64_t address;
+		uint32_t value;
+	} search;
+};
+
+struct ui_search {
+	bool available;
+	bool active;
+	bool live;
+	enum search_size size;
+	uint64_t count;
+	uint32_t num_results;
+	struct search_result results[UI_SEARCH_RESULTS];
+	bool frozen[UI_SEARCH_RESULTS];
+};
+
+struct ui_movie {
+	bool active;
+	bool recording;
+	uint64_t frame;
+	uint64_t length;
 };
 
 struct ui_args {
 	const struct config *cfg;
 	const MTY_JSON *systems;
-	const char *content_name;
 	bool paused;
 	bool show_menu;
 	bool fullscreen;
 	MTY_GFX gfx;
+	float rewind_cost;
+	struct rewind_stats rewind;
+	struct pace_stats pace;
+	struct latency_stats latency;
 
-	struct core *core;
+	// Copied from the emulation thread under a short lock, the UI is built
+	// without holding the core and drives it only through events
+	bool game_loaded;
+	double frame_rate;
+	char game_path[MTY_PATH_MAX];
+	const struct core_variable *variables;
+	const char (*values)[CORE_OPT_NAME_MAX];
+	uint32_t num_variables;
+	struct ui_search search;
+	struct ui_movie movie;
 };
 
 void ui_root(const struct ui_args *args,
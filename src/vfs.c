@@ -0,0 +1,738 @@
+// Copyright (c) Christopher D. Dickson <cdd@matoya.group>
+//
+// This Source Code Form is subject to the terms of the MIT License.
+// If a copy of the MIT License was not distributed with this file,
+// You can obtain one at https://spdx.org/licenses/MIT.html.
+
+// pread and pwrite are XSI in POSIX.1-2001
+#if !defined(_WIN32)
+	#define _XOPEN_SOURCE 700
+#endif
+
+#include "vfs.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "matoya.h"
+#include "deps/libretro.h"
+#include "fmap.h"
+
+#if defined(_WIN32)
+	#include <windows.h>
+
+	typedef HANDLE VFS_FD;
+	#define VFS_FD_NONE INVALID_HANDLE_VALUE
+#else
+	#include <fcntl.h>
+	#include <unistd.h>
+
+	typedef int32_t VFS_FD;
+	#define VFS_FD_NONE -1
+#endif
+
+#if !defined(S_ISDIR)
+	#define S_ISDIR(m) (((m) & S_IFMT) == S_IFDIR)
+#endif
+
+#if !defined(S_ISCHR)
+	#define S_ISCHR(m) (((m) & S_IFMT) == S_IFCHR)
+#endif
+
+#define VFS_DIRS_MAX 16
+#define VFS_DIR_TTL  1000.0f
+
+struct vfs_entry {
+	char *name;
+	bool dir;
+};
+
+struct vfs_listing {
+	char *path;
+	MTY_Time stamp;
+	struct vfs_entry *entries;
+	uint32_t len;
+};
+
+struct retro_vfs_file_handle {
+	char *path;
+	unsigned mode;
+
+	// Read only files are mapped so reads and seeks never leave user space,
+	// everything else goes through positional reads and writes on a raw
+	// descriptor so there is never a separate seek syscall
+	struct fmap *map;
+	const uint8_t *data;
+	VFS_FD fd;
+
+	int64_t pos;
+	int64_t size;
+};
+
+struct retro_vfs_dir_handle {
+	struct vfs_listing list;
+	int64_t index;
+};
+
+static struct {
+	MTY_Atomic64 calls;
+	MTY_Atomic64 syscalls;
+	MTY_Atomic64 mapped_reads;
+	MTY_Atomic64 bytes_read;
+	MTY_Atomic64 dir_reads;
+	MTY_Atomic64 dir_cache_hits;
+} VFS_STATS;
+
+static MTY_Atomic32 VFS_LOCK;
+static struct vfs_listing VFS_DIRS[VFS_DIRS_MAX];
+static uint32_t VFS_DIRS_NEXT;
+
+#define VFS_COUNT(field, n) \
+	MTY_Atomic64Add(&VFS_STATS.field, n)
+
+
+// OS, each wrapper is exactly one call into the OS and counts itself
+
+#if defined(_WIN32)
+
+static VFS_FD vfs_os_open(const char *path, unsigned mode)
+{
+	DWORD access = ((mode & RETRO_VFS_FILE_ACCESS_READ) ? GENERIC_READ : 0) |
+		((mode & RETRO_VFS_FILE_ACCESS_WRITE) ? GENERIC_WRITE : 0);
+
+	DWORD disp = !(mode & RETRO_VFS_FILE_ACCESS_WRITE) ? OPEN_EXISTING :
+		(mode & RETRO_VFS_FILE_ACCESS_UPDATE_EXISTING) ? OPEN_ALWAYS : CREATE_ALWAYS;
+
+	WCHAR *wpath = MTY_MultiToWideD(path);
+	HANDLE fd = CreateFileW(wpath, access, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, disp,
+		FILE_ATTRIBUTE_NORMAL, NULL);
+	MTY_Free(wpath);
+	VFS_COUNT(syscalls, 1);
+
+	return fd;
+}
+
+static void vfs_os_close(VFS_FD fd)
+{
+	CloseHandle(fd);
+	VFS_COUNT(syscalls, 1);
+}
+
+static int64_t vfs_os_size(VFS_FD fd)
+{
+	LARGE_INTEGER size = {0};
+	VFS_COUNT(syscalls, 1);
+
+	return GetFileSizeEx(fd, &size) ? size.QuadPart : -1;
+}
+
+static int64_t vfs_os_pread(VFS_FD fd, void *buf, uint64_t len, int64_t offset)
+{
+	VFS_COUNT(syscalls, 1);
+
+	OVERLAPPED ov = {0};
+	ov.Offset = (DWORD) offset;
+	ov.OffsetHigh = (DWORD) (offset >> 32);
+
+	DWORD n = 0;
+	if (!ReadFile(fd, buf, len > MAXDWORD ? MAXDWORD : (DWORD) len, &n, &ov))
+		return GetLastError() == ERROR_HANDLE_EOF ? 0 : -1;
+
+	return n;
+}
+
+static int64_t vfs_os_pwrite(VFS_FD fd, const void *buf, uint64_t len, int64_t offset)
+{
+	VFS_COUNT(syscalls, 1);
+
+	OVERLAPPED ov = {0};
+	ov.Offset = (DWORD) offset;
+	ov.OffsetHigh = (DWORD) (offset >> 32);
+
+	DWORD n = 0;
+	if (!WriteFile(fd, buf, len > MAXDWORD ? MAXDWORD : (DWORD) len, &n, &ov))
+		return -1;
+
+	return n;
+}
+
+static bool vfs_os_truncate(VFS_FD fd, int64_t length)
+{
+	FILE_END_OF_FILE_INFO info = {0};
+	info.EndOfFile.QuadPart = length;
+	VFS_COUNT(syscalls, 1);
+
+	return SetFileInformationByHandle(fd, FileEndOfFileInfo, &info, sizeof(FILE_END_OF_FILE_INFO));
+}
+
+static bool vfs_os_mkdir(const char *dir)
+{
+	WCHAR *wdir = MTY_MultiToWideD(dir);
+	BOOL r = CreateDirectoryW(wdir, NULL);
+	MTY_Free(wdir);
+	VFS_COUNT(syscalls, 1);
+
+	return r;
+}
+
+#else
+
+static VFS_FD vfs_os_open(const char *path, unsigned mode)
+{
+	int32_t flags = O_RDONLY;
+
+	if ((mode & RETRO_VFS_FILE_ACCESS_READ_WRITE) == RETRO_VFS_FILE_ACCESS_READ_WRITE) {
+		flags = O_RDWR | O_CREAT;
+
+	} else if (mode & RETRO_VFS_FILE_ACCESS_WRITE) {
+		flags = O_WRONLY | O_CREAT;
+	}
+
+	if ((mode & RETRO_VFS_FILE_ACCESS_WRITE) && !(mode & RETRO_VFS_FILE_ACCESS_UPDATE_EXISTING))
+		flags |= O_TRUNC;
+
+	VFS_COUNT(syscalls, 1);
+
+	return open(path, flags, 0644);
+}
+
+static void vfs_os_close(VFS_FD fd)
+{
+	VFS_COUNT(syscalls, 1);
+
+	close(fd);
+}
+
+static int64_t vfs_os_size(VFS_FD fd)
+{
+	VFS_COUNT(syscalls, 1);
+
+	struct stat st;
+
+	return fstat(fd, &st) == 0 ? (int64_t) st.st_size : -1;
+}
+
+static int64_t vfs_os_pread(VFS_FD fd, void *buf, uint64_t len, int64_t offset)
+{
+	VFS_COUNT(syscalls, 1);
+
+	return pread(fd, buf, (size_t) len, (off_t) offset);
+}
+
+static int64_t vfs_os_pwrite(VFS_FD fd, const void *buf, uint64_t len, int64_t offset)
+{
+	VFS_COUNT(syscalls, 1);
+
+	return pwrite(fd, buf, (size_t) len, (off_t) offset);
+}
+
+static bool vfs_os_truncate(VFS_FD fd, int64_t length)
+{
+	VFS_COUNT(syscalls, 1);
+
+	return ftruncate(fd, (off_t) length) == 0;
+}
+
+static bool vfs_os_mkdir(const char *dir)
+{
+	VFS_COUNT(syscalls, 1);
+
+	return mkdir(dir, 0755) == 0;
+}
+
+#endif
+
+static int32_t vfs_os_stat(const char *path, struct stat *st)
+{
+	VFS_COUNT(syscalls, 1);
+
+	return stat(path, st);
+}
+
+
+// Directory cache
+
+static void vfs_lock(void)
+{
+	while (!MTY_Atomic32CAS(&VFS_LOCK, 0, 1))
+		MTY_Sleep(0);
+}
+
+static void vfs_unlock(void)
+{
+	MTY_Atomic32Set(&VFS_LOCK, 0);
+}
+
+static void vfs_free_listing(struct vfs_listing *list)
+{
+	for (uint32_t x = 0; x < list->len; x++)
+		MTY_Free(list->entries[x].name);
+
+	MTY_Free(list->entries);
+	MTY_Free(list->path);
+
+	memset(list, 0, sizeof(struct vfs_listing));
+}
+
+static bool vfs_read_listing(struct vfs_listing *list, const char *dir)
+{
+	MTY_FileList *fl = MTY_GetFileList(dir, NULL);
+
+	// Even an empty directory lists its parent
+	if (!fl || fl->len == 0) {
+		MTY_FreeFileList(&fl);
+		return false;
+	}
+
+	// How many syscalls a listing takes is up to libmatoya, so listings are
+	// counted on their own
+	VFS_COUNT(dir_reads, 1);
+
+	list->path = MTY_Strdup(dir);
+	list->stamp = MTY_GetTime();
+	list->entries = MTY_Alloc(fl->len, sizeof(struct vfs_entry));
+
+	for (uint32_t x = 0; x < fl->len; x++) {
+		const char *name = fl->files[x].name;
+
+		if (!strcmp(name, ".") || !strcmp(name, ".."))
+			continue;
+
+		list->entries[list->len].name = MTY_Strdup(name);
+		list->entries[list->len].dir = fl->files[x].dir;
+		list->len++;
+	}
+
+	MTY_FreeFileList(&fl);
+
+	return true;
+}
+
+static void vfs_copy_listing(struct vfs_listing *dst, const struct vfs_listing *src, bool include_hidden)
+{
+	dst->path = MTY_Strdup(src->path);
+	dst->entries = MTY_Alloc(src->len + 1, sizeof(struct vfs_entry));
+
+	for (uint32_t x = 0; x < src->len; x++) {
+		if (!include_hidden && src->entries[x].name[0] == '.')
+			continue;
+
+		dst->entries[dst->len].name = MTY_Strdup(src->entries[x].name);
+		dst->entries[dst->len].dir = src->entries[x].dir;
+		dst->len++;
+	}
+}
+
+void vfs_clear_dir_cache(void)
+{
+	vfs_lock();
+
+	for (uint32_t x = 0; x < VFS_DIRS_MAX; x++)
+		vfs_free_listing(&VFS_DIRS[x]);
+
+	vfs_unlock();
+}
+
+
+// File API
+
+static const char *vfs_get_path(struct retro_vfs_file_handle *ctx)
+{
+	VFS_COUNT(calls, 1);
+
+	return ctx->path;
+}
+
+static int vfs_close(struct retro_vfs_file_handle *ctx)
+{
+	VFS_COUNT(calls, 1);
+
+	if (!ctx)
+		return -1;
+
+	if (ctx->map) {
+		fmap_close(&ctx->map);
+
+	} else {
+		vfs_os_close(ctx->fd);
+	}
+
+	MTY_Free(ctx->path);
+	MTY_Free(ctx);
+
+	return 0;
+}
+
+static struct retro_vfs_file_handle *vfs_open(const char *path, unsigned mode, unsigned hints)
+{
+	VFS_COUNT(calls, 1);
+
+	if (!path || !(mode & RETRO_VFS_FILE_ACCESS_READ_WRITE))
+		return NULL;
+
+	struct retro_vfs_file_handle *ctx = MTY_Alloc(1, sizeof(struct retro_vfs_file_handle));
+	ctx->path = MTY_Strdup(path);
+	ctx->mode = mode;
+	ctx->fd = VFS_FD_NONE;
+
+	if (mode == RETRO_VFS_FILE_ACCESS_READ) {
+		ctx->map = fmap_open_counted(path, false, &VFS_STATS.syscalls);
+
+		if (ctx->map) {
+			ctx->data = fmap_get_data(ctx->map);
+			ctx->size = (int64_t) fmap_get_size(ctx->map);
+
+			if (hints & RETRO_VFS_FILE_ACCESS_HINT_FREQUENT_ACCESS)
+				fmap_will_need(ctx->map);
+
+			return ctx;
+		}
+	}
+
+	// Writing may create the file
+	if (mode & RETRO_VFS_FILE_ACCESS_WRITE)
+		vfs_clear_dir_cache();
+
+	ctx->fd = vfs_os_open(path, mode);
+	if (ctx->fd == VFS_FD_NONE)
+		goto except;
+
+	ctx->size = vfs_os_size(ctx->fd);
+	if (ctx->size < 0) {
+		vfs_os_close(ctx->fd);
+		goto except;
+	}
+
+	return ctx;
+
+	except:
+
+	MTY_Free(ctx->path);
+	MTY_Free(ctx);
+
+	return NULL;
+}
+
+static int64_t vfs_size(struct retro_vfs_file_handle *ctx)
+{
+	VFS_COUNT(calls, 1);
+
+	return ctx ? ctx->size : -1;
+}
+
+static int64_t vfs_truncate(struct retro_vfs_file_handle *ctx, int64_t length)
+{
+	VFS_COUNT(calls, 1);
+
+	if (!ctx || ctx->map || length < 0)
+		return -1;
+
+	if (!vfs_os_truncate(ctx->fd, length))
+		return -1;
+
+	ctx->size = length;
+
+	return 0;
+}
+
+static int64_t vfs_tell(struct retro_vfs_file_handle *ctx)
+{
+	VFS_COUNT(calls, 1);
+
+	return ctx ? ctx->pos : -1;
+}
+
+static int64_t vfs_seek(struct retro_vfs_file_handle *ctx, int64_t offset, int seek_position)
+{
+	VFS_COUNT(calls, 1);
+
+	if (!ctx)
+		return -1;
+
+	int64_t pos = -1;
+
+	switch (seek_position) {
+		case RETRO_VFS_SEEK_POSITION_START:   pos = offset;             break;
+		case RETRO_VFS_SEEK_POSITION_CURRENT: pos = ctx->pos + offset;  break;
+		case RETRO_VFS_SEEK_POSITION_END:     pos = ctx->size + offset; break;
+	}
+
+	if (pos < 0)
+		return -1;
+
+	ctx->pos = pos;
+
+	return pos;
+}
+
+static int64_t vfs_read(struct retro_vfs_file_handle *ctx, void *s, uint64_t len)
+{
+	VFS_COUNT(calls, 1);
+
+	if (!ctx || !(ctx->mode & RETRO_VFS_FILE_ACCESS_READ))
+		return -1;
+
+	int64_t n = 0;
+
+	if (ctx->data) {
+		if (ctx->pos < ctx->size) {
+			uint64_t avail = (uint64_t) (ctx->size - ctx->pos);
+			n = (int64_t) (len < avail ? len : avail);
+
+			memcpy(s, ctx->data + ctx->pos, (size_t) n);
+		}
+
+		VFS_COUNT(mapped_reads, 1);
+
+	} else {
+		n = vfs_os_pread(ctx->fd, s, len, ctx->pos);
+		if (n < 0)
+			return -1;
+	}
+
+	ctx->pos += n;
+	VFS_COUNT(bytes_read, n);
+
+	return n;
+}
+
+static int64_t vfs_write(struct retro_vfs_file_handle *ctx, const void *s, uint64_t len)
+{
+	VFS_COUNT(calls, 1);
+
+	if (!ctx || ctx->map || !(ctx->mode & RETRO_VFS_FILE_ACCESS_WRITE))
+		return -1;
+
+	int64_t n = vfs_os_pwrite(ctx->fd, s, len, ctx->pos);
+	if (n < 0)
+		return -1;
+
+	ctx->pos += n;
+
+	if (ctx->pos > ctx->size)
+		ctx->size = ctx->pos;
+
+	return n;
+}
+
+static int vfs_flush(struct retro_vfs_file_handle *ctx)
+{
+	VFS_COUNT(calls, 1);
+
+	// Nothing is buffered on our side
+	return ctx ? 0 : -1;
+}
+
+static int vfs_remove(const char *path)
+{
+	VFS_COUNT(calls, 1);
+
+	vfs_clear_dir_cache();
+
+	int32_t r = remove(path);
+	VFS_COUNT(syscalls, 1);
+
+	return r == 0 ? 0 : -1;
+}
+
+static int vfs_rename(const char *old_path, const char *new_path)
+{
+	VFS_COUNT(calls, 1);
+
+	vfs_clear_dir_cache();
+
+	int32_t r = rename(old_path, new_path);
+	VFS_COUNT(syscalls, 1);
+
+	return r == 0 ? 0 : -1;
+}
+
+static int vfs_stat(const char *path, int32_t *size)
+{
+	VFS_COUNT(calls, 1);
+
+	struct stat st;
+	if (vfs_os_stat(path, &st) != 0)
+		return 0;
+
+	if (size)
+		*size = (int32_t) st.st_size;
+
+	int32_t flags = RETRO_VFS_STAT_IS_VALID;
+
+	if (S_ISDIR(st.st_mode))
+		flags |= RETRO_VFS_STAT_IS_DIRECTORY;
+
+	if (S_ISCHR(st.st_mode))
+		flags |= RETRO_VFS_STAT_IS_CHARACTER_SPECIAL;
+
+	return flags;
+}
+
+static int vfs_mkdir(const char *dir)
+{
+	VFS_COUNT(calls, 1);
+
+	struct stat st;
+	if (vfs_os_stat(dir, &st) == 0)
+		return S_ISDIR(st.st_mode) ? -2 : -1;
+
+	vfs_clear_dir_cache();
+
+	return vfs_os_mkdir(dir) ? 0 : -1;
+}
+
+
+// Directory API
+
+static struct retro_vfs_dir_handle *vfs_opendir(const char *dir, bool include_hidden)
+{
+	VFS_COUNT(calls, 1);
+
+	if (!dir)
+		return NULL;
+
+	struct retro_vfs_dir_handle *ctx = MTY_Alloc(1, sizeof(struct retro_vfs_dir_handle));
+	ctx->index = -1;
+
+	vfs_lock();
+
+	const struct vfs_listing *cached = NULL;
+
+	// Changes made through the VFS invalidate the cache right away, the TTL
+	// covers changes made behind its back
+	for (uint32_t x = 0; x < VFS_DIRS_MAX && !cached; x++) {
+		struct vfs_listing *list = &VFS_DIRS[x];
+
+		if (list->path && !strcmp(list->path, dir)) {
+			if (MTY_TimeDiff(list->stamp, MTY_GetTime()) < VFS_DIR_TTL) {
+				cached = list;
+
+			} else {
+				vfs_free_listing(list);
+			}
+		}
+	}
+
+	if (cached) {
+		VFS_COUNT(dir_cache_hits, 1);
+
+	} else {
+		struct vfs_listing *slot = &VFS_DIRS[VFS_DIRS_NEXT];
+		vfs_free_listing(slot);
+
+		if (vfs_read_listing(slot, dir)) {
+			VFS_DIRS_NEXT = (VFS_DIRS_NEXT + 1) % VFS_DIRS_MAX;
+			cached = slot;
+		}
+	}
+
+	// Handles get their own copy so the cache can be invalidated at any time
+	if (cached)
+		vfs_copy_listing(&ctx->list, cached, include_hidden);
+
+	vfs_unlock();
+
+	if (!cached) {
+		MTY_Free(ctx);
+		return NULL;
+	}
+
+	return ctx;
+}
+
+static bool vfs_readdir(struct retro_vfs_dir_handle *ctx)
+{
+	VFS_COUNT(calls, 1);
+
+	if (!ctx || ctx->index >= (int64_t) ctx->list.len)
+		return false;
+
+	ctx->index++;
+
+	return ctx->index < (int64_t) ctx->list.len;
+}
+
+static const char *vfs_dirent_get_name(struct retro_vfs_dir_handle *ctx)
+{
+	VFS_COUNT(calls, 1);
+
+	if (!ctx || ctx->index < 0 || ctx->index >= (int64_t) ctx->list.len)
+		return NULL;
+
+	return ctx->list.entries[ctx->index].name;
+}
+
+static bool vfs_dirent_is_dir(struct retro_vfs_dir_handle *ctx)
+{
+	VFS_COUNT(calls, 1);
+
+	if (!ctx || ctx->index < 0 || ctx->index >= (int64_t) ctx->list.len)
+		return false;
+
+	return ctx->list.entries[ctx->index].dir;
+}
+
+static int vfs_closedir(struct retro_vfs_dir_handle *ctx)
+{
+	VFS_COUNT(calls, 1);
+
+	if (!ctx)
+		return -1;
+
+	vfs_free_listing(&ctx->list);
+	MTY_Free(ctx);
+
+	return 0;
+}
+
+
+// Public
+
+static struct retro_vfs_interface VFS_INTERFACE = {
+	.get_path        = vfs_get_path,
+	.open            = vfs_open,
+	.close           = vfs_close,
+	.size            = vfs_size,
+	.tell            = vfs_tell,
+	.seek            = vfs_seek,
+	.read            = vfs_read,
+	.write           = vfs_write,
+	.flush           = vfs_flush,
+	.remove          = vfs_remove,
+	.rename          = vfs_rename,
+	.truncate        = vfs_truncate,
+	.stat            = vfs_stat,
+	.mkdir           = vfs_mkdir,
+	.opendir         = vfs_opendir,
+	.readdir         = vfs_readdir,
+	.dirent_get_name = vfs_dirent_get_name,
+	.dirent_is_dir   = vfs_dirent_is_dir,
+	.closedir        = vfs_closedir,
+};
+
+struct retro_vfs_interface *vfs_get_interface(void)
+{
+	return &VFS_INTERFACE;
+}
+
+void vfs_get_stats(struct vfs_stats *stats)
+{
+	stats->calls = MTY_Atomic64Get(&VFS_STATS.calls);
+	stats->syscalls = MTY_Atomic64Get(&VFS_STATS.syscalls);
+	stats->mapped_reads = MTY_Atomic64Get(&VFS_STATS.mapped_reads);
+	stats->bytes_read = MTY_Atomic64Get(&VFS_STATS.bytes_read);
+	stats->dir_reads = MTY_Atomic64Get(&VFS_STATS.dir_reads);
+	stats->dir_cache_hits = MTY_Atomic64Get(&VFS_STATS.dir_cache_hits);
+}
+
+void vfs_reset_stats(void)
+{
+	MTY_Atomic64Set(&VFS_STATS.calls, 0);
+	MTY_Atomic64Set(&VFS_STATS.syscalls, 0);
+	MTY_Atomic64Set(&VFS_STATS.mapped_reads, 0);
+	MTY_Atomic64Set(&VFS_STATS.bytes_read, 0);
+	MTY_Atomic64Set(&VFS_STATS.dir_reads, 0);
+	MTY_Atomic64Set(&VFS_STATS.dir_cache_hits, 0);
+}
@@ -0,0 +1,29 @@
+// Copyright (c) Christopher D. Dickson <cdd@matoya.group>
+//
+// This Source Code Form is subject to the terms of the MIT License.
+// If a copy of the MIT License was not distributed with this file,
+// You can obtain one at https://spdx.org/licenses/MIT.html.
+
+#pragma once
+
+#include <stdint.h>
+
+#define VFS_VERSION 3
+
+struct retro_vfs_interface;
+
+// Calls are what cores asked for, syscalls are what actually reached the OS.
+// Directory listings go through libmatoya and are counted as dir_reads instead
+struct vfs_stats {
+	uint64_t calls;
+	uint64_t syscalls;
+	uint64_t mapped_reads;
+	uint64_t bytes_read;
+	uint64_t dir_reads;
+	uint64_t dir_cache_hits;
+};
+
+struct retro_vfs_interface *vfs_get_interface(void);
+void vfs_get_stats(struct vfs_stats *stats);
+void vfs_reset_stats(void);
+void vfs_clear_dir_cache(void);